@@ -0,0 +1,211 @@
+// Throughput benchmarks of the render paths.
+//
+//   make -C bench
+//   bench/bench_ayumi [--json FILE] [--seconds S]
+
+#include "aychip.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace uZX::Chip;
+
+namespace {
+
+constexpr int SAMPLE_RATE = 44100;
+constexpr double CLOCK = 1773400;
+constexpr int FPS = 50;
+constexpr int FRAMES = 500;    // 10 seconds of sound per run
+constexpr int TICKS_PER_FRAME = static_cast<int>(CLOCK / 8 / FPS);
+
+using Frame = std::array<uint8_t, 14>;
+
+// Register stream of a workload, R13 is only written where envelopeWrites is set
+struct Workload {
+    const char* name;
+    std::vector<Frame> frames;
+    std::vector<bool> envelopeWrites;
+};
+
+auto makeWorkloads() -> std::vector<Workload> {
+    std::vector<Workload> workloads;
+    auto constant = [&](const char* name, Frame frame) {
+        std::vector<bool> envelopeWrites(FRAMES, false);
+        envelopeWrites[0] = true;
+        workloads.push_back({name, std::vector<Frame>(FRAMES, frame), envelopeWrites});
+    };
+    //                 A tone    B tone    C tone    N   mixer  A   B   C   E period  shape
+    constant("silence", {0, 0,    0, 0,     0, 0,     0,  0x3f,  0,  0,  0,  0, 0,     0});
+    constant("tone",    {0xfe, 0, 0x7f, 1, 0xbe, 0,   0,  0x38,  15, 12, 10, 0, 0,     0});
+    constant("noise",   {0, 0,    0, 0,     0, 0,     7,  0x07,  15, 12, 10, 0, 0,     0});
+    constant("buzz",    {0xfe, 0, 0, 0,     0, 0,     0,  0x3e,  16, 0,  0,  0x20, 0,  0x08});
+
+    // Every register written every frame, a worst case for the kernel choice and the mixer
+    Workload dense {"dense", std::vector<Frame>(FRAMES), std::vector<bool>(FRAMES, true)};
+    uint32_t seed = 1;
+    for (auto& frame : dense.frames) {
+        for (auto& r : frame) {
+            seed = seed * 1664525 + 1013904223;
+            r = seed >> 24;
+        }
+        frame[13] &= 15;
+    }
+    workloads.push_back(std::move(dense));
+    return workloads;
+}
+
+// The same register writes as AyumiEmulator does, straight to the chip
+auto writeRegisters(ayumi& chip, const Frame& r, bool envelopeWrite) -> void {
+    for (int i = 0; i < TONE_CHANNELS; ++i) {
+        ayumi_set_tone(&chip, i, r[i * 2] | ((r[i * 2 + 1] & 15) << 8));
+        ayumi_set_mixer(&chip, i, (r[7] >> i) & 1, (r[7] >> (i + 3)) & 1, (r[8 + i] >> 4) & 1);
+        ayumi_set_volume(&chip, i, r[8 + i] & 15);
+    }
+    ayumi_set_noise(&chip, r[6] & 31);
+    ayumi_set_envelope(&chip, r[11] | (r[12] << 8));
+    if (envelopeWrite) {
+        ayumi_set_envelope_shape(&chip, r[13] & 15);
+    }
+}
+
+auto playRegisters(AYInterface& chip, const Frame& r, bool envelopeWrite) -> void {
+    bool mask[AYInterface::NUM_REGISTERS] = {};
+    mask[13] = !envelopeWrite;
+    chip.setRegisters(r.data(), mask);
+}
+
+struct Result {
+    std::string stage;
+    std::string workload;
+    std::string variant;
+    const char* unit;
+    double itemsPerSecond;
+};
+
+// Best rate of repeated runs of fn, which processes items units each run
+auto measure(double seconds, double items, const std::function<void()>& fn) -> double {
+    using Clock = std::chrono::steady_clock;
+    double best = 0;
+    const auto start = Clock::now();
+    do {
+        const auto begin = Clock::now();
+        fn();
+        const std::chrono::duration<double> elapsed = Clock::now() - begin;
+        best = std::max(best, items / elapsed.count());
+    } while (std::chrono::duration<double>(Clock::now() - start).count() < seconds);
+    return best;
+}
+
+// Chip logic alone: ayumi_update and ayumi_levels, which ayumi_process of the C code runs
+// every tick. Reported in chip ticks per second.
+auto benchChip(const Workload& w, double seconds) -> Result {
+    int levels[TONE_CHANNELS];
+    int sink = 0;
+    const double rate = measure(seconds, double(FRAMES) * TICKS_PER_FRAME, [&] {
+        ayumi chip {};
+        ayumi_configure(&chip, 0);
+        for (size_t i = 0; i < w.frames.size(); ++i) {
+            writeRegisters(chip, w.frames[i], w.envelopeWrites[i]);
+            for (int t = 0; t < TICKS_PER_FRAME; ++t) {
+                ayumi_tick(&chip, levels);
+                sink += levels[0];
+            }
+        }
+    });
+    // Keeps the levels alive, the result itself does not matter
+    if (sink == -1) {
+        std::puts("");
+    }
+    return {"chip", w.name, "", "ticks", rate};
+}
+
+// Frame by frame rendering, like render_psg of the wrapper
+template <typename Chip>
+auto benchRender(const char* stage, const std::string& variant, const Workload& w, double seconds,
+                 bool removeDC, const std::function<std::unique_ptr<Chip>()>& makeChip) -> Result {
+    const size_t samplesPerFrame = SAMPLE_RATE / FPS;
+    std::vector<float> left(samplesPerFrame);
+    std::vector<float> right(samplesPerFrame);
+    const double rate = measure(seconds, double(FRAMES) * samplesPerFrame, [&] {
+        auto chip = makeChip();
+        for (size_t i = 0; i < w.frames.size(); ++i) {
+            playRegisters(*chip, w.frames[i], w.envelopeWrites[i]);
+            chip->processBlock(left.data(), right.data(), samplesPerFrame, removeDC);
+        }
+    });
+    return {stage, w.name, variant, "samples", rate};
+}
+
+auto writeJson(const char* path, const std::vector<Result>& results) -> bool {
+    FILE* file = std::fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    std::fprintf(file, "{\n  \"sample_rate\": %d,\n  \"clock\": %.0f,\n  \"benchmarks\": [\n", SAMPLE_RATE, CLOCK);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        std::fprintf(file, "    {\"stage\": \"%s\", \"workload\": \"%s\", \"variant\": \"%s\", "
+                           "\"unit\": \"%s\", \"items_per_second\": %.1f}%s\n",
+                     r.stage.c_str(), r.workload.c_str(), r.variant.c_str(), r.unit, r.itemsPerSecond,
+                     i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    std::fclose(file);
+    return true;
+}
+
+} // namespace
+
+auto main(int argc, char** argv) -> int {
+    const char* jsonPath = nullptr;
+    double seconds = 0.5;
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--json") && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            seconds = std::atof(argv[++i]);
+        } else {
+            std::fprintf(stderr, "Usage: %s [--json FILE] [--seconds S]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<Result> results;
+    auto report = [&](Result result) {
+        std::printf("%-10s %-8s %-18s %8.2f M%s/s\n", result.stage.c_str(), result.workload.c_str(),
+                    result.variant.c_str(), result.itemsPerSecond / 1e6, result.unit);
+        std::fflush(stdout);
+        results.push_back(std::move(result));
+    };
+
+    for (const auto& w : makeWorkloads()) {
+        report(benchChip(w, seconds));
+        for (int p = 0; p < static_cast<int>(Precision::size()); ++p) {
+            for (int q = 0; q < static_cast<int>(Quality::size()); ++q) {
+                const Precision precision = p;
+                const Quality quality = q;
+                const auto variant = std::string(quality.getLabel()) + "/" + std::string(precision.getLabel());
+                auto makeChip = [&] {
+                    return std::make_unique<AyumiEmulator>(SAMPLE_RATE, CLOCK, AYInterface::TypeEnum::AY,
+                                                           precision, quality);
+                };
+                // The difference of the two is the DC filter
+                report(benchRender<AyumiEmulator>("render", variant, w, seconds, false, makeChip));
+                report(benchRender<AyumiEmulator>("render_dc", variant, w, seconds, true, makeChip));
+            }
+        }
+        report(benchRender<BlepEmulator>("blep_dc", "", w, seconds, true, [] {
+            return std::make_unique<BlepEmulator>(SAMPLE_RATE, CLOCK, AYInterface::TypeEnum::AY);
+        }));
+    }
+
+    if (jsonPath && !writeJson(jsonPath, results)) {
+        std::fprintf(stderr, "Can not write %s\n", jsonPath);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+"""Throughput of the Python entry points, run with
+
+    pytest benchmarks --benchmark-json=bench.json
+
+Every result has the rendered samples per second in extra_info.
+"""
+import pytest
+import numpy as np
+
+from pyayay import Ayumi, AyumiBatch, Blep, ChipType
+
+pytest.importorskip("pytest_benchmark")
+
+SAMPLE_RATE = 44100
+CLOCK = 1773400
+FPS = 50
+FRAMES = 500
+SAMPLES = SAMPLE_RATE * FRAMES // FPS
+
+#                    A tone      B tone      C tone      N  mixer  A   B   C   E period  shape
+CONSTANT = {
+    "silence": [0x00, 0, 0x00, 0, 0x00, 0, 0, 0x3f, 0,  0,  0,  0x00, 0, 0x00],
+    "tone":    [0xfe, 0, 0x7f, 1, 0xbe, 0, 0, 0x38, 15, 12, 10, 0x00, 0, 0x00],
+    "noise":   [0x00, 0, 0x00, 0, 0x00, 0, 7, 0x07, 15, 12, 10, 0x00, 0, 0x00],
+    "buzz":    [0xfe, 0, 0x00, 0, 0x00, 0, 0, 0x3e, 16, 0,  0,  0x20, 0, 0x08],
+}
+WORKLOADS = list(CONSTANT) + ["dense"]
+
+
+def workload(name, frames=FRAMES):
+    """PSG registers and mask of a workload, like the ones of bench/bench_ayumi.cpp"""
+    if name == "dense":
+        rng = np.random.default_rng(1)
+        psg = rng.integers(0, 256, size=(frames, 14), dtype=np.uint8)
+        psg[:, 13] &= 15
+        return psg, np.zeros((frames, 14), dtype=bool)
+    psg = np.tile(np.array(CONSTANT[name], dtype=np.uint8), (frames, 1))
+    mask = np.zeros((frames, 14), dtype=bool)
+    mask[1:, 13] = True
+    return psg, mask
+
+
+def report(benchmark, samples):
+    benchmark.extra_info["samples"] = samples
+    benchmark.extra_info["samples_per_second"] = samples / benchmark.stats.stats.min
+
+
+@pytest.mark.parametrize("quality", ["draft", "standard", "high"])
+@pytest.mark.parametrize("name", WORKLOADS)
+def test_render_psg(benchmark, name, quality):
+    psg, mask = workload(name)
+    left = np.zeros(SAMPLES, dtype=np.float32)
+    right = np.zeros(SAMPLES, dtype=np.float32)
+
+    def render():
+        Ayumi(SAMPLE_RATE, CLOCK, ChipType.AY, quality=quality).render_psg(psg, mask, left, right, FPS)
+
+    benchmark(render)
+    report(benchmark, SAMPLES)
+
+
+@pytest.mark.parametrize("name", WORKLOADS)
+def test_render_psg_blep(benchmark, name):
+    psg, mask = workload(name)
+    left = np.zeros(SAMPLES, dtype=np.float32)
+    right = np.zeros(SAMPLES, dtype=np.float32)
+
+    def render():
+        Blep(SAMPLE_RATE, CLOCK, ChipType.AY).render_psg(psg, mask, left, right, FPS)
+
+    benchmark(render)
+    report(benchmark, SAMPLES)
+
+
+@pytest.mark.parametrize("block", [64, 1024])
+def test_process_block(benchmark, block):
+    """Per-call overhead of the wrapper: a tone rendered in small and large blocks"""
+    ay = Ayumi(SAMPLE_RATE, CLOCK, ChipType.AY)
+    ay.set_registers(list(range(13)), CONSTANT["tone"][:13])
+    left = np.zeros(block, dtype=np.float32)
+    right = np.zeros(block, dtype=np.float32)
+    blocks = SAMPLES // block
+
+    def render():
+        for _ in range(blocks):
+            ay.process_block(left, right, block)
+
+    benchmark(render)
+    report(benchmark, blocks * block)
+
+
+def test_render_psg_batch_chips(benchmark):
+    chips = 16
+    psg = np.stack([workload("dense", FRAMES // 5)[0]] * chips)
+    mask = np.zeros(psg.shape, dtype=bool)
+    samples = SAMPLES // 5
+    left = np.zeros((chips, samples), dtype=np.float32)
+    right = np.zeros((chips, samples), dtype=np.float32)
+
+    def render():
+        AyumiBatch(chips, SAMPLE_RATE, CLOCK, ChipType.AY).render_psg(psg, mask, left, right, FPS)
+
+    benchmark(render)
+    report(benchmark, chips * samples)
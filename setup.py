@@ -1,3 +1,5 @@
+import os
+
 from setuptools import setup, Extension
 from pybind11.setup_helpers import Pybind11Extension, build_ext
 
@@ -6,9 +8,17 @@ ext_modules = [
         "pyayay",
         sources = [
             "src/wrapper.cpp",
+            "src/analysis.cpp",
             "src/aychip.cpp",
+            "src/psgloops.cpp",
+            "src/randompsg.cpp",
+            "src/realtime.cpp",
+            "src/songfile.cpp",
+            "src/lha.cpp",
         ],
         include_dirs = ["src"],
+        # PYAYAY_STATS=1 pip install . builds in the render counters of Ayumi.stats()
+        define_macros = [("PYAYAY_STATS", os.environ.get("PYAYAY_STATS", "0"))],
     ),
 ]
 
@@ -0,0 +1,212 @@
+#include "analysis.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace uZX::Chip {
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+constexpr float MIN_POWER = 1e-10f;    // -100 dB
+
+auto hzToMel(double hz) -> double {
+    return 2595 * std::log10(1 + hz / 700);
+}
+
+auto melToHz(double mel) -> double {
+    return 700 * (std::pow(10.0, mel / 2595) - 1);
+}
+
+auto toDecibels(float power) -> float {
+    return 10 * std::log10(std::max(power, MIN_POWER));
+}
+
+} // namespace
+
+AudioAnalyzer::AudioAnalyzer(int sampleRate, const AnalysisConfig& config)
+    : Config_(config)
+{
+    const size_t n = config.fftSize;
+    if (n < 16 || (n & (n - 1)) != 0) {
+        throw std::invalid_argument("FFT size must be a power of two, at least 16");
+    }
+    if (config.hopSize == 0 || config.numMels == 0) {
+        throw std::invalid_argument("Hop size and number of mels must be positive");
+    }
+    const double nyquist = sampleRate / 2.0;
+    if (Config_.melMax == 0) {
+        Config_.melMax = nyquist;
+    }
+    if (!(Config_.melMin >= 0 && Config_.melMin < Config_.melMax && Config_.melMax <= nyquist)) {
+        throw std::invalid_argument("Mel range must be within 0 and the Nyquist frequency and not empty");
+    }
+
+    // Periodic Hann window
+    Window_.resize(n);
+    double windowSum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        Window_[i] = static_cast<float>(0.5 - 0.5 * std::cos(2 * PI * i / n));
+        windowSum += Window_[i];
+    }
+    PowerScale_ = static_cast<float>(4 / (windowSum * windowSum));
+
+    const size_t half = n / 2;
+    size_t bits = 0;
+    while ((size_t {1} << bits) < half) {
+        ++bits;
+    }
+    BitReverse_.resize(half);
+    for (size_t i = 0; i < half; ++i) {
+        size_t r = 0;
+        for (size_t b = 0; b < bits; ++b) {
+            r |= (i >> b & 1) << (bits - 1 - b);
+        }
+        BitReverse_[i] = r;
+    }
+    Twiddles_.resize(half);
+    for (size_t k = 0; k < half; ++k) {
+        Twiddles_[k] = std::polar(1.0f, static_cast<float>(-2 * PI * k / n));
+    }
+
+    // Triangles evenly spaced on the HTK mel scale, with a peak of 1
+    const double melLow = hzToMel(Config_.melMin);
+    const double melHigh = hzToMel(Config_.melMax);
+    std::vector<double> edges(config.numMels + 2);
+    for (size_t j = 0; j < edges.size(); ++j) {
+        edges[j] = melToHz(melLow + (melHigh - melLow) * j / (config.numMels + 1));
+    }
+    const double binHz = static_cast<double>(sampleRate) / n;
+    Mels_.resize(config.numMels);
+    for (size_t m = 0; m < config.numMels; ++m) {
+        const double lo = edges[m];
+        const double center = edges[m + 1];
+        const double hi = edges[m + 2];
+        MelBand& band = Mels_[m];
+        band.firstBin = static_cast<size_t>(std::floor(lo / binHz)) + 1;
+        for (size_t k = band.firstBin; k <= half && k * binHz < hi; ++k) {
+            const double f = k * binHz;
+            band.weights.push_back(static_cast<float>(f <= center ? (f - lo) / (center - lo) : (hi - f) / (hi - center)));
+        }
+    }
+
+    Fft_.resize(half);
+    Power_.resize(half + 1);
+}
+
+auto AudioAnalyzer::getNumWindows(size_t numSamples) const -> size_t {
+    return numSamples < Config_.fftSize ? 0 : (numSamples - Config_.fftSize) / Config_.hopSize + 1;
+}
+
+auto AudioAnalyzer::getNumBins() const -> size_t {
+    return Config_.fftSize / 2 + 1;
+}
+
+auto AudioAnalyzer::setOutputs(float* rms, float* peak, float* spectrum, float* mel) -> void {
+    Rms_ = rms;
+    Peak_ = peak;
+    Spectrum_ = spectrum;
+    Mel_ = mel;
+}
+
+auto AudioAnalyzer::addFrame(const float* stereo, size_t numSamples) -> void {
+    if (Rms_ || Peak_) {
+        double sum[2] = {};
+        float peak[2] = {};
+        for (size_t i = 0; i < numSamples; ++i) {
+            for (int side = 0; side < 2; ++side) {
+                const float x = stereo[i * 2 + side];
+                sum[side] += static_cast<double>(x) * x;
+                peak[side] = std::max(peak[side], std::abs(x));
+            }
+        }
+        for (int side = 0; side < 2; ++side) {
+            if (Rms_) {
+                const float rms = numSamples ? static_cast<float>(std::sqrt(sum[side] / numSamples)) : 0.0f;
+                Rms_[Frame_ * 2 + side] = rms;
+            }
+            if (Peak_) {
+                Peak_[Frame_ * 2 + side] = peak[side];
+            }
+        }
+    }
+    ++Frame_;
+
+    if (!Spectrum_ && !Mel_) {
+        return;
+    }
+    for (size_t i = 0; i < numSamples; ++i) {
+        Mono_.push_back(0.5f * (stereo[i * 2] + stereo[i * 2 + 1]));
+    }
+    while (Mono_.size() >= Start_ + Config_.fftSize) {
+        analyzeWindow();
+        Start_ += Config_.hopSize;
+    }
+    // Drops the samples no window needs any more, once they are a window long
+    const size_t used = std::min(Start_, Mono_.size());
+    if (used >= Config_.fftSize) {
+        Mono_.erase(Mono_.begin(), Mono_.begin() + used);
+        Start_ -= used;
+    }
+}
+
+auto AudioAnalyzer::analyzeWindow() -> void {
+    const float* x = Mono_.data() + Start_;
+    const size_t half = Config_.fftSize / 2;
+    // Real FFT of fftSize points as a complex FFT of the even and odd samples
+    for (size_t i = 0; i < half; ++i) {
+        Fft_[BitReverse_[i]] = {x[2 * i] * Window_[2 * i], x[2 * i + 1] * Window_[2 * i + 1]};
+    }
+    fft();
+    const std::complex<float> z0 = Fft_[0];
+    Power_[0] = (z0.real() + z0.imag()) * (z0.real() + z0.imag());
+    Power_[half] = (z0.real() - z0.imag()) * (z0.real() - z0.imag());
+    for (size_t k = 1; k < half; ++k) {
+        const std::complex<float> a = Fft_[k];
+        const std::complex<float> b = std::conj(Fft_[half - k]);
+        const std::complex<float> even = 0.5f * (a + b);
+        const std::complex<float> odd = std::complex<float>(0, -0.5f) * (a - b);
+        Power_[k] = std::norm(even + Twiddles_[k] * odd);
+    }
+    for (float& p : Power_) {
+        p *= PowerScale_;
+    }
+
+    if (Mel_) {
+        float* mel = Mel_ + WindowIndex_ * Mels_.size();
+        for (size_t m = 0; m < Mels_.size(); ++m) {
+            const MelBand& band = Mels_[m];
+            float sum = 0;
+            for (size_t j = 0; j < band.weights.size(); ++j) {
+                sum += band.weights[j] * Power_[band.firstBin + j];
+            }
+            mel[m] = Config_.decibels ? toDecibels(sum) : sum;
+        }
+    }
+    if (Spectrum_) {
+        float* spectrum = Spectrum_ + WindowIndex_ * Power_.size();
+        for (size_t k = 0; k < Power_.size(); ++k) {
+            spectrum[k] = Config_.decibels ? toDecibels(Power_[k]) : Power_[k];
+        }
+    }
+    ++WindowIndex_;
+}
+
+// In place radix-2 FFT of the bit reversed Fft_
+auto AudioAnalyzer::fft() -> void {
+    const size_t size = Fft_.size();
+    for (size_t len = 2; len <= size; len <<= 1) {
+        // Twiddles_ are of 2 * size points, so every step is 2 * size / len of them
+        const size_t step = 2 * size / len;
+        for (size_t i = 0; i < size; i += len) {
+            for (size_t j = 0; j < len / 2; ++j) {
+                const std::complex<float> t = Twiddles_[j * step] * Fft_[i + j + len / 2];
+                Fft_[i + j + len / 2] = Fft_[i + j] - t;
+                Fft_[i + j] += t;
+            }
+        }
+    }
+}
+
+} // namespace uZX::Chip
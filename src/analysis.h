@@ -0,0 +1,70 @@
+#pragma once
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+namespace uZX::Chip {
+
+/*****************************************************************************/
+/*  Features of rendered audio computed while it is rendered: levels per     */
+/*  PSG frame, power spectrogram and mel spectrogram                         */
+/*****************************************************************************/
+
+struct AnalysisConfig {
+    size_t fftSize = 1024;     // power of two, the Hann window length
+    size_t hopSize = 256;
+    size_t numMels = 64;
+    double melMin = 0;         // Hz
+    double melMax = 0;         // Hz, 0 is the Nyquist frequency
+    bool decibels = false;     // 10 log10 of the powers, floored at -100 dB
+};
+
+// Takes stereo audio PSG frame by PSG frame, as it is rendered, and writes the features to
+// the outputs given, nullptr outputs are not computed. Levels are per PSG frame and channel,
+// the spectrograms are of the mono mix, window w covers samples [w * hop, w * hop + fftSize).
+// Powers are scaled so that a sine of amplitude A has a peak of A^2.
+class AudioAnalyzer {
+public:
+    // Throws std::invalid_argument on a bad config
+    AudioAnalyzer(int sampleRate, const AnalysisConfig& config);
+
+    // Full windows in numSamples samples
+    auto getNumWindows(size_t numSamples) const -> size_t;
+    auto getNumBins() const -> size_t;
+    // rms and peak are (frames, 2), spectrum (windows, bins) and mel (windows, mels)
+    auto setOutputs(float* rms, float* peak, float* spectrum, float* mel) -> void;
+
+    // Adds the next PSG frame of numSamples interleaved stereo samples
+    auto addFrame(const float* stereo, size_t numSamples) -> void;
+
+private:
+    auto analyzeWindow() -> void;
+    auto fft() -> void;
+
+    struct MelBand {
+        size_t firstBin;
+        std::vector<float> weights;
+    };
+
+    AnalysisConfig Config_;
+    std::vector<float> Window_;
+    std::vector<size_t> BitReverse_;                // of the fftSize / 2 point complex FFT
+    std::vector<std::complex<float>> Twiddles_;     // e^-2pi i k / fftSize, k < fftSize / 2
+    std::vector<MelBand> Mels_;
+    float PowerScale_;
+
+    std::vector<float> Mono_;    // samples of the next windows, the next one starts at Start_
+    size_t Start_ = 0;
+    size_t Frame_ = 0;
+    size_t WindowIndex_ = 0;
+    std::vector<std::complex<float>> Fft_;
+    std::vector<float> Power_;
+
+    float* Rms_ = nullptr;
+    float* Peak_ = nullptr;
+    float* Spectrum_ = nullptr;
+    float* Mel_ = nullptr;
+};
+
+} // namespace uZX::Chip
@@ -3,26 +3,134 @@
 
 #include "aychip.h"
 
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <limits>
 #include <vector>
 
 
 namespace uZX::Chip {
 
+extern "C" {
+    #include "ayumi/ayumi.c"
+}
+
 namespace {
-    extern "C" {
-        #include "ayumi/ayumi.c"
+
+constexpr int ENVELOPE_SHAPE_REGISTER = 13;
+// Bits of R0-R13 that the chip has
+constexpr uint8_t REGISTER_MASKS[AYInterface::NUM_REGISTERS] = {
+    0xff, 0x0f, 0xff, 0x0f, 0xff, 0x0f, 0x1f, 0xff, 0x1f, 0x1f, 0x1f, 0xff, 0xff, 0x0f
+};
+
+// The chip turns periods of 0 into 1
+auto chipPeriod(int period) -> int {
+    return period ? period : 1;
+}
+
+} // namespace
+
+auto RegisterFile::write(ayumi& chip, int reg, uint8_t value) -> void {
+    value &= REGISTER_MASKS[reg];
+    if (value != Registers_[reg] || (Unwritten_ >> reg & 1) || reg == ENVELOPE_SHAPE_REGISTER) {
+        Registers_[reg] = value;
+        Unwritten_ &= ~(1u << reg);
+        apply(chip, 1u << reg);
+    }
+}
+
+auto RegisterFile::writeFrame(ayumi& chip, const uint8_t* values, const bool* mask) -> void {
+    unsigned dirty = 0;
+    for (int reg = 0; reg < NUM_REGISTERS; ++reg) {
+        const uint8_t value = values[reg] & REGISTER_MASKS[reg];
+        if ((!mask || !mask[reg]) && (value != Registers_[reg] || (Unwritten_ >> reg & 1) || reg == ENVELOPE_SHAPE_REGISTER)) {
+            Registers_[reg] = value;
+            dirty |= 1u << reg;
+        }
+    }
+    if (dirty) {
+        Unwritten_ &= ~dirty;
+        apply(chip, dirty);
     }
 }
 
-AyumiEmulator::AyumiEmulator(int sampleRate, double clock, ChipType type)
+// dirty has bit n set for every changed Rn
+auto RegisterFile::apply(ayumi& chip, unsigned dirty) const -> void {
+    const auto& r = Registers_;
+    for (int ch = 0; ch < TONE_CHANNELS; ++ch) {
+        if (dirty & (3u << (ch * 2))) {
+            ayumi_set_tone(&chip, ch, r[ch * 2] | (r[ch * 2 + 1] << 8));
+        }
+        // R7 bits: tone off A, B, C, then noise off A, B, C. Rn bit 4: envelope on
+        if (dirty & (1u << 7 | 1u << (8 + ch))) {
+            ayumi_set_mixer(&chip, ch, (r[7] >> ch) & 1, (r[7] >> (ch + 3)) & 1, (r[8 + ch] >> 4) & 1);
+            ayumi_set_volume(&chip, ch, r[8 + ch]);
+        }
+    }
+    if (dirty & (1u << 6)) {
+        ayumi_set_noise(&chip, r[6]);
+    }
+    if (dirty & (3u << 11)) {
+        ayumi_set_envelope(&chip, r[11] | (r[12] << 8));
+    }
+    if (dirty & (1u << ENVELOPE_SHAPE_REGISTER)) {
+        ayumi_set_envelope_shape(&chip, r[ENVELOPE_SHAPE_REGISTER]);
+    }
+}
+
+auto RegisterFile::sync(const ayumi& chip) -> void {
+    auto& r = Registers_;
+    uint8_t mixer = r[7] & 0xc0;    // I/O port directions, the chip does not have them
+    for (int ch = 0; ch < TONE_CHANNELS; ++ch) {
+        const auto& channel = chip.channels[ch];
+        if (chipPeriod(r[ch * 2] | (r[ch * 2 + 1] << 8)) != channel.tone_period) {
+            r[ch * 2] = channel.tone_period & 0xff;
+            r[ch * 2 + 1] = channel.tone_period >> 8;
+        }
+        mixer |= (channel.t_off & 1) << ch | (channel.n_off & 1) << (ch + 3);
+        r[8 + ch] = channel.volume | (channel.e_on ? 0x10 : 0);
+    }
+    r[7] = mixer;
+    if (chipPeriod(r[6]) != chip.noise_period) {
+        r[6] = chip.noise_period;
+    }
+    if (chipPeriod(r[11] | (r[12] << 8)) != chip.envelope_period) {
+        r[11] = chip.envelope_period & 0xff;
+        r[12] = chip.envelope_period >> 8;
+    }
+    r[ENVELOPE_SHAPE_REGISTER] = chip.envelope_shape;
+}
+
+
+AyumiEmulator::AyumiEmulator(int sampleRate, double clock, ChipType type, Precision precision, Quality quality,
+                             DcFilter dcFilter)
     : AYInterface()
+    , Engine_(makeAyumiEngine(precision, quality))
     , Pan_ {0.25, 0.75, 0.5}  // ACB is default
     , MasterVolume_(1.0)
 {
+    Engine_->setDcFilter(dcFilter);
     Reset(sampleRate, clock, type);
 }
 
+// Register accessors of AYInterface must point to the new object, so they are not copied
+AyumiEmulator::AyumiEmulator(const AyumiEmulator& other)
+    : AYInterface()
+    , Ayumi_(other.Ayumi_)
+    , Registers_(other.Registers_)
+    , Engine_(other.Engine_->clone())
+    , ChannelsEngine_(other.ChannelsEngine_ ? other.ChannelsEngine_->clone() : nullptr)
+    , Type_(other.Type_)
+    , ClockRate_(other.ClockRate_)
+    , SampleRate_(other.SampleRate_)
+    , Pan_ {other.Pan_[0], other.Pan_[1], other.Pan_[2]}
+    , IsEqp_ {other.IsEqp_[0], other.IsEqp_[1], other.IsEqp_[2]}
+    , MasterVolume_(other.MasterVolume_)
+    , Stats_(other.Stats_)
+{
+}
+
 AyumiEmulator::~AyumiEmulator() {
 
 }
@@ -31,13 +139,39 @@ auto AyumiEmulator::Reset(int sampleRate, double clock, ChipType type) -> void {
     SampleRate_ = sampleRate;
     ClockRate_ = clock;
     Type_ = type;
-    ayumi_configure(&Ayumi_, type, clock, sampleRate);
+    ayumi_configure(&Ayumi_, type);
+    Registers_ = RegisterFile();
+    Engine_->configure(Ayumi_.dac_table, clock, sampleRate);
+    // The counters of a dropped engine stay in the totals
+    if (ChannelsEngine_) {
+        Stats_ += ChannelsEngine_->getStats();
+    }
+    ChannelsEngine_.reset();
     for (int i = 0; i < TONE_CHANNELS; ++i) {
         setPan(i, Pan_[i]);
         setMixer(i, false, false, false);
     }
 }
 
+auto AyumiEmulator::getPrecision() const -> Precision {
+    return Engine_->getPrecision();
+}
+
+auto AyumiEmulator::getQuality() const -> Quality {
+    return Engine_->getQuality();
+}
+
+auto AyumiEmulator::setDcFilter(DcFilter filter) -> void {
+    Engine_->setDcFilter(filter);
+    if (ChannelsEngine_) {
+        ChannelsEngine_->setDcFilter(filter);
+    }
+}
+
+auto AyumiEmulator::getDcFilter() const -> DcFilter {
+    return Engine_->getDcFilter();
+}
+
 auto AyumiEmulator::canChangeClock() const -> bool {
     return true;
 }
@@ -50,8 +184,22 @@ auto AyumiEmulator::getClockValues() const -> std::vector<float> {
     return {};  // no values because canChangeClockContinously() == true
 }
 
+auto AyumiEmulator::retune(int sampleRate, double clock, ChipType type) -> void {
+    SampleRate_ = sampleRate;
+    ClockRate_ = clock;
+    Type_ = type;
+    ayumi_set_type(&Ayumi_, type);
+    Engine_->retune(Ayumi_.dac_table, clock, sampleRate);
+    if (ChannelsEngine_) {
+        ChannelsEngine_->retune(Ayumi_.dac_table, clock, sampleRate);
+    }
+    for (int i = 0; i < TONE_CHANNELS; ++i) {
+        setPan(i, Pan_[i], IsEqp_[i]);
+    }
+}
+
 auto AyumiEmulator::setSampleRate(int sampleRate) -> void {
-    Reset(sampleRate, ClockRate_, Type_);
+    retune(sampleRate, ClockRate_, Type_);
 }
 
 auto AyumiEmulator::getSampleRate() const -> int {
@@ -59,7 +207,7 @@ auto AyumiEmulator::getSampleRate() const -> int {
 }
 
 auto AyumiEmulator::setType(ChipType type) -> void {
-    Reset(SampleRate_, ClockRate_, type);
+    retune(SampleRate_, ClockRate_, type);
 }
 
 auto AyumiEmulator::getType() const -> ChipType {
@@ -71,13 +219,14 @@ auto AyumiEmulator::getClock() const -> double {
 }
 
 auto AyumiEmulator::setClock(double rate) -> void {
-    Reset(SampleRate_, rate, Type_);
+    retune(SampleRate_, rate, Type_);
 }
 
 auto AyumiEmulator::setPan(int chan, double pan, bool isEqp) -> void {
     // 1.0 is right, 0.0 is left
     Pan_[chan] = pan;
-    ayumi_set_pan(&Ayumi_, chan, pan, isEqp);
+    IsEqp_[chan] = isEqp;
+    Engine_->setPan(chan, pan, isEqp);
 }
 
 auto AyumiEmulator::getPan(int chan) const -> double {
@@ -86,6 +235,7 @@ auto AyumiEmulator::getPan(int chan) const -> double {
 
 auto AyumiEmulator::setTonePeriod(int chan, int period) -> void {
     ayumi_set_tone(&Ayumi_, chan, period);
+    Registers_.sync(Ayumi_);
 }
 
 auto AyumiEmulator::getTonePeriod(int chan) const -> int {
@@ -98,6 +248,7 @@ auto AyumiEmulator::getEnvelopePeriod() const -> int {
 
 auto AyumiEmulator::setNoisePeriod(int period) -> void {
     ayumi_set_noise(&Ayumi_, period);
+    Registers_.sync(Ayumi_);
 }
 
 auto AyumiEmulator::getNoisePeriod() const -> int {
@@ -105,11 +256,16 @@ auto AyumiEmulator::getNoisePeriod() const -> int {
 }
 
 auto AyumiEmulator::setEnvelopePeriod(int period) -> void {
-    return ayumi_set_envelope(&Ayumi_, period);
+    ayumi_set_envelope(&Ayumi_, period);
+    Registers_.sync(Ayumi_);
 }
 
 auto AyumiEmulator::setEnvelopeShape(EnvShape shape) -> void {
     ayumi_set_envelope_shape(&Ayumi_, shape);
+    Registers_.sync(Ayumi_);
+    if constexpr (RenderStats::ENABLED) {
+        ++Stats_.envelopeResets;
+    }
 }
 
 auto AyumiEmulator::getEnvelopeShape() const -> EnvShape {
@@ -118,18 +274,22 @@ auto AyumiEmulator::getEnvelopeShape() const -> EnvShape {
 
 auto AyumiEmulator::setEnvelopeOn(int chan, bool on) -> void {
     Ayumi_.channels[chan].e_on = on;
+    Registers_.sync(Ayumi_);
 }
 
 auto AyumiEmulator::setNoiseOn(int chan, bool on) -> void {
     Ayumi_.channels[chan].n_off = !on;
+    Registers_.sync(Ayumi_);
 }
 
 auto AyumiEmulator::setMixer(int chan, bool tOn, bool nOn, bool eOn) -> void {
     ayumi_set_mixer(&Ayumi_, chan, !tOn, !nOn, eOn);
+    Registers_.sync(Ayumi_);
 }
 
 auto AyumiEmulator::setVolume(int chan, int volume) -> void {
     ayumi_set_volume(&Ayumi_, chan, volume);
+    Registers_.sync(Ayumi_);
 }
 
 auto AyumiEmulator::getVolume(int chan) const -> int {
@@ -138,6 +298,7 @@ auto AyumiEmulator::getVolume(int chan) const -> int {
 
 auto AyumiEmulator::setToneOn(int chan, bool on) -> void {
     Ayumi_.channels[chan].t_off = !on;
+    Registers_.sync(Ayumi_);
 }
 
 auto AyumiEmulator::setMasterVolume(float volume) -> void {
@@ -148,15 +309,1295 @@ auto AyumiEmulator::getMasterVolume() const -> float {
     return MasterVolume_;
 }
 
+auto AyumiEmulator::setRegister(int reg, uint8_t value) -> void {
+    Registers_.write(Ayumi_, reg, value);
+    if constexpr (RenderStats::ENABLED) {
+        ++Stats_.registerWrites;
+        Stats_.envelopeResets += reg == ENVELOPE_SHAPE_REGISTER;
+    }
+}
+
+auto AyumiEmulator::setRegisters(const uint8_t* values, const bool* mask) -> void {
+    Registers_.writeFrame(Ayumi_, values, mask);
+    if constexpr (RenderStats::ENABLED) {
+        for (int reg = 0; reg < NUM_REGISTERS; ++reg) {
+            if (!mask || !mask[reg]) {
+                ++Stats_.registerWrites;
+                Stats_.envelopeResets += reg == ENVELOPE_SHAPE_REGISTER;
+            }
+        }
+    }
+}
+
+auto AyumiEmulator::getRegister(int reg) const -> uint8_t {
+    return Registers_.get(reg);
+}
+
 auto AyumiEmulator::processBlock(float* outLeft, float* outRight, size_t numSamples, bool removeDC, size_t stride) -> void {
-    for (size_t i = 0; i < numSamples; ++i, outLeft+=stride, outRight+=stride) {
-        ayumi_process(&Ayumi_);
+    float* outs[] = {outLeft, outRight};
+    Engine_->processBlock(Ayumi_, outs, numSamples, removeDC, stride, MasterVolume_);
+}
+
+auto AyumiEmulator::processBlockChannels(float* const* outs, size_t numSamples, bool removeDC, size_t stride) -> void {
+    if (!ChannelsEngine_) {
+        ChannelsEngine_ = makeAyumiEngine<EngineOutput::CHANNELS>(getPrecision(), getQuality());
+        ChannelsEngine_->setDcFilter(getDcFilter());
+        ChannelsEngine_->configure(Ayumi_.dac_table, ClockRate_, SampleRate_);
+    }
+    // Both engines tick the same chip, so they share the phase
+    ChannelsEngine_->setPhase(Engine_->getPhase());
+    ChannelsEngine_->processBlock(Ayumi_, outs, numSamples, removeDC, stride, MasterVolume_);
+    Engine_->setPhase(ChannelsEngine_->getPhase());
+}
+
+auto AyumiEmulator::getStats() const -> RenderStats {
+    RenderStats stats = Stats_;
+    stats += Engine_->getStats();
+    if (ChannelsEngine_) {
+        stats += ChannelsEngine_->getStats();
+    }
+    return stats;
+}
+
+auto AyumiEmulator::resetStats() -> void {
+    Stats_ = {};
+    Engine_->resetStats();
+    if (ChannelsEngine_) {
+        ChannelsEngine_->resetStats();
+    }
+}
+
+namespace {
+
+// Register writes timed in clock cycles, a chip tick is 8 clock cycles
+class RegisterWriteQueue : public TickEventQueue {
+public:
+    RegisterWriteQueue(AYInterface& chip, const AyumiEmulator::RegisterWrite* writes, size_t numWrites)
+        : Chip_(chip)
+        , Writes_(writes)
+        , NumWrites_(numWrites)
+    {}
+
+    auto getNumApplied() const -> size_t {
+        return Next_;
+    }
+
+    // Applies the writes left before time, in clock cycles
+    auto applyUntil(double time) -> void {
+        while (Next_ < NumWrites_ && Writes_[Next_].time < time) {
+            applyNext();
+        }
+    }
+
+protected:
+    auto nextTime() const -> double override {
+        return Next_ < NumWrites_ ? Writes_[Next_].time / CLOCKS_PER_TICK : std::numeric_limits<double>::infinity();
+    }
+
+    auto applyNext() -> void override {
+        const auto& write = Writes_[Next_++];
+        Chip_.R[write.reg] = write.value;
+    }
+
+private:
+    static constexpr double CLOCKS_PER_TICK = 8;
+
+    AYInterface& Chip_;
+    const AyumiEmulator::RegisterWrite* Writes_;
+    size_t NumWrites_;
+    size_t Next_ = 0;
+};
+
+} // namespace
+
+auto AyumiEmulator::processEvents(float* outLeft, float* outRight, size_t numSamples, const RegisterWrite* writes, size_t numWrites,
+                                  bool removeDC, size_t stride) -> size_t {
+    RegisterWriteQueue queue(*this, writes, numWrites);
+    float* outs[] = {outLeft, outRight};
+    Engine_->processBlock(Ayumi_, outs, numSamples, removeDC, stride, MasterVolume_, &queue);
+    // Writes after the last tick of the block take effect from the next block
+    queue.applyUntil(numSamples * ClockRate_ / SampleRate_);
+    return queue.getNumApplied();
+}
+
+namespace {
+
+// How many times a counter that ayumi_tick increments and zeroes on reaching period wraps
+// in ticks ticks. A counter already past the period (it was lowered) wraps on the next tick.
+// Period 0, the noise period of a chip that was never written, wraps every tick like 1.
+auto advanceCounter(int& counter, int period, uint64_t ticks) -> uint64_t {
+    period = std::max(period, 1);
+    const uint64_t first = counter < period ? period - counter : 1;
+    if (ticks < first) {
+        counter += static_cast<int>(ticks);
+        return 0;
+    }
+    const uint64_t rest = ticks - first;
+    counter = static_cast<int>(rest % period);
+    return 1 + rest / period;
+}
+
+// The noise LFSR is linear over GF(2), so n steps of it are the n-th power of its step matrix.
+// It has the maximal period 2^17 - 1, which bounds a jump to 17 matrix by vector products.
+constexpr int NOISE_BITS = 17;
+constexpr uint64_t NOISE_PERIOD = (1u << NOISE_BITS) - 1;
+using NoiseMatrix = std::array<uint32_t, NOISE_BITS>;    // column i is the image of bit i
+
+auto applyNoiseMatrix(const NoiseMatrix& m, uint32_t noise) -> uint32_t {
+    uint32_t result = 0;
+    for (int i = 0; i < NOISE_BITS; ++i) {
+        if (noise >> i & 1) {
+            result ^= m[i];
+        }
+    }
+    return result;
+}
+
+auto advanceNoise(uint32_t noise, uint64_t steps) -> uint32_t {
+    // powers[p] makes 2^p steps
+    static const auto powers = [] {
+        std::array<NoiseMatrix, NOISE_BITS> result {};
+        for (int i = 0; i < NOISE_BITS; ++i) {
+            const uint32_t bit = 1u << i;
+            result[0][i] = (bit >> 1) | (((bit ^ (bit >> 3)) & 1) << 16);
+        }
+        for (int p = 1; p < NOISE_BITS; ++p) {
+            for (int i = 0; i < NOISE_BITS; ++i) {
+                result[p][i] = applyNoiseMatrix(result[p - 1], result[p - 1][i]);
+            }
+        }
+        return result;
+    }();
+    steps %= NOISE_PERIOD;
+    for (int p = 0; steps; ++p, steps >>= 1) {
+        if (steps & 1) {
+            noise = applyNoiseMatrix(powers[p], noise);
+        }
+    }
+    return noise;
+}
+
+// A segment lasts at most 32 steps, after the first one the envelope either holds
+// or repeats every 64 steps, so long runs are cut down to less than 128 steps
+auto advanceEnvelope(ayumi& ay, uint64_t steps) -> void {
+    constexpr uint64_t ENVELOPE_CYCLE = 64;
+    if (steps >= 2 * ENVELOPE_CYCLE) {
+        steps = ENVELOPE_CYCLE + (steps - ENVELOPE_CYCLE) % ENVELOPE_CYCLE;
+    }
+    for (; steps; --steps) {
+        Envelopes[ay.envelope_shape][ay.envelope_segment](&ay);
+    }
+}
+
+// Ticks until a counter wraps, the wrapping tick is the first one that can change the output
+auto ticksToWrap(int counter, int period) -> uint64_t {
+    return counter < period ? period - counter : 1;
+}
+
+} // namespace
+
+auto advanceChip(ayumi& chip, uint64_t ticks) -> void {
+    const uint64_t noiseSteps = advanceCounter(chip.noise_counter, chip.noise_period << 1, ticks);
+    chip.noise = static_cast<int>(advanceNoise(static_cast<uint32_t>(chip.noise), noiseSteps));
+    advanceEnvelope(chip, advanceCounter(chip.envelope_counter, chip.envelope_period, ticks));
+    for (auto& channel : chip.channels) {
+        channel.tone ^= advanceCounter(channel.tone_counter, channel.tone_period, ticks) & 1;
+    }
+}
+
+auto getSteadyTicks(const ayumi& chip) -> uint64_t {
+    // Generators that can not change the output do not end the run: tones that are off,
+    // noise when no channel uses it and an envelope that holds or is not used
+    uint64_t result = std::numeric_limits<uint64_t>::max();
+    bool noiseOn = false;
+    bool envelopeOn = false;
+    for (const auto& channel : chip.channels) {
+        if (!channel.t_off) {
+            result = std::min(result, ticksToWrap(channel.tone_counter, channel.tone_period));
+        }
+        noiseOn |= !channel.n_off;
+        envelopeOn |= channel.e_on != 0;
+    }
+    if (noiseOn) {
+        result = std::min(result, ticksToWrap(chip.noise_counter, chip.noise_period << 1));
+    }
+    const auto segment = Envelopes[chip.envelope_shape][chip.envelope_segment];
+    if (envelopeOn && segment != hold_top && segment != hold_bottom) {
+        result = std::min(result, ticksToWrap(chip.envelope_counter, chip.envelope_period));
+    }
+    return result - 1;
+}
+
+auto AyumiEmulator::advanceTicks(uint64_t ticks) -> void {
+    advanceChip(Ayumi_, ticks);
+}
+
+auto AyumiEmulator::advance(size_t numSamples) -> void {
+    advanceTicks(Engine_->advance(numSamples));
+}
+
+auto AyumiEmulator::getWarmUpSamples(bool removeDC) const -> size_t {
+    return Engine_->getWarmUpSamples(removeDC);
+}
+
+auto AyumiEmulator::skip(size_t numSamples, bool removeDC) -> void {
+    constexpr size_t BLOCK_SIZE = 256;
+    const size_t warmUp = std::min(numSamples, getWarmUpSamples(removeDC));
+    advance(numSamples - warmUp);
+    float scratch[2][BLOCK_SIZE];
+    for (size_t i = 0; i < warmUp; i += BLOCK_SIZE) {
+        processBlock(scratch[0], scratch[1], std::min(BLOCK_SIZE, warmUp - i), removeDC);
+    }
+}
+
+
+namespace {
+
+constexpr char STATE_MAGIC[4] = {'A', 'Y', 'S', 'T'};
+// Version 2 added the quality, version 1 states are standard quality.
+// Version 3 added the DC filter, older states use the box filter.
+constexpr uint8_t STATE_VERSION = 3;
+constexpr uint8_t STATE_WITH_HISTORY = 1;
+
+// Field by field, so the format does not depend on the layout of struct ayumi.
+// Every value is small: periods are 12 bits at most and counters stay below them.
+auto saveChip(ByteWriter& out, const ayumi& chip) -> void {
+    for (const auto& channel : chip.channels) {
+        out.put(static_cast<uint16_t>(channel.tone_period));
+        out.put(static_cast<uint16_t>(channel.tone_counter));
+        out.put(static_cast<uint8_t>(channel.tone | channel.t_off << 1 | channel.n_off << 2 | channel.e_on << 3));
+        out.put(static_cast<uint8_t>(channel.volume));
+    }
+    out.put(static_cast<uint8_t>(chip.noise_period));
+    out.put(static_cast<uint8_t>(chip.noise_counter));
+    out.put(static_cast<uint32_t>(chip.noise));
+    out.put(static_cast<uint16_t>(chip.envelope_period));
+    out.put(static_cast<uint16_t>(chip.envelope_counter));
+    out.put(static_cast<uint8_t>(chip.envelope_shape | chip.envelope_segment << 4));
+    out.put(static_cast<uint8_t>(chip.envelope));
+}
+
+auto loadChip(ByteReader& in, ayumi& chip) -> void {
+    for (auto& channel : chip.channels) {
+        channel.tone_period = in.get<uint16_t>();
+        channel.tone_counter = in.get<uint16_t>();
+        const uint8_t flags = in.get<uint8_t>();
+        channel.tone = flags & 1;
+        channel.t_off = flags >> 1 & 1;
+        channel.n_off = flags >> 2 & 1;
+        channel.e_on = flags >> 3 & 1;
+        channel.volume = in.get<uint8_t>();
+        if (channel.tone_period < 1 || channel.tone_period > 0xfff || channel.tone_counter > 0xfff || channel.volume > 15) {
+            throw std::invalid_argument("Bad tone channel state");
+        }
+    }
+    chip.noise_period = in.get<uint8_t>();
+    chip.noise_counter = in.get<uint8_t>();
+    chip.noise = static_cast<int>(in.get<uint32_t>());
+    // Period 0 is left by ayumi_configure until R6 is written
+    if (chip.noise_period > 0x1f || chip.noise >> NOISE_BITS) {
+        throw std::invalid_argument("Bad noise state");
+    }
+    chip.envelope_period = in.get<uint16_t>();
+    chip.envelope_counter = in.get<uint16_t>();
+    const uint8_t shape = in.get<uint8_t>();
+    chip.envelope_shape = shape & 0xf;
+    chip.envelope_segment = shape >> 4;
+    chip.envelope = in.get<uint8_t>();
+    if (chip.envelope_period < 1 || chip.envelope_segment > 1 || chip.envelope > 31) {
+        throw std::invalid_argument("Bad envelope state");
+    }
+}
+
+} // namespace
+
+auto AyumiEmulator::saveState(bool compact) const -> std::vector<uint8_t> {
+    ByteWriter out;
+    out.putBytes(STATE_MAGIC, sizeof(STATE_MAGIC));
+    out.put(STATE_VERSION);
+    out.put(static_cast<uint8_t>(compact ? 0 : STATE_WITH_HISTORY));
+    out.put(static_cast<uint32_t>(SampleRate_));
+    out.put(ClockRate_);
+    out.put(static_cast<uint8_t>(Type_.value));
+    out.put(static_cast<uint8_t>(getPrecision().value));
+    out.put(static_cast<uint8_t>(getQuality().value));
+    out.put(static_cast<uint8_t>(getDcFilter().value));
+    for (int i = 0; i < TONE_CHANNELS; ++i) {
+        out.put(Pan_[i]);
+        out.put(static_cast<uint8_t>(IsEqp_[i]));
+    }
+    out.put(MasterVolume_);
+    saveChip(out, Ayumi_);
+    Engine_->saveState(out, !compact);
+    return out.release();
+}
+
+auto AyumiEmulator::loadState(const uint8_t* data, size_t size) -> void {
+    ByteReader in(data, size);
+    char magic[sizeof(STATE_MAGIC)];
+    in.getBytes(magic, sizeof(magic));
+    if (!std::equal(std::begin(magic), std::end(magic), STATE_MAGIC)) {
+        throw std::invalid_argument("Not an Ayumi state");
+    }
+    const uint8_t version = in.get<uint8_t>();
+    if (version < 1 || version > STATE_VERSION) {
+        throw std::invalid_argument("Unsupported Ayumi state version");
+    }
+    const bool withHistory = in.get<uint8_t>() & STATE_WITH_HISTORY;
+    const int sampleRate = static_cast<int>(in.get<uint32_t>());
+    const double clock = in.get<double>();
+    const uint8_t type = in.get<uint8_t>();
+    const uint8_t precision = in.get<uint8_t>();
+    const uint8_t quality = version >= 2 ? in.get<uint8_t>() : static_cast<uint8_t>(QualityEnum::STANDARD);
+    const uint8_t dcFilter = version >= 3 ? in.get<uint8_t>() : static_cast<uint8_t>(DcFilterEnum::BOX);
+    if (sampleRate <= 0 || !(clock > 0) || type >= ChipType::size() || precision >= Precision::size()
+        || quality >= Quality::size() || dcFilter >= DcFilter::size()) {
+        throw std::invalid_argument("Bad Ayumi settings");
+    }
+    double pan[TONE_CHANNELS];
+    bool isEqp[TONE_CHANNELS];
+    for (int i = 0; i < TONE_CHANNELS; ++i) {
+        pan[i] = in.get<double>();
+        isEqp[i] = in.get<uint8_t>();
+    }
+    const float masterVolume = in.get<float>();
+
+    ayumi chip;
+    ayumi_configure(&chip, type);
+    loadChip(in, chip);
+    auto engine = makeAyumiEngine(precision, quality);
+    engine->setDcFilter(dcFilter);
+    engine->configure(chip.dac_table, clock, sampleRate);
+    for (int i = 0; i < TONE_CHANNELS; ++i) {
+        engine->setPan(i, pan[i], isEqp[i]);
+    }
+    engine->loadState(in, withHistory);
+    if (!in.atEnd()) {
+        throw std::invalid_argument("Unexpected data after Ayumi state");
+    }
+
+    SampleRate_ = sampleRate;
+    ClockRate_ = clock;
+    Type_ = type;
+    Ayumi_ = chip;
+    Registers_ = RegisterFile();
+    Registers_.sync(Ayumi_);
+    Stats_ = getStats();
+    Engine_ = std::move(engine);
+    ChannelsEngine_.reset();
+    std::copy(std::begin(pan), std::end(pan), Pan_);
+    std::copy(std::begin(isEqp), std::end(isEqp), IsEqp_);
+    MasterVolume_ = masterVolume;
+}
+
+auto AyumiEmulator::isEquivalent(const AyumiEmulator& other, const ChipStateParts& parts, double phaseTolerance) const -> bool {
+    if (Type_ != other.Type_ || ClockRate_ != other.ClockRate_ || SampleRate_ != other.SampleRate_
+        || MasterVolume_ != other.MasterVolume_ || getPrecision() != other.getPrecision()
+        || getQuality() != other.getQuality() || getDcFilter() != other.getDcFilter()
+        || !std::equal(std::begin(Pan_), std::end(Pan_), other.Pan_)
+        || !std::equal(std::begin(IsEqp_), std::end(IsEqp_), other.IsEqp_)) {
+        return false;
+    }
+    if (std::abs(Engine_->getPhase() - other.Engine_->getPhase()) > phaseTolerance) {
+        return false;
+    }
+    for (int reg = 0; reg < NUM_REGISTERS; ++reg) {
+        if (Registers_.get(reg) != other.Registers_.get(reg)) {
+            return false;
+        }
+    }
+    // The periods, mixer and volumes follow from the registers
+    for (int chan = 0; chan < TONE_CHANNELS; ++chan) {
+        const tone_channel& a = Ayumi_.channels[chan];
+        const tone_channel& b = other.Ayumi_.channels[chan];
+        if (parts.tone[chan] && (a.tone_counter != b.tone_counter || a.tone != b.tone)) {
+            return false;
+        }
+    }
+    const ayumi& a = Ayumi_;
+    const ayumi& b = other.Ayumi_;
+    if (parts.noise && (a.noise_counter != b.noise_counter || a.noise != b.noise)) {
+        return false;
+    }
+    return !parts.envelope || (a.envelope_counter == b.envelope_counter && a.envelope_segment == b.envelope_segment
+                               && a.envelope == b.envelope);
+}
+
+
+/*****************************************************************************/
+/*  TurboSound                                                               */
+/*****************************************************************************/
+
+TurboSound::TurboSound(size_t numChips, int sampleRate, double clock, ChipType type, Precision precision, Quality quality,
+                       DcFilter dcFilter)
+    : AYInterface()
+    , Bus_(makeAyumiEngine(precision, quality))
+    , Selected_(0)
+    , MasterVolume_(1.0)
+{
+    Bus_->setDcFilter(dcFilter);
+    if (numChips == 0 || numChips > MAX_CHIPS) {
+        throw std::invalid_argument("Number of chips must be from 1 to " + std::to_string(MAX_CHIPS));
+    }
+    Chips_.reserve(numChips);
+    // Only the bus filter is live: processMix uses the engines of the chips to interpolate, their FIR
+    // and DC filter are never run. The iir filter keeps them from holding a DC delay line each.
+    for (size_t i = 0; i < numChips; ++i) {
+        Chips_.emplace_back(sampleRate, clock, type, precision, quality, DcFilterEnum::IIR);
+    }
+    Reset(sampleRate, clock, type);
+}
+
+TurboSound::TurboSound(const TurboSound& other)
+    : AYInterface()
+    , Chips_(other.Chips_)
+    , Bus_(other.Bus_->clone())
+    , Selected_(other.Selected_)
+    , MasterVolume_(other.MasterVolume_)
+{
+}
+
+TurboSound::~TurboSound() {
+
+}
+
+auto TurboSound::Reset(int sampleRate, double clock, ChipType type) -> void {
+    for (auto& chip : Chips_) {
+        chip.Reset(sampleRate, clock, type);
+    }
+    // Only the FIR and DC filter of the bus are used, the DAC table and clock do not matter
+    Bus_->configure(Chips_[0].Ayumi_.dac_table, clock, sampleRate);
+}
+
+auto TurboSound::getPrecision() const -> Precision {
+    return Bus_->getPrecision();
+}
+
+auto TurboSound::getQuality() const -> Quality {
+    return Bus_->getQuality();
+}
+
+auto TurboSound::setDcFilter(DcFilter filter) -> void {
+    Bus_->setDcFilter(filter);
+}
+
+auto TurboSound::getDcFilter() const -> DcFilter {
+    return Bus_->getDcFilter();
+}
+
+auto TurboSound::getNumChips() const -> size_t {
+    return Chips_.size();
+}
+
+auto TurboSound::selectChip(size_t chip) -> void {
+    if (chip >= Chips_.size()) {
+        throw std::out_of_range("Chip index out of bounds");
+    }
+    Selected_ = chip;
+}
+
+auto TurboSound::getSelectedChip() const -> size_t {
+    return Selected_;
+}
+
+auto TurboSound::getChip(size_t chip) -> AyumiEmulator& {
+    return Chips_.at(chip);
+}
+
+auto TurboSound::getChip(size_t chip) const -> const AyumiEmulator& {
+    return Chips_.at(chip);
+}
+
+auto TurboSound::canChangeClock() const -> bool {
+    return true;
+}
+
+auto TurboSound::canChangeClockContinously() const -> bool {
+    return true;
+}
+
+auto TurboSound::getClock() const -> double {
+    return Chips_[Selected_].getClock();
+}
+
+auto TurboSound::getClockValues() const -> std::vector<float> {
+    return {};  // no values because canChangeClockContinously() == true
+}
+
+auto TurboSound::setSampleRate(int sampleRate) -> void {
+    for (auto& chip : Chips_) {
+        chip.setSampleRate(sampleRate);
+    }
+}
+
+auto TurboSound::getSampleRate() const -> int {
+    return Chips_[0].getSampleRate();
+}
+
+auto TurboSound::setType(ChipType type) -> void {
+    Chips_[Selected_].setType(type);
+}
+
+auto TurboSound::getType() const -> ChipType {
+    return Chips_[Selected_].getType();
+}
+
+auto TurboSound::setClock(double v) -> void {
+    Chips_[Selected_].setClock(v);
+}
+
+auto TurboSound::setPan(int chan, double pan, bool isEqp) -> void {
+    Chips_[Selected_].setPan(chan, pan, isEqp);
+}
+
+auto TurboSound::getPan(int chan) const -> double {
+    return Chips_[Selected_].getPan(chan);
+}
+
+auto TurboSound::setMixer(int chan, bool tOn, bool nOn, bool eOn) -> void {
+    Chips_[Selected_].setMixer(chan, tOn, nOn, eOn);
+}
+
+auto TurboSound::setEnvelopeOn(int chan, bool on) -> void {
+    Chips_[Selected_].setEnvelopeOn(chan, on);
+}
+
+auto TurboSound::setNoiseOn(int chan, bool on) -> void {
+    Chips_[Selected_].setNoiseOn(chan, on);
+}
+
+auto TurboSound::setVolume(int chan, int volume) -> void {
+    Chips_[Selected_].setVolume(chan, volume);
+}
+
+auto TurboSound::getVolume(int chan) const -> int {
+    return Chips_[Selected_].getVolume(chan);
+}
+
+auto TurboSound::setToneOn(int chan, bool on) -> void {
+    Chips_[Selected_].setToneOn(chan, on);
+}
+
+auto TurboSound::setTonePeriod(int chan, int period) -> void {
+    Chips_[Selected_].setTonePeriod(chan, period);
+}
+
+auto TurboSound::getTonePeriod(int chan) const -> int {
+    return Chips_[Selected_].getTonePeriod(chan);
+}
+
+auto TurboSound::setNoisePeriod(int period) -> void {
+    Chips_[Selected_].setNoisePeriod(period);
+}
+
+auto TurboSound::getNoisePeriod() const -> int {
+    return Chips_[Selected_].getNoisePeriod();
+}
+
+auto TurboSound::setEnvelopeShape(EnvShape shape) -> void {
+    Chips_[Selected_].setEnvelopeShape(shape);
+}
+
+auto TurboSound::getEnvelopeShape() const -> EnvShape {
+    return Chips_[Selected_].getEnvelopeShape();
+}
+
+auto TurboSound::setEnvelopePeriod(int period) -> void {
+    Chips_[Selected_].setEnvelopePeriod(period);
+}
+
+auto TurboSound::getEnvelopePeriod() const -> int {
+    return Chips_[Selected_].getEnvelopePeriod();
+}
+
+auto TurboSound::setMasterVolume(float volume) -> void {
+    MasterVolume_ = volume;
+}
+
+auto TurboSound::getMasterVolume() const -> float {
+    return MasterVolume_;
+}
+
+auto TurboSound::setRegister(int reg, uint8_t value) -> void {
+    Chips_[Selected_].setRegister(reg, value);
+}
+
+auto TurboSound::setRegisters(const uint8_t* values, const bool* mask) -> void {
+    Chips_[Selected_].setRegisters(values, mask);
+}
+
+auto TurboSound::getRegister(int reg) const -> uint8_t {
+    return Chips_[Selected_].getRegister(reg);
+}
+
+auto TurboSound::processBlock(float* outLeft, float* outRight, size_t numSamples, bool removeDC, size_t stride) -> void {
+    ayumi* chips[MAX_CHIPS];
+    AyumiEngineBase* voices[MAX_CHIPS];
+    for (size_t i = 0; i < Chips_.size(); ++i) {
+        chips[i] = &Chips_[i].Ayumi_;
+        voices[i] = Chips_[i].Engine_.get();
+    }
+    float* outs[] = {outLeft, outRight};
+    Bus_->processMix(chips, voices, Chips_.size(), outs, numSamples, removeDC, stride, MasterVolume_);
+}
+
+
+/*****************************************************************************/
+/*  BlepEmulator                                                             */
+/*****************************************************************************/
+
+namespace {
+    // Increments of a band-limited unit step at phase p / BLEP_PHASES of a sample:
+    // tap k of row p is S(k + 1 - phase) - S(k - phase), where S is the integral of a
+    // Blackman windowed sinc 2 * BLEP_DELAY samples long, so every row sums to one.
+    // Row BLEP_PHASES is the start of the next sample, rows are interpolated linearly.
+    using BlepTable = std::array<std::array<double, BlepEmulator::BLEP_TAPS>, BlepEmulator::BLEP_PHASES + 1>;
+
+    const BlepTable& blepTable() {
+        static const auto table = [] {
+            constexpr int WIDTH = 2 * BlepEmulator::BLEP_DELAY;
+            constexpr int OVERSAMPLING = 16;    // integration points per phase
+            constexpr int RESOLUTION = BlepEmulator::BLEP_PHASES * OVERSAMPLING;
+            constexpr double CUTOFF = 0.45;     // of the sample rate
+            const double pi = std::acos(-1.0);
+            // step[i] is S(i / RESOLUTION), integrated with the midpoint rule
+            std::vector<double> step(WIDTH * RESOLUTION + 1);
+            for (size_t i = 1; i < step.size(); ++i) {
+                const double t = (i - 0.5) / RESOLUTION;
+                const double x = t - BlepEmulator::BLEP_DELAY;
+                const double sinc = x == 0 ? 2 * CUTOFF : std::sin(2 * pi * CUTOFF * x) / (pi * x);
+                const double window = 0.42 - 0.5 * std::cos(2 * pi * t / WIDTH) + 0.08 * std::cos(4 * pi * t / WIDTH);
+                step[i] = step[i - 1] + sinc * window;
+            }
+            const double total = step.back();
+            const auto stepAt = [&](int i) {
+                return step[std::clamp(i, 0, WIDTH * RESOLUTION)] / total;
+            };
+            BlepTable result;
+            for (int p = 0; p <= BlepEmulator::BLEP_PHASES; ++p) {
+                for (int k = 0; k < BlepEmulator::BLEP_TAPS; ++k) {
+                    const int x = k * RESOLUTION - p * OVERSAMPLING;
+                    result[p][k] = stepAt(x + RESOLUTION) - stepAt(x);
+                }
+            }
+            return result;
+        }();
+        return table;
+    }
+}
+
+BlepEmulator::BlepEmulator(int sampleRate, double clock, ChipType type)
+    : AYInterface()
+    , Pan_ {0.25, 0.75, 0.5}  // ACB is default
+    , MasterVolume_(1.0)
+{
+    Reset(sampleRate, clock, type);
+}
+
+// Register accessors of AYInterface must point to the new object, so they are not copied
+BlepEmulator::BlepEmulator(const BlepEmulator& other)
+    : AYInterface()
+    , Ayumi_(other.Ayumi_)
+    , Registers_(other.Registers_)
+    , Type_(other.Type_)
+    , ClockRate_(other.ClockRate_)
+    , SampleRate_(other.SampleRate_)
+    , Pan_ {other.Pan_[0], other.Pan_[1], other.Pan_[2]}
+    , IsEqp_ {other.IsEqp_[0], other.IsEqp_[1], other.IsEqp_[2]}
+    , MasterVolume_(other.MasterVolume_)
+    , Step_(other.Step_)
+    , NextTick_(other.NextTick_)
+    , SteadyTicks_(other.SteadyTicks_)
+    , PendingTicks_(other.PendingTicks_)
+    , Level_ {other.Level_[0], other.Level_[1]}
+    , Out_ {other.Out_[0], other.Out_[1]}
+    , IncrementIndex_(other.IncrementIndex_)
+    , DcSum_ {other.DcSum_[0], other.DcSum_[1]}
+    , DcIndex_(other.DcIndex_)
+{
+    std::copy(&other.Mix_[0][0][0], &other.Mix_[0][0][0] + std::size(Mix_) * 32 * 2, &Mix_[0][0][0]);
+    std::copy(&other.Increments_[0][0], &other.Increments_[0][0] + BLEP_SLOTS * 2, &Increments_[0][0]);
+    std::copy(&other.DcDelay_[0][0], &other.DcDelay_[0][0] + DC_FILTER_SIZE * 2, &DcDelay_[0][0]);
+}
+
+BlepEmulator::~BlepEmulator() {
+
+}
+
+auto BlepEmulator::Reset(int sampleRate, double clock, ChipType type) -> void {
+    ayumi_configure(&Ayumi_, type);
+    Registers_ = RegisterFile();
+    retune(sampleRate, clock, type);
+    // The first tick is one tick after the start, like in AyumiEngine
+    NextTick_ = 1;
+    SteadyTicks_ = 0;
+    PendingTicks_ = 0;
+    std::fill(std::begin(Level_), std::end(Level_), 0.0);
+    std::fill(std::begin(Out_), std::end(Out_), 0.0);
+    std::fill(&Increments_[0][0], &Increments_[0][0] + BLEP_SLOTS * 2, 0.0);
+    IncrementIndex_ = 0;
+    std::fill(std::begin(DcSum_), std::end(DcSum_), 0.0);
+    std::fill(&DcDelay_[0][0], &DcDelay_[0][0] + DC_FILTER_SIZE * 2, 0.0);
+    DcIndex_ = 0;
+    for (int i = 0; i < TONE_CHANNELS; ++i) {
+        setPan(i, Pan_[i]);
+        setMixer(i, false, false, false);
+    }
+}
+
+auto BlepEmulator::retune(int sampleRate, double clock, ChipType type) -> void {
+    SampleRate_ = sampleRate;
+    ClockRate_ = clock;
+    Type_ = type;
+    ayumi_set_type(&Ayumi_, type);
+    Step_ = clock / (sampleRate * 8.0);
+    for (int i = 0; i < TONE_CHANNELS; ++i) {
+        setPan(i, Pan_[i], IsEqp_[i]);
+    }
+}
+
+auto BlepEmulator::canChangeClock() const -> bool {
+    return true;
+}
+
+auto BlepEmulator::canChangeClockContinously() const -> bool {
+    return true;
+}
+
+auto BlepEmulator::getClockValues() const -> std::vector<float> {
+    return {};  // no values because canChangeClockContinously() == true
+}
+
+auto BlepEmulator::setSampleRate(int sampleRate) -> void {
+    retune(sampleRate, ClockRate_, Type_);
+}
+
+auto BlepEmulator::getSampleRate() const -> int {
+    return SampleRate_;
+}
+
+auto BlepEmulator::setType(ChipType type) -> void {
+    retune(SampleRate_, ClockRate_, type);
+}
+
+auto BlepEmulator::getType() const -> ChipType {
+    return Type_;
+}
+
+auto BlepEmulator::getClock() const -> double {
+    return ClockRate_;
+}
+
+auto BlepEmulator::setClock(double rate) -> void {
+    retune(SampleRate_, rate, Type_);
+}
+
+auto BlepEmulator::setPan(int chan, double pan, bool isEqp) -> void {
+    // 1.0 is right, 0.0 is left
+    Pan_[chan] = pan;
+    IsEqp_[chan] = isEqp;
+    const double left = isEqp ? std::sqrt(1 - pan) : 1 - pan;
+    const double right = isEqp ? std::sqrt(pan) : pan;
+    for (int i = 0; i < 32; ++i) {
+        Mix_[chan][i][0] = Ayumi_.dac_table[i] * left;
+        Mix_[chan][i][1] = Ayumi_.dac_table[i] * right;
+    }
+}
+
+auto BlepEmulator::getPan(int chan) const -> double {
+    return Pan_[chan];
+}
+
+auto BlepEmulator::setTonePeriod(int chan, int period) -> void {
+    ayumi_set_tone(&Ayumi_, chan, period);
+    Registers_.sync(Ayumi_);
+}
+
+auto BlepEmulator::getTonePeriod(int chan) const -> int {
+    return Ayumi_.channels[chan].tone_period;
+}
+
+auto BlepEmulator::getEnvelopePeriod() const -> int {
+    return Ayumi_.envelope_period;
+}
+
+auto BlepEmulator::setNoisePeriod(int period) -> void {
+    ayumi_set_noise(&Ayumi_, period);
+    Registers_.sync(Ayumi_);
+}
+
+auto BlepEmulator::getNoisePeriod() const -> int {
+    return Ayumi_.noise_period;
+}
+
+auto BlepEmulator::setEnvelopePeriod(int period) -> void {
+    ayumi_set_envelope(&Ayumi_, period);
+    Registers_.sync(Ayumi_);
+}
+
+auto BlepEmulator::setEnvelopeShape(EnvShape shape) -> void {
+    ayumi_set_envelope_shape(&Ayumi_, shape);
+    Registers_.sync(Ayumi_);
+}
+
+auto BlepEmulator::getEnvelopeShape() const -> EnvShape {
+    return Ayumi_.envelope_shape;
+}
+
+auto BlepEmulator::setEnvelopeOn(int chan, bool on) -> void {
+    Ayumi_.channels[chan].e_on = on;
+    Registers_.sync(Ayumi_);
+}
+
+auto BlepEmulator::setNoiseOn(int chan, bool on) -> void {
+    Ayumi_.channels[chan].n_off = !on;
+    Registers_.sync(Ayumi_);
+}
+
+auto BlepEmulator::setMixer(int chan, bool tOn, bool nOn, bool eOn) -> void {
+    ayumi_set_mixer(&Ayumi_, chan, !tOn, !nOn, eOn);
+    Registers_.sync(Ayumi_);
+}
+
+auto BlepEmulator::setVolume(int chan, int volume) -> void {
+    ayumi_set_volume(&Ayumi_, chan, volume);
+    Registers_.sync(Ayumi_);
+}
+
+auto BlepEmulator::getVolume(int chan) const -> int {
+    return Ayumi_.channels[chan].volume;
+}
+
+auto BlepEmulator::setToneOn(int chan, bool on) -> void {
+    Ayumi_.channels[chan].t_off = !on;
+    Registers_.sync(Ayumi_);
+}
+
+auto BlepEmulator::setMasterVolume(float volume) -> void {
+    MasterVolume_ = volume;
+}
+
+auto BlepEmulator::getMasterVolume() const -> float {
+    return MasterVolume_;
+}
+
+auto BlepEmulator::setRegister(int reg, uint8_t value) -> void {
+    Registers_.write(Ayumi_, reg, value);
+}
+
+auto BlepEmulator::setRegisters(const uint8_t* values, const bool* mask) -> void {
+    Registers_.writeFrame(Ayumi_, values, mask);
+}
+
+auto BlepEmulator::getRegister(int reg) const -> uint8_t {
+    return Registers_.get(reg);
+}
+
+auto BlepEmulator::flush() -> void {
+    advanceChip(Ayumi_, PendingTicks_);
+    PendingTicks_ = 0;
+    SteadyTicks_ = 0;
+}
+
+auto BlepEmulator::tick(double phase) -> void {
+    if (PendingTicks_) {
+        flush();
+    }
+    int levels[TONE_CHANNELS];
+    ayumi_tick(&Ayumi_, levels);
+    double level[2] = {};
+    for (int ch = 0; ch < TONE_CHANNELS; ++ch) {
+        level[0] += Mix_[ch][levels[ch]][0];
+        level[1] += Mix_[ch][levels[ch]][1];
+    }
+    const double delta[2] = {level[0] - Level_[0], level[1] - Level_[1]};
+    if (delta[0] != 0 || delta[1] != 0) {
+        const BlepTable& table = blepTable();
+        const double x = phase * BLEP_PHASES;
+        const int row = std::min(static_cast<int>(x), BLEP_PHASES - 1);
+        const double w = x - row;
+        for (int k = 0; k < BLEP_TAPS; ++k) {
+            const double h = table[row][k] + w * (table[row + 1][k] - table[row][k]);
+            double (&increment)[2] = Increments_[(IncrementIndex_ + k) & (BLEP_SLOTS - 1)];
+            increment[0] += delta[0] * h;
+            increment[1] += delta[1] * h;
+        }
+        Level_[0] = level[0];
+        Level_[1] = level[1];
+    }
+    SteadyTicks_ = getSteadyTicks(Ayumi_);
+}
+
+auto BlepEmulator::processBlock(float* outLeft, float* outRight, size_t numSamples, bool removeDC, size_t stride) -> void {
+    // Registers may have changed since the last block
+    SteadyTicks_ = 0;
+    for (size_t i = 0, offset = 0; i < numSamples; ++i, offset += stride) {
+        double t = NextTick_;
+        while (t < Step_) {
+            if (SteadyTicks_) {
+                const auto ticks = std::min(SteadyTicks_, static_cast<uint64_t>(std::ceil(Step_ - t)));
+                SteadyTicks_ -= ticks;
+                PendingTicks_ += ticks;
+                t += static_cast<double>(ticks);
+            } else {
+                tick(t / Step_);
+                t += 1;
+            }
+        }
+        NextTick_ = t - Step_;
+        double out[2];
+        for (int o = 0; o < 2; ++o) {
+            Out_[o] += Increments_[IncrementIndex_][o];
+            Increments_[IncrementIndex_][o] = 0;
+            out[o] = Out_[o];
+        }
+        IncrementIndex_ = (IncrementIndex_ + 1) & (BLEP_SLOTS - 1);
         if (removeDC) {
-            ayumi_remove_dc(&Ayumi_);
+            for (int o = 0; o < 2; ++o) {
+                DcSum_[o] += out[o] - DcDelay_[DcIndex_][o];
+                DcDelay_[DcIndex_][o] = out[o];
+                out[o] -= DcSum_[o] / DC_FILTER_SIZE;
+            }
+            DcIndex_ = (DcIndex_ + 1) & (DC_FILTER_SIZE - 1);
+        }
+        outLeft[offset] = static_cast<float>(out[0]) * MasterVolume_;
+        outRight[offset] = static_cast<float>(out[1]) * MasterVolume_;
+    }
+    flush();
+}
+
+
+/*****************************************************************************/
+/*  AyumiBatch                                                               */
+/*****************************************************************************/
+
+namespace {
+    // Branch-free form of the Envelopes table: level step per envelope tick and
+    // the level a segment starts from, both indexed by shape * 2 + segment
+    struct EnvelopeTables {
+        int step[16 * 2];
+        int start[16 * 2];
+
+        EnvelopeTables() {
+            for (int shape = 0; shape < 16; ++shape) {
+                for (int segment = 0; segment < 2; ++segment) {
+                    const auto fn = Envelopes[shape][segment];
+                    step[shape * 2 + segment] = fn == slide_up ? 1 : fn == slide_down ? -1 : 0;
+                    start[shape * 2 + segment] = fn == slide_down || fn == hold_top ? 31 : 0;
+                }
+            }
+        }
+    };
+
+    const EnvelopeTables& envelopeTables() {
+        static const EnvelopeTables tables;
+        return tables;
+    }
+}
+
+// ifunc based dispatch is only available with GCC on Linux
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define AYUMI_BATCH_TARGETS __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define AYUMI_BATCH_TARGETS
+#endif
+
+AyumiBatch::AyumiBatch(size_t numChips, int sampleRate, double clock, ChipType type, DcFilter dcFilter)
+    : NumChips_(numChips)
+    , Pan_ {0.25, 0.75, 0.5}  // ACB is default
+    , MasterVolume_(1.0)
+    , DcFilter_(dcFilter)
+{
+    Reset(sampleRate, clock, type);
+}
+
+auto AyumiBatch::Reset(int sampleRate, double clock, ChipType type) -> void {
+    // Same initial state as ayumi_configure
+    SampleRate_ = sampleRate;
+    ClockRate_ = clock;
+    Type_ = type;
+    DacTable_ = type == AYInterface::TypeEnum::YM ? YM_dac_table : AY_dac_table;
+    Step_ = clock / (sampleRate * 8 * DECIMATE_FACTOR);
+    X_ = 0;
+    FirIndex_ = 0;
+    Registers_.assign(NumChips_ * NUM_REGISTERS, 0);
+    Tiles_.assign((NumChips_ + TILE_LANES - 1) / TILE_LANES, Tile {});
+    clearDc();
+    for (auto& tile : Tiles_) {
+        for (size_t c = 0; c < TILE_LANES; ++c) {
+            for (int ch = 0; ch < TONE_CHANNELS; ++ch) {
+                tile.tonePeriod[ch][c] = 1;
+                tile.toneOff[ch][c] = 1;
+                tile.noiseOff[ch][c] = 1;
+            }
+            tile.noise[c] = 1;
+            tile.envelopePeriod[c] = 1;
+        }
+    }
+    for (int i = 0; i < TONE_CHANNELS; ++i) {
+        setPan(i, Pan_[i]);
+    }
+}
+
+auto AyumiBatch::clearDc() -> void {
+    DcIndex_ = 0;
+    for (auto& tile : Tiles_) {
+        std::fill(&tile.dcSum[0][0], &tile.dcSum[0][0] + 2 * TILE_LANES, 0.0);
+        std::fill(&tile.dcLast[0][0], &tile.dcLast[0][0] + 2 * TILE_LANES, 0.0);
+    }
+    if (DcFilter_ == DcFilterEnum::BOX) {
+        DcDelay_.assign(Tiles_.size() * 2 * DC_FILTER_SIZE * TILE_LANES, 0.0);
+    } else {
+        DcDelay_ = {};
+    }
+}
+
+auto AyumiBatch::setDcFilter(DcFilter filter) -> void {
+    DcFilter_ = filter;
+    clearDc();
+}
+
+auto AyumiBatch::getDcFilter() const -> DcFilter {
+    return DcFilter_;
+}
+
+auto AyumiBatch::getNumChips() const -> size_t {
+    return NumChips_;
+}
+
+auto AyumiBatch::getSampleRate() const -> int {
+    return SampleRate_;
+}
+
+auto AyumiBatch::getClock() const -> double {
+    return ClockRate_;
+}
+
+auto AyumiBatch::getType() const -> ChipType {
+    return Type_;
+}
+
+auto AyumiBatch::setPan(int chan, double pan, bool isEqp) -> void {
+    Pan_[chan] = pan;
+    PanLeft_[chan] = isEqp ? std::sqrt(1 - pan) : 1 - pan;
+    PanRight_[chan] = isEqp ? std::sqrt(pan) : pan;
+}
+
+auto AyumiBatch::getPan(int chan) const -> double {
+    return Pan_[chan];
+}
+
+auto AyumiBatch::setMasterVolume(float volume) -> void {
+    MasterVolume_ = volume;
+}
+
+auto AyumiBatch::getMasterVolume() const -> float {
+    return MasterVolume_;
+}
+
+auto AyumiBatch::getRegister(size_t chip, int reg) const -> unsigned char {
+    return Registers_[chip * NUM_REGISTERS + reg];
+}
+
+auto AyumiBatch::setRegister(size_t chip, int reg, unsigned char value) -> void {
+    unsigned char* R = &Registers_[chip * NUM_REGISTERS];
+    Tile& tile = Tiles_[chip / TILE_LANES];
+    const size_t c = chip % TILE_LANES;
+    R[reg] = value;
+    switch (reg) {
+        case 0: case 1: case 2: case 3: case 4: case 5: {
+            const int chan = reg >> 1;
+            const int period = ((R[chan * 2 + 1] & 0x0f) << 8) | R[chan * 2];
+            tile.tonePeriod[chan][c] = (period == 0) | period;
+            break;
+        }
+        case 6: {
+            const int period = value & 0x1f;
+            tile.noisePeriod[c] = (period == 0) | period;
+            break;
+        }
+        case 7:
+            for (int chan = 0; chan < TONE_CHANNELS; ++chan) {
+                tile.toneOff[chan][c] = (value >> chan) & 1;
+                tile.noiseOff[chan][c] = (value >> (chan + 3)) & 1;
+            }
+            break;
+        case 8: case 9: case 10:
+            tile.volume[reg - 8][c] = value & 0x0f;
+            tile.envelopeOn[reg - 8][c] = (value & 0x10) != 0;
+            break;
+        case 11: case 12: {
+            const int period = (R[12] << 8) | R[11];
+            tile.envelopePeriod[c] = (period == 0) | period;
+            break;
+        }
+        case 13: {
+            const int shape = value & 0x0f;
+            tile.envelopeShape[c] = shape;
+            tile.envelopeCounter[c] = 0;
+            tile.envelopeSegment[c] = 0;
+            tile.envelope[c] = envelopeTables().start[shape * 2];
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+AYUMI_BATCH_TARGETS
+auto AyumiBatch::processBlock(float* outLeft, float* outRight, size_t chipStride, size_t numSamples, bool removeDC) -> void {
+    constexpr size_t L = TILE_LANES;
+    // Local copies of everything the lanes read, so the compiler knows none of it
+    // aliases the tile state
+    int envelopeStep[16 * 2];
+    int envelopeStart[16 * 2];
+    std::copy(std::begin(envelopeTables().step), std::end(envelopeTables().step), envelopeStep);
+    std::copy(std::begin(envelopeTables().start), std::end(envelopeTables().start), envelopeStart);
+    double dac[32];
+    std::copy(DacTable_, DacTable_ + 32, dac);
+    double pan[2][TONE_CHANNELS];
+    std::copy(std::begin(PanLeft_), std::end(PanLeft_), pan[0]);
+    std::copy(std::begin(PanRight_), std::end(PanRight_), pan[1]);
+    const double step = Step_;
+    const float masterVolume = MasterVolume_;
+    const bool box = removeDC && DcFilter_ == DcFilterEnum::BOX;
+    const bool iir = removeDC && DcFilter_ == DcFilterEnum::IIR;
+    double x = X_;
+    int firIndex = FirIndex_;
+    int dcIndex = DcIndex_;
+
+    // Tiles are rendered one after another so that each one keeps its FIR and
+    // DC history hot in cache, all of them see the same sequence of ticks
+    for (size_t tileIndex = 0; tileIndex < Tiles_.size(); ++tileIndex) {
+        Tile& t = Tiles_[tileIndex];
+        double* dcDelay = box ? &DcDelay_[tileIndex * 2 * DC_FILTER_SIZE * L] : nullptr;
+        x = X_;
+        firIndex = FirIndex_;
+        dcIndex = DcIndex_;
+        for (size_t s = 0; s < numSamples; ++s) {
+            double out[2][L];
+            for (int i = 0; i < DECIMATE_FACTOR; ++i) {
+                x += step;
+                if (x >= 1) {
+                    x -= 1;
+                    // update_mixer
+                    int noise[L];
+                    int envelope[L];
+                    for (size_t c = 0; c < L; ++c) {
+                        const int nc = t.noiseCounter[c] + 1;
+                        const int shift = nc >= (t.noisePeriod[c] << 1);
+                        const int n = t.noise[c];
+                        t.noiseCounter[c] = shift ? 0 : nc;
+                        t.noise[c] = shift ? (n >> 1) | (((n ^ (n >> 3)) & 1) << 16) : n;
+                        noise[c] = t.noise[c] & 1;
+
+                        const int ec = t.envelopeCounter[c] + 1;
+                        const int fire = ec >= t.envelopePeriod[c];
+                        const int index = t.envelopeShape[c] * 2 + t.envelopeSegment[c];
+                        const int e = t.envelope[c] + fire * envelopeStep[index];
+                        const int wrap = (e > 31) | (e < 0);
+                        t.envelopeCounter[c] = fire ? 0 : ec;
+                        t.envelopeSegment[c] ^= wrap;
+                        t.envelope[c] = wrap ? envelopeStart[index ^ 1] : e;
+                        envelope[c] = t.envelope[c];
+                        out[0][c] = 0;
+                        out[1][c] = 0;
+                    }
+                    for (int ch = 0; ch < TONE_CHANNELS; ++ch) {
+                        for (size_t c = 0; c < L; ++c) {
+                            const int tc = t.toneCounter[ch][c] + 1;
+                            const int flip = tc >= t.tonePeriod[ch][c];
+                            t.toneCounter[ch][c] = flip ? 0 : tc;
+                            t.tone[ch][c] ^= flip;
+                            const int level = t.envelopeOn[ch][c] ? envelope[c] : t.volume[ch][c] * 2 + 1;
+                            const int index = ((t.tone[ch][c] | t.toneOff[ch][c]) & (noise[c] | t.noiseOff[ch][c])) * level;
+                            out[0][c] += dac[index] * pan[0][ch];
+                            out[1][c] += dac[index] * pan[1][ch];
+                        }
+                    }
+                    // cubic interpolator
+                    for (int side = 0; side < 2; ++side) {
+                        double (&y)[4][L] = t.interpolatorY[side];
+                        double (&k)[3][L] = t.interpolatorC[side];
+                        for (size_t c = 0; c < L; ++c) {
+                            y[0][c] = y[1][c];
+                            y[1][c] = y[2][c];
+                            y[2][c] = y[3][c];
+                            y[3][c] = out[side][c];
+                            const double y1 = y[2][c] - y[0][c];
+                            k[0][c] = 0.5 * y[1][c] + 0.25 * (y[0][c] + y[2][c]);
+                            k[1][c] = 0.5 * y1;
+                            k[2][c] = 0.25 * (y[3][c] - y[1][c] - y1);
+                        }
+                    }
+                }
+                // FIR history is a ring of FIR_SIZE frames written twice, so the
+                // newest FIR_SIZE frames are always contiguous
+                firIndex = (firIndex + 1) % FIR_SIZE;
+                for (int side = 0; side < 2; ++side) {
+                    const double (&k)[3][L] = t.interpolatorC[side];
+                    for (size_t c = 0; c < L; ++c) {
+                        const double v = (k[2][c] * x + k[1][c]) * x + k[0][c];
+                        t.fir[side][firIndex][c] = v;
+                        t.fir[side][firIndex + FIR_SIZE][c] = v;
+                    }
+                }
+            }
+
+            // decimate, the sample of age k is at firIndex + FIR_SIZE - k.
+            // Both sides are accumulated together to get two independent chains.
+            const int newest = firIndex + FIR_SIZE;
+            double y[2][L] = {};
+            // every DECIMATE_FACTOR-th tap is zero, so skip them
+            for (int phase = 0; phase < FIR_SIZE / 2; phase += DECIMATE_FACTOR) {
+                for (int k = phase + 1; k < phase + DECIMATE_FACTOR; ++k) {
+                    const double h = FirTable[k];
+                    for (int side = 0; side < 2; ++side) {
+                        const double* a = t.fir[side][newest - k];
+                        const double* b = t.fir[side][newest - FIR_SIZE + k];
+                        for (size_t c = 0; c < L; ++c) {
+                            y[side][c] += h * (a[c] + b[c]);
+                        }
+                    }
+                }
+            }
+            for (int side = 0; side < 2; ++side) {
+                for (size_t c = 0; c < L; ++c) {
+                    out[side][c] = y[side][c] + FirTable[FIR_SIZE / 2] * t.fir[side][newest - FIR_SIZE / 2][c];
+                }
+            }
+
+            if (box) {
+                for (int side = 0; side < 2; ++side) {
+                    double* delay = dcDelay + (side * DC_FILTER_SIZE + dcIndex) * L;
+                    for (size_t c = 0; c < L; ++c) {
+                        t.dcSum[side][c] += -delay[c] + out[side][c];
+                        delay[c] = out[side][c];
+                        out[side][c] = out[side][c] - t.dcSum[side][c] / DC_FILTER_SIZE;
+                    }
+                }
+                dcIndex = (dcIndex + 1) & (DC_FILTER_SIZE - 1);
+            } else if (iir) {
+                for (int side = 0; side < 2; ++side) {
+                    for (size_t c = 0; c < L; ++c) {
+                        t.dcSum[side][c] = out[side][c] - t.dcLast[side][c] + DC_IIR_POLE * t.dcSum[side][c];
+                        t.dcLast[side][c] = out[side][c];
+                        out[side][c] = t.dcSum[side][c];
+                    }
+                }
+            }
+
+            const size_t first = tileIndex * L;
+            const size_t count = std::min(L, NumChips_ - first);
+            for (size_t c = 0; c < count; ++c) {
+                outLeft[(first + c) * chipStride + s] = static_cast<float>(out[0][c]) * masterVolume;
+                outRight[(first + c) * chipStride + s] = static_cast<float>(out[1][c]) * masterVolume;
+            }
         }
-        *outLeft = static_cast<float>(Ayumi_.left) * MasterVolume_;
-        *outRight = static_cast<float>(Ayumi_.right) * MasterVolume_;
     }
+    X_ = x;
+    FirIndex_ = firIndex;
+    DcIndex_ = dcIndex;
 }
 
 }
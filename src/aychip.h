@@ -2,11 +2,13 @@
 
 #include <cmath>
 #include <cstddef>
+#include <memory>
 #include <string>
 #include <vector>
 #include <array>
 
 #include "utils/tools.h"
+#include "ayengine.h"
 
 namespace uZX::Chip {
 
@@ -14,12 +16,6 @@ namespace uZX::Chip {
 /*  C++ wrapper for aychip struct and functions                              */
 /*****************************************************************************/
 
-namespace {
-    extern "C" {
-        #include "ayumi/ayumi.h"
-    }
-}
-
 
 // We must divide AYChip into an interface and implementation, because implementation can vary or even be drivers for real hardware chips
 // Ayumi AY/YM
@@ -114,7 +110,32 @@ public:
     virtual auto getMasterVolume() const -> float = 0;
     virtual auto processBlock(float* outLeft, float* outRight, size_t numSamples, bool removeDC = true, size_t stride = 1) -> void = 0;
 
+    static constexpr int NUM_REGISTERS = 14;
+    // Writes one of R0-R13, ay.R[reg] = value does the same.
+    // The default goes through the setters below, chips with a register file write to it.
+    virtual auto setRegister(int reg, uint8_t value) -> void {
+        static constexpr SetterFunction setters[NUM_REGISTERS] {
+            &AYInterface::setR0, &AYInterface::setR1, &AYInterface::setR2, &AYInterface::setR3,
+            &AYInterface::setR4, &AYInterface::setR5, &AYInterface::setR6, &AYInterface::setR7,
+            &AYInterface::setR8, &AYInterface::setR9, &AYInterface::setR10, &AYInterface::setR11,
+            &AYInterface::setR12, &AYInterface::setR13
+        };
+        (this->*setters[reg])(value);
+    }
+    // Writes a frame of R0-R13 in order, except the registers where mask is true.
+    // A null mask writes them all.
+    virtual auto setRegisters(const uint8_t* values, const bool* mask = nullptr) -> void {
+        for (int reg = 0; reg < NUM_REGISTERS; ++reg) {
+            if (!mask || !mask[reg]) {
+                setRegister(reg, values[reg]);
+            }
+        }
+    }
+    virtual auto getRegister(int reg) const -> uint8_t = 0;
+
 private:
+    typedef void (AYInterface::*SetterFunction)(unsigned char);
+
     inline void setFineTonePeriod(int chan, unsigned char fine) noexcept {
         const int oldPeriod = getTonePeriod(chan);
         setTonePeriod(chan, (oldPeriod & 0xff00) | (fine & 0xff));
@@ -173,51 +194,273 @@ private:
     /************************************************************************/
 
 public:
-    typedef void (AYInterface::*SetterFunction)(unsigned char);
-
     class RegisterAccessor {
     private:
         AYInterface& Obj_;
-        SetterFunction Setter_;
+        int Reg_;
 
     public:
         void operator=(int value) {
-            (Obj_.*Setter_)(value);
+            Obj_.setRegister(Reg_, static_cast<uint8_t>(value));
+        }
+        operator uint8_t() const {
+            return Obj_.getRegister(Reg_);
         }
-        RegisterAccessor(AYInterface& obj, SetterFunction setter)
+        RegisterAccessor(AYInterface& obj, int reg)
             : Obj_(obj)
-            , Setter_(setter)
+            , Reg_(reg)
         {}
     };
 
     AYInterface()
         : R {
-            RegisterAccessor {*this, &AYInterface::setR0},
-            RegisterAccessor {*this, &AYInterface::setR1},
-            RegisterAccessor {*this, &AYInterface::setR2},
-            RegisterAccessor {*this, &AYInterface::setR3},
-            RegisterAccessor {*this, &AYInterface::setR4},
-            RegisterAccessor {*this, &AYInterface::setR5},
-            RegisterAccessor {*this, &AYInterface::setR6},
-            RegisterAccessor {*this, &AYInterface::setR7},
-            RegisterAccessor {*this, &AYInterface::setR8},
-            RegisterAccessor {*this, &AYInterface::setR9},
-            RegisterAccessor {*this, &AYInterface::setR10},
-            RegisterAccessor {*this, &AYInterface::setR11},
-            RegisterAccessor {*this, &AYInterface::setR12},
-            RegisterAccessor {*this, &AYInterface::setR13}
+            RegisterAccessor {*this, 0},
+            RegisterAccessor {*this, 1},
+            RegisterAccessor {*this, 2},
+            RegisterAccessor {*this, 3},
+            RegisterAccessor {*this, 4},
+            RegisterAccessor {*this, 5},
+            RegisterAccessor {*this, 6},
+            RegisterAccessor {*this, 7},
+            RegisterAccessor {*this, 8},
+            RegisterAccessor {*this, 9},
+            RegisterAccessor {*this, 10},
+            RegisterAccessor {*this, 11},
+            RegisterAccessor {*this, 12},
+            RegisterAccessor {*this, 13}
         }
     {};
 
-    std::array<RegisterAccessor, 14> R;
+    std::array<RegisterAccessor, NUM_REGISTERS> R;
+};
+
+
+// R0-R13 of an ayumi chip as the chip has them: written values masked to the register widths.
+// A frame is diffed against the file and only what changed reaches the chip, a tone or
+// envelope period in one write however many of its two registers changed, and the mixer
+// decoded once. R13 is applied on every write, as every write restarts the envelope. The first
+// write of a register is applied whatever its value: a fresh chip is not what the zeroed file
+// says, ayumi_configure leaves the noise period at 0 and not at the 1 that R6 = 0 gives.
+class RegisterFile {
+public:
+    static constexpr int NUM_REGISTERS = AYInterface::NUM_REGISTERS;
+
+    auto get(int reg) const -> uint8_t { return Registers_[reg]; }
+    auto write(ayumi& chip, int reg, uint8_t value) -> void;
+    // Same as writing the registers where mask is not true in order
+    auto writeFrame(ayumi& chip, const uint8_t* values, const bool* mask) -> void;
+    // Catches up with changes made to the chip by other means than registers. A period register
+    // pair is kept when it still gives the chip period, so R0 = 0 stays 0 and not 1.
+    auto sync(const ayumi& chip) -> void;
+
+private:
+    auto apply(ayumi& chip, unsigned dirty) const -> void;
+
+    std::array<uint8_t, NUM_REGISTERS> Registers_ {};
+    unsigned Unwritten_ = (1u << NUM_REGISTERS) - 1;    // bit n set until Rn is written
 };
 
 
+// Parts of the chip logic state AyumiEmulator::isEquivalent compares, the ones that can be heard
+struct ChipStateParts {
+    bool tone[TONE_CHANNELS] = {true, true, true};
+    bool noise = true;
+    bool envelope = true;
+};
+
 class AyumiEmulator : public AYInterface {
 public:
-    AyumiEmulator(int sampleRate = 44100, double clock = 2000000, ChipType type = TypeEnum::YM);
+    AyumiEmulator(int sampleRate = 44100, double clock = 2000000, ChipType type = TypeEnum::YM,
+                  Precision precision = PrecisionEnum::FLOAT64, Quality quality = QualityEnum::STANDARD,
+                  DcFilter dcFilter = DcFilterEnum::BOX);
+    AyumiEmulator(const AyumiEmulator& other);
     ~AyumiEmulator() override;
     auto Reset(int sampleRate = 44100, double clock = 2000000, ChipType type = TypeEnum::YM) -> void;
+    auto getPrecision() const -> Precision;
+    auto getQuality() const -> Quality;
+    // Box by default, like Ayumi. Switching clears the DC filter history of both engines.
+    auto setDcFilter(DcFilter filter) -> void;
+    auto getDcFilter() const -> DcFilter;
+    // setSampleRate, setType and setClock go through retune, which keeps the chip counters
+    // and the filter history, so the sound goes on without a click
+    auto retune(int sampleRate, double clock, ChipType type) -> void;
+
+    auto canChangeClock() const -> bool override;
+    auto canChangeClockContinously() const -> bool override;
+    auto getClock() const -> double override;
+    auto getClockValues() const -> std::vector<float> override;
+    auto setSampleRate(int sampleRate) -> void override;
+    auto getSampleRate() const -> int override;
+    auto setType(ChipType type) -> void override;
+    auto getType() const -> ChipType override;
+    auto setClock(double v) -> void override;
+    auto setPan(int chan, double pan, bool isEqp = false) -> void override;
+    auto getPan(int chan) const -> double override;
+    auto setMixer(int chan, bool tOn, bool nOn, bool eOn) -> void override;
+    auto setEnvelopeOn(int chan, bool on) -> void override;
+    auto setNoiseOn(int chan, bool on) -> void override;
+    auto setVolume(int chan, int volume) -> void override;
+    auto getVolume(int chan) const -> int override;
+    auto setToneOn(int chan, bool on) -> void override;
+    auto setTonePeriod(int chan, int period) -> void override;
+    auto getTonePeriod(int chan) const -> int override;
+    auto setNoisePeriod(int period) -> void override;
+    auto getNoisePeriod() const -> int override;
+    auto setEnvelopeShape(EnvShape shape) -> void override;
+    auto getEnvelopeShape() const -> EnvShape override;
+    auto setEnvelopePeriod(int period) -> void override;
+    auto getEnvelopePeriod() const -> int override;
+    auto setMasterVolume(float volume) -> void override;
+    auto getMasterVolume() const -> float override;
+    auto processBlock(float* outLeft, float* outRight, size_t numSamples, bool removeDC = true, size_t stride = 1) -> void override;
+    auto setRegister(int reg, uint8_t value) -> void override;
+    auto setRegisters(const uint8_t* values, const bool* mask = nullptr) -> void override;
+    auto getRegister(int reg) const -> uint8_t override;
+
+    // Register write at time clock cycles from the start of a processEvents block
+    struct RegisterWrite {
+        double time;
+        int reg;
+        int value;
+    };
+    // Renders numSamples samples applying every write right before the first chip tick after
+    // its time, so writes are not rounded to block or sample boundaries. Times must not decrease.
+    // Writes up to the end of the block are applied, returns how many, the rest are left.
+    auto processEvents(float* outLeft, float* outRight, size_t numSamples, const RegisterWrite* writes, size_t numWrites,
+                       bool removeDC = true, size_t stride = 1) -> size_t;
+
+    // Moves the chip ticks chip ticks on without rendering: tone, noise and envelope
+    // counters, the noise LFSR and the envelope are computed in closed form
+    auto advanceTicks(uint64_t ticks) -> void;
+    // Moves numSamples samples on without rendering. The interpolator, FIR and DC filter
+    // keep their old history, render getWarmUpSamples() samples before using the output
+    auto advance(size_t numSamples) -> void;
+    auto getWarmUpSamples(bool removeDC = true) const -> size_t;
+    // Fast forward: advance() and then render only the warm-up samples, so the output
+    // after it matches rendering all numSamples samples up to rounding
+    auto skip(size_t numSamples, bool removeDC = true) -> void;
+
+    // Versioned binary snapshot of the settings and the chip state. The compact one leaves
+    // out the filter history, which is most of the full one, and loading it clears the history.
+    // loadState restores the precision too and throws std::invalid_argument on bad data.
+    auto saveState(bool compact = false) const -> std::vector<uint8_t>;
+    auto loadState(const uint8_t* data, size_t size) -> void;
+    // True when other has the same settings and registers, the same parts of the chip logic
+    // state (tone counters, noise LFSR, envelope) and its engine phase is within phaseTolerance
+    // of a chip tick of this one: the same registers then render the same parts the same from
+    // both, up to rounding and filter history
+    auto isEquivalent(const AyumiEmulator& other, const ChipStateParts& parts = {}, double phaseTolerance = 1e-6) const -> bool;
+    // Renders channels A, B and C to outs[0..2] without mixing them, in the same pass over
+    // the chip. The channel outputs have their own filter history, pan does not apply to them.
+    auto processBlockChannels(float* const* outs, size_t numSamples, bool removeDC = true, size_t stride = 1) -> void;
+
+    // Counters of both engines and the register writes since creation or resetStats().
+    // Without PYAYAY_STATS they are all zero.
+    auto getStats() const -> RenderStats;
+    auto resetStats() -> void;
+
+private:
+    friend class TurboSound;    // mixes the chip and engine on its bus
+
+    ayumi Ayumi_;
+    RegisterFile Registers_;
+    std::unique_ptr<AyumiEngineBase> Engine_;
+    std::unique_ptr<AyumiEngineBase> ChannelsEngine_;    // made on the first processBlockChannels
+    ChipType Type_;
+    double ClockRate_;
+    int SampleRate_;
+    double Pan_[TONE_CHANNELS];
+    bool IsEqp_[TONE_CHANNELS] = {};
+    float MasterVolume_;
+    RenderStats Stats_;    // register writes, the engines count the rest
+};
+
+
+// TurboSound and other boards of several AY chips with one output. Every chip keeps its own
+// clock, type and pan, and ticks and interpolates on its own, but the chips are mixed on the
+// oversampled bus, so the decimation FIR and DC filter run once for the mix. Like on the board,
+// register writes and the chip settings go to the selected chip, the sample rate and master
+// volume are of the board.
+class TurboSound : public AYInterface {
+public:
+    static constexpr size_t MAX_CHIPS = AyumiEngineBase::MAX_MIX_CHIPS;
+
+    TurboSound(size_t numChips = 2, int sampleRate = 44100, double clock = 2000000, ChipType type = TypeEnum::YM,
+               Precision precision = PrecisionEnum::FLOAT64, Quality quality = QualityEnum::STANDARD,
+               DcFilter dcFilter = DcFilterEnum::BOX);
+    TurboSound(const TurboSound& other);
+    ~TurboSound() override;
+    // Resets every chip and the bus, the pans are kept
+    auto Reset(int sampleRate = 44100, double clock = 2000000, ChipType type = TypeEnum::YM) -> void;
+    auto getPrecision() const -> Precision;
+    auto getQuality() const -> Quality;
+    // The DC filter of the bus, the only one the mix goes through
+    auto setDcFilter(DcFilter filter) -> void;
+    auto getDcFilter() const -> DcFilter;
+
+    auto getNumChips() const -> size_t;
+    auto selectChip(size_t chip) -> void;
+    auto getSelectedChip() const -> size_t;
+    auto getChip(size_t chip) -> AyumiEmulator&;
+    auto getChip(size_t chip) const -> const AyumiEmulator&;
+
+    auto canChangeClock() const -> bool override;
+    auto canChangeClockContinously() const -> bool override;
+    auto getClock() const -> double override;
+    auto getClockValues() const -> std::vector<float> override;
+    auto setSampleRate(int sampleRate) -> void override;
+    auto getSampleRate() const -> int override;
+    auto setType(ChipType type) -> void override;
+    auto getType() const -> ChipType override;
+    auto setClock(double v) -> void override;
+    auto setPan(int chan, double pan, bool isEqp = false) -> void override;
+    auto getPan(int chan) const -> double override;
+    auto setMixer(int chan, bool tOn, bool nOn, bool eOn) -> void override;
+    auto setEnvelopeOn(int chan, bool on) -> void override;
+    auto setNoiseOn(int chan, bool on) -> void override;
+    auto setVolume(int chan, int volume) -> void override;
+    auto getVolume(int chan) const -> int override;
+    auto setToneOn(int chan, bool on) -> void override;
+    auto setTonePeriod(int chan, int period) -> void override;
+    auto getTonePeriod(int chan) const -> int override;
+    auto setNoisePeriod(int period) -> void override;
+    auto getNoisePeriod() const -> int override;
+    auto setEnvelopeShape(EnvShape shape) -> void override;
+    auto getEnvelopeShape() const -> EnvShape override;
+    auto setEnvelopePeriod(int period) -> void override;
+    auto getEnvelopePeriod() const -> int override;
+    auto setMasterVolume(float volume) -> void override;
+    auto getMasterVolume() const -> float override;
+    auto processBlock(float* outLeft, float* outRight, size_t numSamples, bool removeDC = true, size_t stride = 1) -> void override;
+    auto setRegister(int reg, uint8_t value) -> void override;
+    auto setRegisters(const uint8_t* values, const bool* mask = nullptr) -> void override;
+    auto getRegister(int reg) const -> uint8_t override;
+
+private:
+    std::vector<AyumiEmulator> Chips_;
+    // Decimation FIR and DC filter of the mix, the chip engines do the rest
+    std::unique_ptr<AyumiEngineBase> Bus_;
+    size_t Selected_;
+    float MasterVolume_;
+};
+
+
+// The chip logic of Ayumi rendered by band-limited step synthesis instead of oversampling.
+// Every change of the mixed level is added to the output as a band-limited step, read from
+// a table of windowed sinc step responses, straight at the output sample rate. Runs of ticks
+// that can not change the levels are jumped over in closed form, so the cost is per output
+// sample and per level change rather than per chip tick. The output is delayed by BLEP_DELAY
+// samples and has a bit more aliasing near the Nyquist frequency than Ayumi.
+class BlepEmulator : public AYInterface {
+public:
+    static constexpr int BLEP_DELAY = 16;
+    static constexpr int BLEP_TAPS = 2 * BLEP_DELAY + 1;
+    static constexpr int BLEP_PHASES = 64;
+
+    BlepEmulator(int sampleRate = 44100, double clock = 2000000, ChipType type = TypeEnum::YM);
+    BlepEmulator(const BlepEmulator& other);
+    ~BlepEmulator() override;
+    auto Reset(int sampleRate = 44100, double clock = 2000000, ChipType type = TypeEnum::YM) -> void;
 
     auto canChangeClock() const -> bool override;
     auto canChangeClockContinously() const -> bool override;
@@ -247,16 +490,122 @@ public:
     auto setMasterVolume(float volume) -> void override;
     auto getMasterVolume() const -> float override;
     auto processBlock(float* outLeft, float* outRight, size_t numSamples, bool removeDC = true, size_t stride = 1) -> void override;
-    // TODO
-    // * Output to thee separate channels instead of mixing them to stereo panorama
+    auto setRegister(int reg, uint8_t value) -> void override;
+    auto setRegisters(const uint8_t* values, const bool* mask = nullptr) -> void override;
+    auto getRegister(int reg) const -> uint8_t override;
 
 private:
+    // Power of two ring of the step increments still to come, it fits BLEP_TAPS samples
+    static constexpr int BLEP_SLOTS = 64;
+
+    auto retune(int sampleRate, double clock, ChipType type) -> void;
+    // One chip tick at fraction phase of the current output sample
+    auto tick(double phase) -> void;
+    auto flush() -> void;
+
     ayumi Ayumi_;
+    RegisterFile Registers_;
     ChipType Type_;
     double ClockRate_;
     int SampleRate_;
     double Pan_[TONE_CHANNELS];
+    bool IsEqp_[TONE_CHANNELS] = {};
+    float MasterVolume_;
+    // Mix_[ch][level] is what channel ch at DAC level adds to left and right
+    double Mix_[TONE_CHANNELS][32][2];
+    double Step_;           // chip ticks per output sample
+    double NextTick_;       // time of the next chip tick from the start of the current sample, in ticks
+    // Like in AyumiEngine, ticks that keep the levels are counted and applied by flush()
+    uint64_t SteadyTicks_;
+    uint64_t PendingTicks_;
+    double Level_[2];       // mixed level after the last tick
+    double Out_[2];         // sum of all the step increments output so far
+    double Increments_[BLEP_SLOTS][2];
+    int IncrementIndex_;
+    double DcSum_[2];
+    double DcDelay_[DC_FILTER_SIZE][2];
+    int DcIndex_;
+};
+
+
+// Many Ayumi chips with the same sample rate, clock and type rendered in lockstep.
+// Chip state is kept as struct-of-arrays in tiles of TILE_LANES chips, so every
+// step of ayumi_process (counters, mixer, interpolator, FIR, DC filter) is a plain
+// loop over lanes that the compiler turns into 4/8/16-wide SIMD instructions.
+// Registers are kept as a raw register file per chip, like on the real hardware.
+class AyumiBatch {
+public:
+    using ChipType = AYInterface::ChipType;
+    static constexpr int NUM_REGISTERS = 14;
+    static constexpr size_t TILE_LANES = 8;
+
+    AyumiBatch(size_t numChips, int sampleRate = 44100, double clock = 2000000, ChipType type = AYInterface::TypeEnum::YM,
+               DcFilter dcFilter = DcFilterEnum::BOX);
+    auto Reset(int sampleRate = 44100, double clock = 2000000, ChipType type = AYInterface::TypeEnum::YM) -> void;
+
+    auto getNumChips() const -> size_t;
+    auto getSampleRate() const -> int;
+    auto getClock() const -> double;
+    auto getType() const -> ChipType;
+    // Switching clears the DC filter history of every chip
+    auto setDcFilter(DcFilter filter) -> void;
+    auto getDcFilter() const -> DcFilter;
+    auto setPan(int chan, double pan, bool isEqp = false) -> void;
+    auto getPan(int chan) const -> double;
+    auto setMasterVolume(float volume) -> void;
+    auto getMasterVolume() const -> float;
+    auto setRegister(size_t chip, int reg, unsigned char value) -> void;
+    auto getRegister(size_t chip, int reg) const -> unsigned char;
+    // Renders numSamples samples for every chip, chip i is written to outLeft/outRight + i * chipStride
+    auto processBlock(float* outLeft, float* outRight, size_t chipStride, size_t numSamples, bool removeDC = true) -> void;
+
+private:
+    auto clearDc() -> void;
+
+    // struct ayumi of TILE_LANES chips, index [lane] is innermost everywhere.
+    // Index [side] is 0 for left and 1 for right. The box DC filter delay line is in
+    // DcDelay_, so a tile is the chip state and the FIR history only.
+    struct Tile {
+        int tonePeriod[TONE_CHANNELS][TILE_LANES];
+        int toneCounter[TONE_CHANNELS][TILE_LANES];
+        int tone[TONE_CHANNELS][TILE_LANES];
+        int toneOff[TONE_CHANNELS][TILE_LANES];
+        int noiseOff[TONE_CHANNELS][TILE_LANES];
+        int envelopeOn[TONE_CHANNELS][TILE_LANES];
+        int volume[TONE_CHANNELS][TILE_LANES];
+        int noisePeriod[TILE_LANES];
+        int noiseCounter[TILE_LANES];
+        int noise[TILE_LANES];
+        int envelopePeriod[TILE_LANES];
+        int envelopeCounter[TILE_LANES];
+        int envelopeShape[TILE_LANES];
+        int envelopeSegment[TILE_LANES];
+        int envelope[TILE_LANES];
+        double interpolatorC[2][3][TILE_LANES];
+        double interpolatorY[2][4][TILE_LANES];
+        double dcSum[2][TILE_LANES];   // running sum of the box delay line, or last iir output
+        double dcLast[2][TILE_LANES];  // last iir input
+        double fir[2][FIR_SIZE * 2][TILE_LANES];  // ring of FIR_SIZE frames, stored twice
+    };
+
+    size_t NumChips_;
+    int SampleRate_;
+    double ClockRate_;
+    ChipType Type_;
+    double Pan_[TONE_CHANNELS];
+    double PanLeft_[TONE_CHANNELS];
+    double PanRight_[TONE_CHANNELS];
     float MasterVolume_;
+    const double* DacTable_;
+    double Step_;
+    double X_;
+    int FirIndex_;
+    int DcIndex_;
+    DcFilter DcFilter_;
+    std::vector<unsigned char> Registers_;
+    std::vector<Tile> Tiles_;
+    // Box filter only: [tile][side][DC_FILTER_SIZE][lane]
+    std::vector<double> DcDelay_;
 };
 
 } // namespace uZX::Chip
@@ -0,0 +1,874 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "utils/byte_stream.h"
+#include "utils/render_stats.h"
+#include "utils/tools.h"
+
+namespace uZX::Chip {
+
+// The chip logic of Ayumi, defined in aychip.cpp. It has external linkage, so the classes
+// holding a struct ayumi are the same in every translation unit
+extern "C" {
+    #include "ayumi/ayumi.h"
+}
+
+/*****************************************************************************/
+/*  Resampling and output stage of Ayumi, templated on the sample type       */
+/*****************************************************************************/
+
+// Half of the symmetric decimation filter: FirTable[k] weights x[k] + x[FIR_SIZE - k],
+// every DECIMATE_FACTOR-th tap except the center one is zero
+inline constexpr double FirTable[FIR_SIZE / 2 + 1] = {
+    0.0, -0.0000046183113992051936, -0.00001117761640887225, -0.000018610264502005432,
+    -0.000025134586135631012, -0.000028494281690666197, -0.000026396828793275159, -0.000017094212558802156,
+    0.0, 0.000023798193576966866, 0.000051281160242202183, 0.00007762197826243427,
+    0.000096759426664120416, 0.00010240229300393402, 0.000089344614218077106, 0.000054875700118949183,
+    0.0, -0.000069839082210680165, -0.0001447966132360757, -0.00021158452917708308,
+    -0.00025535069106550544, -0.00026228714374322104, -0.00022258805927027799, -0.00013323230495695704,
+    0.0, 0.00016182578767055206, 0.00032846175385096581, 0.00047045611576184863,
+    0.00055713851457530944, 0.00056212565121518726, 0.00046901918553962478, 0.00027624866838952986,
+    0.0, -0.00032564179486838622, -0.00065182310286710388, -0.00092127787309319298,
+    -0.0010772534348943575, -0.0010737727700273478, -0.00088556645390392634, -0.00051581896090765534,
+    0.0, 0.00059548767193795277, 0.0011803558710661009, 0.0016527320270369871,
+    0.0019152679330965555, 0.0018927324805381538, 0.0015481870327877937, 0.00089470695834941306,
+    0.0, -0.0010178225878206125, -0.0020037400552054292, -0.0027874356824117317,
+    -0.003210329988021943, -0.0031540624117984395, -0.0025657163651900345, -0.0014750752642111449,
+    0.0, 0.0016624165446378462, 0.0032591192839069179, 0.0045165685815867747,
+    0.0051838984346123896, 0.0050774264697459933, 0.0041192521414141585, 0.0023628575417966491,
+    0.0, -0.0026543507866759182, -0.0051990251084333425, -0.0072020238234656924,
+    -0.0082672928192007358, -0.0081033739572956287, -0.006583111539570221, -0.0037839040415292386,
+    0.0, 0.0042781252851152507, 0.0084176358598320178, 0.01172566057463055,
+    0.013550476647788672, 0.013388189369997496, 0.010979501242341259, 0.006381274941685413,
+    0.0, -0.007421229604153888, -0.01486456304340213, -0.021143584622178104,
+    -0.02504275058758609, -0.025473530942547201, -0.021627310017882196, -0.013104323383225543,
+    0.0, 0.017065133989980476, 0.036978919264451952, 0.05823318062093958,
+    0.079072012081405949, 0.097675998716952317, 0.11236045936950932, 0.12176343577287731,
+    0.125
+};
+
+// Generic tables for the quality tiers: a Blackman windowed sinc with the cutoff at the output
+// Nyquist frequency, so like in FirTable every DecimateFactor-th tap except the center one
+// is exactly zero. The standard tier keeps FirTable, which is bit exact with the C ayumi.
+namespace FirDesign {
+    inline constexpr double PI = 3.14159265358979323846;
+
+    constexpr auto cos(double x) -> double {
+        const double turns = x / (2 * PI);
+        x -= 2 * PI * static_cast<double>(static_cast<long long>(turns + (turns < 0 ? -0.5 : 0.5)));
+        double term = 1;
+        double sum = 1;
+        for (int n = 1; n < 30; ++n) {
+            term *= -x * x / ((2 * n - 1) * (2 * n));
+            sum += term;
+        }
+        return sum;
+    }
+
+    constexpr auto sin(double x) -> double {
+        return cos(x - PI / 2);
+    }
+
+    template <int DecimateFactor, int FirSize>
+    constexpr auto makeTable() -> std::array<double, FirSize / 2 + 1> {
+        std::array<double, FirSize / 2 + 1> half {};
+        if constexpr (DecimateFactor == DECIMATE_FACTOR && FirSize == FIR_SIZE) {
+            for (size_t k = 0; k < half.size(); ++k) {
+                half[k] = FirTable[k];
+            }
+        } else {
+            double sum = 0;
+            for (int k = 0; k <= FirSize / 2; ++k) {
+                const int offset = FirSize / 2 - k;
+                if (offset && offset % DecimateFactor == 0) {
+                    continue;
+                }
+                const double x = PI * offset / DecimateFactor;
+                const double sinc = offset ? sin(x) / x : 1.0;
+                const double window = 0.42 - 0.5 * cos(2 * PI * k / FirSize) + 0.08 * cos(4 * PI * k / FirSize);
+                half[k] = sinc * window;
+                sum += offset ? 2 * half[k] : half[k];
+            }
+            for (double& h : half) {
+                h /= sum;
+            }
+        }
+        return half;
+    }
+} // namespace FirDesign
+
+struct PrecisionEnum {
+    enum Enum {
+        FLOAT64,
+        FLOAT32
+    };
+    static inline constexpr std::string_view labels[] {
+        "float64",
+        "float32"
+    };
+};
+using Precision = EnumChoice<PrecisionEnum>;
+
+// Decimation factor and FIR size of the engine: draft is 4x and 64 taps,
+// standard is Ayumi's 8x and 192 taps, high is 16x and 384 taps
+struct QualityEnum {
+    enum Enum {
+        DRAFT,
+        STANDARD,
+        HIGH
+    };
+    static inline constexpr std::string_view labels[] {
+        "draft",
+        "standard",
+        "high"
+    };
+};
+using Quality = EnumChoice<QualityEnum>;
+
+// DC removal of the output: box is Ayumi's moving average of DC_FILTER_SIZE samples, iir is
+// a one-pole high-pass with the same -3 dB point, about 10 Hz at 44.1 kHz, and no delay line
+struct DcFilterEnum {
+    enum Enum {
+        BOX,
+        IIR
+    };
+    static inline constexpr std::string_view labels[] {
+        "box",
+        "iir"
+    };
+};
+using DcFilter = EnumChoice<DcFilterEnum>;
+
+// Pole of the iir DC filter: 1 - w, where w is the -3 dB frequency of the box filter in radians
+inline constexpr double DC_IIR_POLE = 1 - 1.5096 / DC_FILTER_SIZE;
+// Samples the iir DC filter takes to forget its input below float precision, ln(2^24) / (1 - pole)
+inline constexpr size_t DC_IIR_WARM_UP = static_cast<size_t>(16.64 * DC_FILTER_SIZE / 1.5096) + 1;
+
+// Closed-form jumps of the chip logic, defined next to it in aychip.cpp.
+// advanceChip ticks the chip ticks times without computing the levels.
+// getSteadyTicks tells how many of the next ticks keep the levels of the current state.
+auto advanceChip(ayumi& chip, uint64_t ticks) -> void;
+auto getSteadyTicks(const ayumi& chip) -> uint64_t;
+
+// Register writes timed in chip ticks, applied by the engine in the middle of a block.
+// The engine calls start() when a block begins and tick() right before every chip tick,
+// which applies all the events due by then, so they land on the exact tick.
+class TickEventQueue {
+public:
+    virtual ~TickEventQueue() {};
+
+    // phase is the part of the next tick already passed, the first tick is at time 1 - phase
+    auto start(double phase) -> void {
+        Time_ = 1 - phase;
+        NextTime_ = nextTime();
+    }
+
+    // Whether the next tick applies events
+    auto isDue() const -> bool {
+        return NextTime_ < Time_;
+    }
+
+    auto tick() -> void {
+        while (NextTime_ < Time_) {
+            applyNext();
+            NextTime_ = nextTime();
+        }
+        Time_ += 1;
+    }
+
+protected:
+    // Time of the next event in ticks from the start of the block, infinity when there are none
+    virtual auto nextTime() const -> double = 0;
+    virtual auto applyNext() -> void = 0;
+
+private:
+    double Time_ = 0;
+    double NextTime_ = 0;
+};
+
+// What the engine renders: the stereo mix, or every tone channel on its own
+enum class EngineOutput {
+    STEREO,
+    CHANNELS
+};
+
+// Everything after the chip logic: mix of the DAC levels to the outputs, cubic interpolator,
+// decimation FIR and DC filter. The chip itself (struct ayumi) is ticked from here.
+class AyumiEngineBase {
+public:
+    virtual ~AyumiEngineBase() {};
+
+    virtual auto clone() const -> std::unique_ptr<AyumiEngineBase> = 0;
+    virtual auto getPrecision() const -> Precision = 0;
+    virtual auto getQuality() const -> Quality = 0;
+    // Resets the filter state, like ayumi_configure does for the chip
+    virtual auto configure(const double* dacTable, double clock, int sampleRate) -> void = 0;
+    // Switches the DAC table and rates in place, the phase and filter history are kept.
+    // Stereo tables need setPan again afterwards.
+    virtual auto retune(const double* dacTable, double clock, int sampleRate) -> void = 0;
+    virtual auto setPan(int chan, double pan, bool isEqp) -> void = 0;
+    // Switching the DC filter clears its history, configure keeps it
+    virtual auto setDcFilter(DcFilter filter) -> void = 0;
+    virtual auto getDcFilter() const -> DcFilter = 0;
+    // outs are left and right, or channels A, B and C. Events, if given, are applied on their ticks
+    virtual auto processBlock(ayumi& chip, float* const* outs, size_t numSamples,
+                              bool removeDC, size_t stride, float masterVolume,
+                              TickEventQueue* events = nullptr) -> void = 0;
+    // Most chips processMix takes, boards have two or three
+    static constexpr size_t MAX_MIX_CHIPS = 8;
+    // Renders several chips mixed on the oversampled bus of this engine: the engine voices[k]
+    // of every chip ticks it and interpolates it at its own rate and pan, and the sum goes
+    // through the FIR and DC filter of this engine once. voices must be of the type of this one.
+    virtual auto processMix(ayumi* const* chips, AyumiEngineBase* const* voices, size_t numChips,
+                            float* const* outs, size_t numSamples, bool removeDC, size_t stride,
+                            float masterVolume) -> void = 0;
+    virtual auto getPhase() const -> double = 0;
+    virtual auto setPhase(double phase) -> void = 0;
+    // Moves the phase numSamples samples on without rendering, returns the chip ticks passed.
+    // The filter history is left as it is.
+    virtual auto advance(size_t numSamples) -> uint64_t = 0;
+    // Samples to render until the interpolator, FIR and, with removeDC, DC filter
+    // hold nothing from before
+    virtual auto getWarmUpSamples(bool removeDC) const -> size_t = 0;
+    // The phase, and withHistory the interpolator, FIR and DC filter history.
+    // Loading without history clears it, like configure does.
+    virtual auto saveState(ByteWriter& out, bool withHistory) const -> void = 0;
+    virtual auto loadState(ByteReader& in, bool withHistory) -> void = 0;
+    // Counters of the blocks rendered so far, kept by configure and loadState
+    virtual auto getStats() const -> const RenderStats& = 0;
+    virtual auto resetStats() -> void = 0;
+};
+
+// Real is the type of all the filter state and arithmetic. The phase accumulator and
+// the DC filter running sums stay in double, so float32 does not drift over time.
+// Every output has its own interpolator, FIR and DC filter lane.
+// The chip tick and mix are specialized on how each channel is mixed (see ChannelMode),
+// the kernel is picked once per block from the mixer, volume and envelope registers.
+// The interpolator makes DecimateFactor frames per output sample, decimated by a FirSize FIR.
+template <typename Real, EngineOutput Output = EngineOutput::STEREO,
+          int DecimateFactor = DECIMATE_FACTOR, int FirSize = FIR_SIZE>
+class AyumiEngine final : public AyumiEngineBase {
+public:
+    static constexpr int OUTPUTS = Output == EngineOutput::STEREO ? 2 : TONE_CHANNELS;
+    static constexpr int PROCESS_BLOCK_SIZE = 8;
+    // Output samples of oversampled history, a power of two that fits FirSize plus a block
+    static constexpr int FIR_SLOTS = 32;
+    static constexpr auto FIR = FirDesign::makeTable<DecimateFactor, FirSize>();
+
+    static_assert(FirSize % (2 * DecimateFactor) == 0, "FIR must cover whole output samples on each side");
+    static_assert(FirSize / DecimateFactor + PROCESS_BLOCK_SIZE <= FIR_SLOTS, "FIR history does not fit");
+
+    auto clone() const -> std::unique_ptr<AyumiEngineBase> override;
+    auto getPrecision() const -> Precision override;
+    auto getQuality() const -> Quality override;
+    auto configure(const double* dacTable, double clock, int sampleRate) -> void override;
+    auto retune(const double* dacTable, double clock, int sampleRate) -> void override;
+    auto setPan(int chan, double pan, bool isEqp) -> void override;
+    auto setDcFilter(DcFilter filter) -> void override;
+    auto getDcFilter() const -> DcFilter override { return DcFilter_; }
+    auto processBlock(ayumi& chip, float* const* outs, size_t numSamples,
+                      bool removeDC, size_t stride, float masterVolume,
+                      TickEventQueue* events = nullptr) -> void override;
+    auto processMix(ayumi* const* chips, AyumiEngineBase* const* voices, size_t numChips,
+                    float* const* outs, size_t numSamples, bool removeDC, size_t stride,
+                    float masterVolume) -> void override;
+    auto getPhase() const -> double override { return X_; }
+    auto setPhase(double phase) -> void override { X_ = phase; }
+    auto advance(size_t numSamples) -> uint64_t override;
+    auto getWarmUpSamples(bool removeDC) const -> size_t override;
+    auto saveState(ByteWriter& out, bool withHistory) const -> void override;
+    auto loadState(ByteReader& in, bool withHistory) -> void override;
+    auto getStats() const -> const RenderStats& override { return Stats_; }
+    auto resetStats() -> void override { Stats_ = {}; }
+
+private:
+    // SILENT channels have volume 0 and no envelope, their level is always DAC 0 or 1, both zero
+    enum ChannelMode {
+        SILENT,
+        FIXED,
+        ENVELOPE,
+        NUM_CHANNEL_MODES
+    };
+    // Kernel index is the sum of mode(ch) * 3^ch, DYNAMIC_KERNEL reads the registers every tick
+    static constexpr int NUM_KERNELS = NUM_CHANNEL_MODES * NUM_CHANNEL_MODES * NUM_CHANNEL_MODES;
+    static constexpr int DYNAMIC_KERNEL = -1;
+
+    // Polyphase FIR history, see Fir_
+    using FirHistory = Real (*)[FIR_SLOTS * 2][OUTPUTS];
+    using ProcessFn = void (AyumiEngine::*)(ayumi&, Real (*)[OUTPUTS], int, TickEventQueue*);
+    using InterpolateFn = void (AyumiEngine::*)(ayumi&, int, TickEventQueue*, FirHistory, int);
+
+    template <size_t... Kernel>
+    static constexpr auto makeKernels(std::index_sequence<Kernel...>) -> std::array<ProcessFn, NUM_KERNELS> {
+        return {&AyumiEngine::process<static_cast<int>(Kernel), false>...};
+    }
+    template <bool Mix, size_t... Kernel>
+    static constexpr auto makeInterpolateKernels(std::index_sequence<Kernel...>) -> std::array<InterpolateFn, NUM_KERNELS> {
+        return {&AyumiEngine::interpolate<static_cast<int>(Kernel), false, Mix>...};
+    }
+    static auto getKernel(const ayumi& chip) -> int;
+
+    auto mix(int chan, int level, Real* out) const -> void;
+    template <int Chan, int Mode>
+    auto mixChannel(const ayumi& chip, int noise, Real* out) const -> void;
+    template <int Kernel>
+    auto update(ayumi& chip) -> void;
+    auto flush(ayumi& chip) -> void;
+    template <int Kernel, bool WithEvents, bool Mix>
+    auto interpolate(ayumi& chip, int count, TickEventQueue* events, FirHistory fir, int firIndex) -> void;
+    template <int Kernel, bool WithEvents>
+    auto process(ayumi& chip, Real (*out)[OUTPUTS], int count, TickEventQueue* events) -> void;
+    template <int Count>
+    auto decimate(int first, Real (*y)[OUTPUTS]) const -> void;
+    auto decimateBlock(Real (*out)[OUTPUTS], int count) -> void;
+    auto output(Real (*out)[OUTPUTS], int count, float* const* outs, size_t& offset, size_t stride,
+                bool removeDC, float masterVolume) -> void;
+    auto clearDc() -> void;
+
+    // Index [o] is the output everywhere: left and right, or channels A, B and C.
+    // Laid out from the hottest: what every tick touches, then every sample, then the tables
+    // and history. The box DC filter delay line, the largest part, is allocated apart.
+    double Step_;
+    double X_;
+    // While the levels and the interpolator are constant, ticks only move the chip counters,
+    // so they are counted in PendingTicks_ and applied by flush() in closed form
+    uint64_t SteadyTicks_;
+    uint64_t PendingTicks_;
+    Real InterpolatorC_[3][OUTPUTS];
+    Real InterpolatorY_[4][OUTPUTS];
+    int FirIndex_;
+    int DcIndex_;
+    DcFilter DcFilter_;
+    // Running sum of the box delay line, or the last output of the iir filter
+    double DcSum_[OUTPUTS];
+    Real DcLast_[OUTPUTS];    // last input of the iir filter
+    // What channel ch at DAC level adds to every output: the DAC value times the pan,
+    // or for CHANNELS just the DAC value at its own output
+    Real Mix_[TONE_CHANNELS][32][OUTPUTS];
+    // Polyphase history: [phase][slot][o], frame i of output sample n is at [i][n % FIR_SLOTS],
+    // every slot is stored twice (at n and n + FIR_SLOTS), so any FIR_SLOTS slots are contiguous
+    Real Fir_[DecimateFactor][FIR_SLOTS * 2][OUTPUTS];
+    Real Dac_[32];
+    RenderStats Stats_;
+    // DC_FILTER_SIZE samples for the box filter, empty for iir
+    std::vector<std::array<Real, OUTPUTS>> DcDelay_;
+};
+
+template <typename Real, EngineOutput Output>
+auto makeAyumiEngine(Quality quality) -> std::unique_ptr<AyumiEngineBase> {
+    switch (quality) {
+    case QualityEnum::DRAFT:
+        return std::make_unique<AyumiEngine<Real, Output, 4, 64>>();
+    case QualityEnum::HIGH:
+        return std::make_unique<AyumiEngine<Real, Output, 16, 384>>();
+    default:
+        return std::make_unique<AyumiEngine<Real, Output>>();
+    }
+}
+
+template <EngineOutput Output = EngineOutput::STEREO>
+auto makeAyumiEngine(Precision precision, Quality quality = QualityEnum::STANDARD) -> std::unique_ptr<AyumiEngineBase> {
+    if (precision == PrecisionEnum::FLOAT32) {
+        return makeAyumiEngine<float, Output>(quality);
+    }
+    return makeAyumiEngine<double, Output>(quality);
+}
+
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::clone() const -> std::unique_ptr<AyumiEngineBase> {
+    return std::make_unique<AyumiEngine>(*this);
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::getPrecision() const -> Precision {
+    return sizeof(Real) == sizeof(float) ? PrecisionEnum::FLOAT32 : PrecisionEnum::FLOAT64;
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::getQuality() const -> Quality {
+    return DecimateFactor < DECIMATE_FACTOR ? QualityEnum::DRAFT
+         : DecimateFactor > DECIMATE_FACTOR ? QualityEnum::HIGH : QualityEnum::STANDARD;
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::configure(const double* dacTable, double clock, int sampleRate) -> void {
+    const RenderStats stats = Stats_;
+    const DcFilter dcFilter = DcFilter_;
+    *this = AyumiEngine();
+    Stats_ = stats;
+    DcFilter_ = dcFilter;
+    clearDc();
+    retune(dacTable, clock, sampleRate);
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::setDcFilter(DcFilter filter) -> void {
+    DcFilter_ = filter;
+    clearDc();
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::clearDc() -> void {
+    DcIndex_ = 0;
+    std::fill(std::begin(DcSum_), std::end(DcSum_), 0.0);
+    std::fill(std::begin(DcLast_), std::end(DcLast_), Real(0));
+    if (DcFilter_ == DcFilterEnum::BOX) {
+        DcDelay_.assign(DC_FILTER_SIZE, {});
+    } else {
+        DcDelay_ = {};
+    }
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::retune(const double* dacTable, double clock, int sampleRate) -> void {
+    for (int i = 0; i < 32; ++i) {
+        Dac_[i] = static_cast<Real>(dacTable[i]);
+    }
+    if constexpr (Output == EngineOutput::CHANNELS) {
+        for (int ch = 0; ch < TONE_CHANNELS; ++ch) {
+            for (int i = 0; i < 32; ++i) {
+                Mix_[ch][i][ch] = Dac_[i];
+            }
+        }
+    }
+    Step_ = clock / (sampleRate * 8 * DecimateFactor);
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::setPan(int chan, double pan, bool isEqp) -> void {
+    if constexpr (Output == EngineOutput::STEREO) {
+        const auto left = static_cast<Real>(isEqp ? std::sqrt(1 - pan) : 1 - pan);
+        const auto right = static_cast<Real>(isEqp ? std::sqrt(pan) : pan);
+        for (int i = 0; i < 32; ++i) {
+            Mix_[chan][i][0] = Dac_[i] * left;
+            Mix_[chan][i][1] = Dac_[i] * right;
+        }
+    }
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::getKernel(const ayumi& chip) -> int {
+    int kernel = 0;
+    for (int ch = TONE_CHANNELS - 1; ch >= 0; --ch) {
+        const auto& channel = chip.channels[ch];
+        const int mode = channel.e_on ? ENVELOPE : channel.volume ? FIXED : SILENT;
+        kernel = kernel * NUM_CHANNEL_MODES + mode;
+    }
+    return kernel;
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::flush(ayumi& chip) -> void {
+    advanceChip(chip, PendingTicks_);
+    PendingTicks_ = 0;
+    SteadyTicks_ = 0;
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::mix(int chan, int level, Real* out) const -> void {
+    if constexpr (Output == EngineOutput::STEREO) {
+        out[0] += Mix_[chan][level][0];
+        out[1] += Mix_[chan][level][1];
+    } else {
+        out[chan] = Mix_[chan][level][chan];
+    }
+}
+
+// Same level as ayumi_levels, with the envelope or volume choice made at compile time
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+template <int Chan, int Mode>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::mixChannel(const ayumi& chip, int noise, Real* out) const -> void {
+    if constexpr (Mode != SILENT) {
+        const auto& channel = chip.channels[Chan];
+        const int gate = (channel.tone | channel.t_off) & (noise | channel.n_off);
+        mix(Chan, gate * (Mode == ENVELOPE ? chip.envelope : channel.volume * 2 + 1), out);
+    }
+}
+
+// One chip tick: mix the channels to the outputs and feed the cubic interpolator
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+template <int Kernel>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::update(ayumi& chip) -> void {
+    if (PendingTicks_) {
+        flush(chip);
+    }
+    Real out[OUTPUTS] = {};
+    if constexpr (Kernel == DYNAMIC_KERNEL) {
+        int levels[TONE_CHANNELS];
+        ayumi_tick(&chip, levels);
+        for (int ch = 0; ch < TONE_CHANNELS; ++ch) {
+            mix(ch, levels[ch], out);
+        }
+    } else {
+        ayumi_update(&chip);
+        const int noise = chip.noise & 1;
+        mixChannel<0, Kernel % NUM_CHANNEL_MODES>(chip, noise, out);
+        mixChannel<1, Kernel / NUM_CHANNEL_MODES % NUM_CHANNEL_MODES>(chip, noise, out);
+        mixChannel<2, Kernel / (NUM_CHANNEL_MODES * NUM_CHANNEL_MODES)>(chip, noise, out);
+    }
+    for (int o = 0; o < OUTPUTS; ++o) {
+        Real (&y)[4][OUTPUTS] = InterpolatorY_;
+        Real (&c)[3][OUTPUTS] = InterpolatorC_;
+        y[0][o] = y[1][o];
+        y[1][o] = y[2][o];
+        y[2][o] = y[3][o];
+        y[3][o] = out[o];
+        const Real y1 = y[2][o] - y[0][o];
+        c[0][o] = Real(0.5) * y[1][o] + Real(0.25) * (y[0][o] + y[2][o]);
+        c[1][o] = Real(0.5) * y1;
+        c[2][o] = Real(0.25) * (y[3][o] - y[1][o] - y1);
+    }
+    // Four equal points make the interpolator constant, the next ticks with the same levels
+    // would compute the very same coefficients
+    bool flat = true;
+    for (int o = 0; o < OUTPUTS; ++o) {
+        const Real (&y)[4][OUTPUTS] = InterpolatorY_;
+        flat = flat && y[0][o] == y[3][o] && y[1][o] == y[3][o] && y[2][o] == y[3][o];
+    }
+    SteadyTicks_ = flat ? getSteadyTicks(chip) : 0;
+}
+
+// Polyphase decimation of Count output samples at once, the first one is in slot first.
+// Tap k = DecimateFactor * q + r of output j reads frame DecimateFactor - 1 - r of slot
+// first + j - q, so for every tap the inputs of all samples and outputs are contiguous and
+// the inner loop is a run of OUTPUTS * Count independent SIMD lanes. Each output is summed
+// in the same order as the direct form filter of the C ayumi, so the double path of the
+// standard quality is bit exact with it.
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+template <int Count>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::decimate(int first, Real (*y)[OUTPUTS]) const -> void {
+    constexpr int LAST_PHASE = DecimateFactor - 1;
+    constexpr int TAPS_SLOTS = FirSize / DecimateFactor - 1;
+    Real acc[Count][OUTPUTS] = {};
+    for (int q = 0; q < FirSize / 2 / DecimateFactor; ++q) {
+        // r == 0 taps are zero, the mirrored tap FirSize - k is frame r - 1 of slot first + j - TAPS_SLOTS + q
+        for (int r = 1; r < DecimateFactor; ++r) {
+            const Real h = static_cast<Real>(FIR[q * DecimateFactor + r]);
+            const Real (*a)[OUTPUTS] = &Fir_[LAST_PHASE - r][first - q];
+            const Real (*b)[OUTPUTS] = &Fir_[r - 1][first - TAPS_SLOTS + q];
+            for (int j = 0; j < Count; ++j) {
+                for (int o = 0; o < OUTPUTS; ++o) {
+                    acc[j][o] += h * (a[j][o] + b[j][o]);
+                }
+            }
+        }
+    }
+    const Real center = static_cast<Real>(FIR[FirSize / 2]);
+    const Real (*a)[OUTPUTS] = &Fir_[LAST_PHASE][first - FirSize / 2 / DecimateFactor];
+    for (int j = 0; j < Count; ++j) {
+        for (int o = 0; o < OUTPUTS; ++o) {
+            y[j][o] = acc[j][o] + center * a[j][o];
+        }
+    }
+}
+
+// Ticks the chip and makes the interpolator frames of the count output samples after
+// firIndex in fir. With Mix the frames are added to what fir has, so several chips can
+// share one FIR history.
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+template <int Kernel, bool WithEvents, bool Mix>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::interpolate(ayumi& chip, int count, TickEventQueue* events,
+                                                                     FirHistory fir, int firIndex) -> void {
+    const uint64_t start = RenderStats::now();
+    uint64_t mixerCycles = 0;
+    int slot = firIndex;
+    for (int j = 0; j < count; ++j) {
+        slot = (slot + 1) & (FIR_SLOTS - 1);
+        for (int i = 0; i < DecimateFactor; ++i) {
+            X_ += Step_;
+            // Draft quality makes fewer frames than chip ticks, so a frame may take several.
+            // The other tiers take at most one, like the C ayumi.
+            while (X_ >= 1) {
+                X_ -= 1;
+                if constexpr (WithEvents) {
+                    if (events->isDue()) {
+                        flush(chip);
+                    }
+                    events->tick();
+                }
+                if constexpr (RenderStats::ENABLED) {
+                    ++Stats_.ticks;
+                }
+                if (SteadyTicks_) {
+                    --SteadyTicks_;
+                    ++PendingTicks_;
+                    if constexpr (RenderStats::ENABLED) {
+                        ++Stats_.steadyTicks;
+                    }
+                } else if constexpr (RenderStats::ENABLED) {
+                    const uint64_t tickStart = RenderStats::now();
+                    update<Kernel>(chip);
+                    mixerCycles += RenderStats::now() - tickStart;
+                } else {
+                    update<Kernel>(chip);
+                }
+                if constexpr (DecimateFactor >= DECIMATE_FACTOR) {
+                    break;
+                }
+            }
+            const Real x = static_cast<Real>(X_);
+            for (int o = 0; o < OUTPUTS; ++o) {
+                const Real v = (InterpolatorC_[2][o] * x + InterpolatorC_[1][o]) * x + InterpolatorC_[0][o];
+                if constexpr (Mix) {
+                    fir[i][slot][o] += v;
+                    fir[i][slot + FIR_SLOTS][o] += v;
+                } else {
+                    fir[i][slot][o] = v;
+                    fir[i][slot + FIR_SLOTS][o] = v;
+                }
+            }
+        }
+    }
+    if constexpr (RenderStats::ENABLED) {
+        Stats_.mixerCycles += mixerCycles;
+        Stats_.interpolationCycles += RenderStats::now() - start - mixerCycles;
+    }
+}
+
+// Decimates the count output samples after FirIndex_, which moves on to the last of them
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::decimateBlock(Real (*out)[OUTPUTS], int count) -> void {
+    const uint64_t firStart = RenderStats::now();
+    FirIndex_ = (FirIndex_ + count) & (FIR_SLOTS - 1);
+    const int first = FirIndex_ + FIR_SLOTS - (count - 1);
+    if (count == PROCESS_BLOCK_SIZE) {
+        decimate<PROCESS_BLOCK_SIZE>(first, out);
+    } else {
+        for (int j = 0; j < count; ++j) {
+            decimate<1>(first + j, out + j);
+        }
+    }
+    if constexpr (RenderStats::ENABLED) {
+        Stats_.firCycles += RenderStats::now() - firStart;
+    }
+}
+
+// Renders count <= PROCESS_BLOCK_SIZE output samples before the DC filter
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+template <int Kernel, bool WithEvents>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::process(ayumi& chip, Real (*out)[OUTPUTS], int count, TickEventQueue* events) -> void {
+    interpolate<Kernel, WithEvents, false>(chip, count, events, Fir_, FirIndex_);
+    decimateBlock(out, count);
+}
+
+// DC filter, master volume and conversion of count samples to outs at offset, which moves on
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::output(Real (*out)[OUTPUTS], int count, float* const* outs,
+                                                                size_t& offset, size_t stride,
+                                                                bool removeDC, float masterVolume) -> void {
+    const uint64_t dcStart = RenderStats::now();
+    const bool box = removeDC && DcFilter_ == DcFilterEnum::BOX;
+    const bool iir = removeDC && DcFilter_ == DcFilterEnum::IIR;
+    for (int j = 0; j < count; ++j, offset += stride) {
+        if (box) {
+            for (int o = 0; o < OUTPUTS; ++o) {
+                const Real x = out[j][o];
+                DcSum_[o] += -static_cast<double>(DcDelay_[DcIndex_][o]) + x;
+                DcDelay_[DcIndex_][o] = x;
+                out[j][o] = static_cast<Real>(x - DcSum_[o] / DC_FILTER_SIZE);
+            }
+            DcIndex_ = (DcIndex_ + 1) & (DC_FILTER_SIZE - 1);
+        } else if (iir) {
+            for (int o = 0; o < OUTPUTS; ++o) {
+                const Real x = out[j][o];
+                DcSum_[o] = static_cast<double>(x) - DcLast_[o] + DC_IIR_POLE * DcSum_[o];
+                DcLast_[o] = x;
+                out[j][o] = static_cast<Real>(DcSum_[o]);
+            }
+        }
+        for (int o = 0; o < OUTPUTS; ++o) {
+            outs[o][offset] = static_cast<float>(out[j][o]) * masterVolume;
+        }
+    }
+    if constexpr (RenderStats::ENABLED) {
+        Stats_.dcCycles += RenderStats::now() - dcStart;
+    }
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::processBlock(ayumi& chip, float* const* outs, size_t numSamples,
+                                             bool removeDC, size_t stride, float masterVolume,
+                                             TickEventQueue* events) -> void {
+    static constexpr auto kernels = makeKernels(std::make_index_sequence<NUM_KERNELS>());
+    Real out[PROCESS_BLOCK_SIZE][OUTPUTS];
+    size_t offset = 0;
+    // Registers may have changed since the last block. Events may change them at any tick,
+    // so with events the channel modes are read on every tick.
+    SteadyTicks_ = 0;
+    ProcessFn kernel = &AyumiEngine::process<DYNAMIC_KERNEL, true>;
+    if (events) {
+        events->start(X_);
+    } else {
+        kernel = kernels[getKernel(chip)];
+    }
+    for (size_t i = 0; i < numSamples; i += PROCESS_BLOCK_SIZE) {
+        const int count = static_cast<int>(std::min<size_t>(PROCESS_BLOCK_SIZE, numSamples - i));
+        (this->*kernel)(chip, out, count, events);
+        output(out, count, outs, offset, stride, removeDC, masterVolume);
+    }
+    flush(chip);
+    if constexpr (RenderStats::ENABLED) {
+        Stats_.samples += numSamples;
+        ++Stats_.blocks;
+    }
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::processMix(ayumi* const* chips, AyumiEngineBase* const* voices,
+                                                                    size_t numChips, float* const* outs, size_t numSamples,
+                                                                    bool removeDC, size_t stride, float masterVolume) -> void {
+    // The first chip writes the frames, the others add to them
+    static constexpr auto writeKernels = makeInterpolateKernels<false>(std::make_index_sequence<NUM_KERNELS>());
+    static constexpr auto mixKernels = makeInterpolateKernels<true>(std::make_index_sequence<NUM_KERNELS>());
+    InterpolateFn kernels[MAX_MIX_CHIPS];
+    for (size_t k = 0; k < numChips; ++k) {
+        auto* voice = static_cast<AyumiEngine*>(voices[k]);
+        voice->SteadyTicks_ = 0;
+        kernels[k] = (k ? mixKernels : writeKernels)[getKernel(*chips[k])];
+    }
+    Real out[PROCESS_BLOCK_SIZE][OUTPUTS];
+    size_t offset = 0;
+    for (size_t i = 0; i < numSamples; i += PROCESS_BLOCK_SIZE) {
+        const int count = static_cast<int>(std::min<size_t>(PROCESS_BLOCK_SIZE, numSamples - i));
+        for (size_t k = 0; k < numChips; ++k) {
+            (static_cast<AyumiEngine*>(voices[k])->*kernels[k])(*chips[k], count, nullptr, Fir_, FirIndex_);
+        }
+        decimateBlock(out, count);
+        output(out, count, outs, offset, stride, removeDC, masterVolume);
+    }
+    for (size_t k = 0; k < numChips; ++k) {
+        static_cast<AyumiEngine*>(voices[k])->flush(*chips[k]);
+    }
+    if constexpr (RenderStats::ENABLED) {
+        Stats_.samples += numSamples;
+        ++Stats_.blocks;
+    }
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::advance(size_t numSamples) -> uint64_t {
+    const double x = X_ + static_cast<double>(numSamples) * DecimateFactor * Step_;
+    const double ticks = std::floor(x);
+    X_ = x - ticks;
+    return static_cast<uint64_t>(ticks);
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::getWarmUpSamples(bool removeDC) const -> size_t {
+    // The interpolator needs 4 chip ticks, then the FIR a full window of frames
+    const auto interpolator = static_cast<size_t>(std::ceil(4 / (DecimateFactor * Step_)));
+    const size_t dc = !removeDC ? 0 : DcFilter_ == DcFilterEnum::BOX ? size_t {DC_FILTER_SIZE} : DC_IIR_WARM_UP;
+    return interpolator + FirSize / DecimateFactor + dc;
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::saveState(ByteWriter& out, bool withHistory) const -> void {
+    out.put(X_);
+    if (!withHistory) {
+        return;
+    }
+    for (const auto& point : InterpolatorY_) {
+        for (const Real y : point) {
+            out.put(y);
+        }
+    }
+    for (const auto& coefficient : InterpolatorC_) {
+        for (const Real c : coefficient) {
+            out.put(c);
+        }
+    }
+    // The second copy of the FIR slots is not saved
+    out.put(static_cast<uint8_t>(FirIndex_));
+    for (const auto& phase : Fir_) {
+        for (int slot = 0; slot < FIR_SLOTS; ++slot) {
+            for (const Real v : phase[slot]) {
+                out.put(v);
+            }
+        }
+    }
+    // The DC filter is saved by the owner, here only its history
+    if (DcFilter_ == DcFilterEnum::IIR) {
+        for (int o = 0; o < OUTPUTS; ++o) {
+            out.put(DcSum_[o]);
+            out.put(DcLast_[o]);
+        }
+        return;
+    }
+    out.put(static_cast<uint16_t>(DcIndex_));
+    for (const double sum : DcSum_) {
+        out.put(sum);
+    }
+    for (const auto& delay : DcDelay_) {
+        for (const Real x : delay) {
+            out.put(x);
+        }
+    }
+}
+
+template <typename Real, EngineOutput Output, int DecimateFactor, int FirSize>
+auto AyumiEngine<Real, Output, DecimateFactor, FirSize>::loadState(ByteReader& in, bool withHistory) -> void {
+    AyumiEngine loaded {};
+    std::copy(std::begin(Dac_), std::end(Dac_), loaded.Dac_);
+    std::copy(&Mix_[0][0][0], &Mix_[0][0][0] + sizeof(Mix_) / sizeof(Real), &loaded.Mix_[0][0][0]);
+    loaded.Step_ = Step_;
+    loaded.Stats_ = Stats_;
+    loaded.DcFilter_ = DcFilter_;
+    loaded.clearDc();
+    loaded.X_ = in.get<double>();
+    if (!(loaded.X_ >= 0 && loaded.X_ < 1)) {
+        throw std::invalid_argument("Bad engine phase");
+    }
+    if (withHistory) {
+        for (auto& point : loaded.InterpolatorY_) {
+            for (Real& y : point) {
+                y = in.get<Real>();
+            }
+        }
+        for (auto& coefficient : loaded.InterpolatorC_) {
+            for (Real& c : coefficient) {
+                c = in.get<Real>();
+            }
+        }
+        loaded.FirIndex_ = in.get<uint8_t>();
+        for (auto& phase : loaded.Fir_) {
+            for (int slot = 0; slot < FIR_SLOTS; ++slot) {
+                for (int o = 0; o < OUTPUTS; ++o) {
+                    phase[slot][o] = phase[slot + FIR_SLOTS][o] = in.get<Real>();
+                }
+            }
+        }
+        if (DcFilter_ == DcFilterEnum::IIR) {
+            for (int o = 0; o < OUTPUTS; ++o) {
+                loaded.DcSum_[o] = in.get<double>();
+                loaded.DcLast_[o] = in.get<Real>();
+            }
+        } else {
+            loaded.DcIndex_ = in.get<uint16_t>();
+            for (double& sum : loaded.DcSum_) {
+                sum = in.get<double>();
+            }
+            for (auto& delay : loaded.DcDelay_) {
+                for (Real& x : delay) {
+                    x = in.get<Real>();
+                }
+            }
+        }
+        if (loaded.FirIndex_ >= FIR_SLOTS || loaded.DcIndex_ >= DC_FILTER_SIZE) {
+            throw std::invalid_argument("Bad filter history");
+        }
+    }
+    *this = loaded;
+}
+
+} // namespace uZX::Chip
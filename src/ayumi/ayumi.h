@@ -18,18 +18,6 @@ struct tone_channel {
   int n_off;
   int e_on;
   int volume;
-  double pan_left;
-  double pan_right;
-};
-
-struct interpolator {
-  double c[4];
-  double y[4];
-};
-
-struct dc_filter {
-  double sum;
-  double delay[DC_FILTER_SIZE];
 };
 
 struct ayumi {
@@ -43,29 +31,18 @@ struct ayumi {
   int envelope_segment;
   int envelope;
   const double* dac_table;
-  double step;
-  double x;
-  struct interpolator interpolator_left;
-  struct interpolator interpolator_right;
-  double fir_left[FIR_SIZE * 2];
-  double fir_right[FIR_SIZE * 2];
-  int fir_index;
-  struct dc_filter dc_left;
-  struct dc_filter dc_right;
-  int dc_index;
-  double left;
-  double right;
 };
 
-int ayumi_configure(struct ayumi* ay, int is_ym, double clock_rate, int sr);
-void ayumi_set_pan(struct ayumi* ay, int index, double pan, int is_eqp);
+void ayumi_configure(struct ayumi* ay, int is_ym);
+void ayumi_set_type(struct ayumi* ay, int is_ym);
 void ayumi_set_tone(struct ayumi* ay, int index, int period);
 void ayumi_set_noise(struct ayumi* ay, int period);
 void ayumi_set_mixer(struct ayumi* ay, int index, int t_off, int n_off, int e_on);
 void ayumi_set_volume(struct ayumi* ay, int index, int volume);
 void ayumi_set_envelope(struct ayumi* ay, int period);
 void ayumi_set_envelope_shape(struct ayumi* ay, int shape);
-void ayumi_process(struct ayumi* ay);
-void ayumi_remove_dc(struct ayumi* ay);
+void ayumi_update(struct ayumi* ay);
+void ayumi_levels(const struct ayumi* ay, int* levels);
+void ayumi_tick(struct ayumi* ay, int* levels);
 
 #endif
@@ -0,0 +1,387 @@
+#include "lha.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+
+namespace uZX::LHA {
+
+namespace {
+
+// -lh5- parameters: 8 KB window, literals and match lengths 3..256 share one alphabet
+constexpr int DICTIONARY_BITS = 13;
+constexpr int MAX_MATCH = 256;
+constexpr int THRESHOLD = 3;
+constexpr int NC = 255 + MAX_MATCH + 2 - THRESHOLD;    // literal/length codes
+constexpr int NP = DICTIONARY_BITS + 1;                // distance codes
+constexpr int NT = 16 + 3;                             // code length codes
+constexpr int CBIT = 9;
+constexpr int PBIT = 4;
+constexpr int TBIT = 5;
+// Real files unpack to tens of times their packed size at most, a size claimed beyond this
+// is a broken header and is not allocated
+constexpr size_t MAX_EXPANSION = 4096;
+// The bit reader fetches up to 8 bytes ahead, a stream that reads further past its end is truncated
+constexpr size_t MAX_OVERRUN = 16;
+
+auto readLE16(const uint8_t* p) -> uint32_t {
+    return p[0] | (p[1] << 8);
+}
+
+auto readLE32(const uint8_t* p) -> uint32_t {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// MSB first bit reader, reads zeros past the end like the original LHA does and counts them
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size) : Data_(data), End_(data + size) {}
+
+    // Peeks up to 32 bits
+    auto peek(int count) -> uint32_t {
+        fill();
+        return count ? static_cast<uint32_t>(Buffer_ >> (64 - count)) : 0;
+    }
+
+    auto skip(int count) -> void {
+        fill();
+        Buffer_ <<= count;
+        Count_ -= count;
+    }
+
+    auto read(int count) -> uint32_t {
+        const uint32_t value = peek(count);
+        skip(count);
+        return value;
+    }
+
+    // Zero bytes read past the end
+    auto getOverrun() const -> size_t { return Overrun_; }
+
+private:
+    auto fill() -> void {
+        while (Count_ <= 56) {
+            uint64_t byte = 0;
+            if (Data_ < End_) {
+                byte = *Data_++;
+            } else {
+                ++Overrun_;
+            }
+            Buffer_ |= byte << (56 - Count_);
+            Count_ += 8;
+        }
+    }
+
+    const uint8_t* Data_;
+    const uint8_t* End_;
+    uint64_t Buffer_ = 0;
+    int Count_ = 0;
+    size_t Overrun_ = 0;
+};
+
+// Canonical Huffman code: shorter codes first, symbols in increasing order within a length.
+// Codes up to TABLE_BITS long are decoded with one lookup, longer ones bit by bit.
+class Huffman {
+public:
+    static constexpr int MAX_BITS = 16;
+    static constexpr int TABLE_BITS = 10;
+
+    // The degenerate code of one symbol which takes no bits
+    auto setSingle(int symbol, int numSymbols) -> void {
+        if (symbol >= numSymbols) {
+            throw std::runtime_error("LHA: bad Huffman table");
+        }
+        Single_ = symbol;
+    }
+
+    // lengths[i] == 0 means symbol i is not used
+    auto build(const uint8_t* lengths, int numSymbols) -> void {
+        Single_ = -1;
+        Count_.fill(0);
+        for (int i = 0; i < numSymbols; ++i) {
+            Count_[lengths[i]] += 1;
+        }
+        Count_[0] = 0;
+        int left = 1;
+        std::array<int, MAX_BITS + 2> offsets {};
+        for (int len = 1; len <= MAX_BITS; ++len) {
+            left = (left << 1) - Count_[len];
+            if (left < 0) {
+                throw std::runtime_error("LHA: bad Huffman table");
+            }
+            offsets[len + 1] = offsets[len] + Count_[len];
+        }
+        Symbols_.resize(numSymbols);
+        for (int i = 0; i < numSymbols; ++i) {
+            if (lengths[i]) {
+                Symbols_[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+            }
+        }
+
+        Table_.fill(Entry {0, 0});
+        int code = 0;
+        int index = 0;
+        for (int len = 1; len <= TABLE_BITS; ++len) {
+            for (int i = 0; i < Count_[len]; ++i, ++code, ++index) {
+                const int shift = TABLE_BITS - len;
+                for (int j = code << shift; j < (code + 1) << shift; ++j) {
+                    Table_[j] = Entry {Symbols_[index], static_cast<uint8_t>(len)};
+                }
+            }
+            code <<= 1;
+        }
+    }
+
+    auto decode(BitReader& bits) const -> int {
+        if (Single_ >= 0) {
+            return Single_;
+        }
+        const uint32_t look = bits.peek(MAX_BITS);
+        const Entry& entry = Table_[look >> (MAX_BITS - TABLE_BITS)];
+        if (entry.length) {
+            bits.skip(entry.length);
+            return entry.symbol;
+        }
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (int len = 1; len <= MAX_BITS; ++len) {
+            code |= (look >> (MAX_BITS - len)) & 1;
+            if (code - first < Count_[len]) {
+                bits.skip(len);
+                return Symbols_[index + code - first];
+            }
+            index += Count_[len];
+            first = (first + Count_[len]) << 1;
+            code <<= 1;
+        }
+        throw std::runtime_error("LHA: bad Huffman code");
+    }
+
+private:
+    struct Entry {
+        uint16_t symbol;
+        uint8_t length;     // 0 for codes longer than TABLE_BITS
+    };
+
+    int Single_ = -1;
+    std::array<int, MAX_BITS + 1> Count_ {};
+    std::vector<uint16_t> Symbols_;
+    std::array<Entry, 1 << TABLE_BITS> Table_ {};
+};
+
+class LH5Decoder {
+public:
+    LH5Decoder(const uint8_t* data, size_t size) : Bits_(data, size), PackedSize_(size) {}
+
+    auto decode(size_t unpackedSize) -> std::vector<uint8_t> {
+        if (unpackedSize / MAX_EXPANSION > PackedSize_) {
+            throw std::runtime_error("LHA: unpacked size too large for the packed data");
+        }
+        std::vector<uint8_t> out(unpackedSize);
+        size_t pos = 0;
+        size_t blockSize = 0;
+        while (pos < unpackedSize) {
+            if (Bits_.getOverrun() > MAX_OVERRUN) {
+                throw std::runtime_error("LHA: truncated data");
+            }
+            if (blockSize == 0) {
+                blockSize = Bits_.read(16);
+                blockSize = blockSize ? blockSize : 0x10000;
+                readTables();
+            }
+            --blockSize;
+            const int c = Codes_.decode(Bits_);
+            if (c < 256) {
+                out[pos++] = static_cast<uint8_t>(c);
+                continue;
+            }
+            const size_t length = std::min<size_t>(c - 256 + THRESHOLD, unpackedSize - pos);
+            int distance = Distances_.decode(Bits_);
+            if (distance) {
+                distance = (1 << (distance - 1)) + Bits_.read(distance - 1);
+            }
+            // The dictionary starts filled with spaces
+            for (size_t i = 0; i < length; ++i, ++pos) {
+                out[pos] = pos > static_cast<size_t>(distance) ? out[pos - distance - 1] : ' ';
+            }
+        }
+        if (Bits_.getOverrun() > MAX_OVERRUN) {
+            throw std::runtime_error("LHA: truncated data");
+        }
+        return out;
+    }
+
+private:
+    auto readTables() -> void {
+        readLengthsTable(NT, TBIT, 3, Lengths_);
+        readCodesTable();
+        readLengthsTable(NP, PBIT, -1, Distances_);
+    }
+
+    // Code lengths of the length alphabet or of the distance codes.
+    // After the special'th length 2 bits tell how many zero lengths follow
+    auto readLengthsTable(int numSymbols, int countBits, int special, Huffman& huffman) -> void {
+        const int n = Bits_.read(countBits);
+        if (n == 0) {
+            huffman.setSingle(Bits_.read(countBits), numSymbols);
+            return;
+        }
+        if (n > numSymbols) {
+            throw std::runtime_error("LHA: bad table size");
+        }
+        std::array<uint8_t, NT> lengths {};
+        int i = 0;
+        while (i < n) {
+            int len = Bits_.peek(3);
+            if (len == 7) {
+                // Unary extension: 111 followed by ones and a zero
+                uint32_t mask = 1u << 12;
+                const uint32_t look = Bits_.peek(16);
+                while ((look & mask) && len < Huffman::MAX_BITS) {
+                    mask >>= 1;
+                    ++len;
+                }
+                if (look & mask) {
+                    throw std::runtime_error("LHA: bad code length");
+                }
+            }
+            Bits_.skip(len < 7 ? 3 : len - 3);
+            lengths[i++] = static_cast<uint8_t>(len);
+            if (i == special) {
+                int zeros = Bits_.read(2);
+                if (i + zeros > numSymbols) {
+                    throw std::runtime_error("LHA: bad table size");
+                }
+                i += zeros;
+            }
+        }
+        huffman.build(lengths.data(), numSymbols);
+    }
+
+    // Code lengths of literals and match lengths, coded with the length alphabet
+    auto readCodesTable() -> void {
+        const int n = Bits_.read(CBIT);
+        if (n == 0) {
+            Codes_.setSingle(Bits_.read(CBIT), NC);
+            return;
+        }
+        if (n > NC) {
+            throw std::runtime_error("LHA: bad table size");
+        }
+        std::array<uint8_t, NC> lengths {};
+        int i = 0;
+        while (i < n) {
+            const int c = Lengths_.decode(Bits_);
+            if (c > 2) {
+                lengths[i++] = static_cast<uint8_t>(c - 2);
+                continue;
+            }
+            const int zeros = c == 0 ? 1 : c == 1 ? Bits_.read(4) + 3 : Bits_.read(CBIT) + 20;
+            if (i + zeros > NC) {
+                throw std::runtime_error("LHA: bad table size");
+            }
+            i += zeros;
+        }
+        Codes_.build(lengths.data(), NC);
+    }
+
+    BitReader Bits_;
+    size_t PackedSize_;
+    Huffman Lengths_;
+    Huffman Codes_;
+    Huffman Distances_;
+};
+
+auto crc16(const uint8_t* data, size_t size) -> uint32_t {
+    static const auto table = [] {
+        std::array<uint16_t, 256> result {};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t r = i;
+            for (int j = 0; j < 8; ++j) {
+                r = (r & 1) ? (r >> 1) ^ 0xA001 : r >> 1;
+            }
+            result[i] = static_cast<uint16_t>(r);
+        }
+        return result;
+    }();
+    uint32_t crc = 0;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+constexpr size_t MIN_HEADER_SIZE = 24;
+
+auto getMethod(const uint8_t* data) -> std::string {
+    return std::string(reinterpret_cast<const char*>(data + 2), 5);
+}
+
+} // namespace
+
+auto decodeLH5(const uint8_t* data, size_t size, size_t unpackedSize) -> std::vector<uint8_t> {
+    return LH5Decoder(data, size).decode(unpackedSize);
+}
+
+auto isArchive(const uint8_t* data, size_t size) -> bool {
+    if (size < MIN_HEADER_SIZE || data[20] > 2) {
+        return false;
+    }
+    const auto method = getMethod(data);
+    return method == "-lh5-" || method == "-lh0-";
+}
+
+auto unpackFirstFile(const uint8_t* data, size_t size) -> std::vector<uint8_t> {
+    if (!isArchive(data, size)) {
+        throw std::runtime_error("LHA: not an archive or unsupported method");
+    }
+    const int level = data[20];
+    size_t packedSize = readLE32(data + 7);
+    const size_t originalSize = readLE32(data + 11);
+    size_t dataOffset;
+    uint32_t crc;
+    if (level == 2) {
+        dataOffset = readLE16(data);
+        crc = readLE16(data + 21);
+    } else {
+        dataOffset = data[0] + 2;
+        const size_t nameLength = data[21];
+        if (22 + nameLength + 2 > dataOffset || dataOffset > size) {
+            throw std::runtime_error("LHA: bad header");
+        }
+        crc = readLE16(data + 22 + nameLength);
+        if (level == 1) {
+            // Extended headers follow the base one and are counted in the packed size
+            size_t next = readLE16(data + dataOffset - 2);
+            while (next) {
+                if (next < 3 || next > packedSize || dataOffset + next > size) {
+                    throw std::runtime_error("LHA: bad extended header");
+                }
+                dataOffset += next;
+                packedSize -= next;
+                next = readLE16(data + dataOffset - 2);
+            }
+        }
+    }
+    if (dataOffset > size || packedSize > size - dataOffset) {
+        throw std::runtime_error("LHA: truncated archive");
+    }
+
+    std::vector<uint8_t> result;
+    if (getMethod(data) == "-lh0-") {
+        if (packedSize < originalSize) {
+            throw std::runtime_error("LHA: truncated archive");
+        }
+        result.assign(data + dataOffset, data + dataOffset + originalSize);
+    } else {
+        result = decodeLH5(data + dataOffset, packedSize, originalSize);
+    }
+    if (crc16(result.data(), result.size()) != crc) {
+        throw std::runtime_error("LHA: CRC mismatch");
+    }
+    return result;
+}
+
+} // namespace uZX::LHA
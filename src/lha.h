@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Decompression of LHA archives, the container of .ym files, and of raw -lh5- streams
+// used by .vtx files. Corrupted data throws std::runtime_error.
+namespace uZX::LHA {
+
+// Unpacks a raw -lh5- stream into unpackedSize bytes
+auto decodeLH5(const uint8_t* data, size_t size, size_t unpackedSize) -> std::vector<uint8_t>;
+
+// True when data starts with an LHA archive header of a supported method
+auto isArchive(const uint8_t* data, size_t size) -> bool;
+
+// Unpacks the first file of an LHA archive. Header levels 0, 1, 2 and methods -lh0- (stored)
+// and -lh5- are supported, which covers all the .ym files in the wild
+auto unpackFirstFile(const uint8_t* data, size_t size) -> std::vector<uint8_t>;
+
+} // namespace uZX::LHA
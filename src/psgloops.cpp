@@ -0,0 +1,125 @@
+#include "psgloops.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace uZX::Chip {
+
+namespace {
+
+constexpr int NUM_REGISTERS = AYInterface::NUM_REGISTERS;
+constexpr int MIXER_REGISTER = 7;
+constexpr int VOLUME_REGISTER = 8;
+constexpr uint8_t ENVELOPE_MODE = 0x10;
+// Previous occurrences of a block tried at every frame, the most recent ones
+constexpr size_t MAX_CANDIDATES = 16;
+
+// Register rows with the masked values left out, so equal frames are equal words
+class Frames {
+public:
+    Frames(const uint8_t* registers, size_t registerStride, const uint8_t* mask, size_t maskStride, size_t frames)
+        : Rows_(frames * NUM_REGISTERS)
+    {
+        for (size_t i = 0; i < frames; ++i) {
+            for (int reg = 0; reg < NUM_REGISTERS; ++reg) {
+                Rows_[i * NUM_REGISTERS + reg] = mask[i * maskStride + reg] ? 0x100 : registers[i * registerStride + reg];
+            }
+        }
+    }
+
+    auto equal(size_t a, size_t b) const -> bool {
+        return std::equal(&Rows_[a * NUM_REGISTERS], &Rows_[(a + 1) * NUM_REGISTERS], &Rows_[b * NUM_REGISTERS]);
+    }
+
+    auto hash(size_t first, size_t count) const -> uint64_t {
+        uint64_t h = 0xcbf29ce484222325;
+        for (size_t i = first * NUM_REGISTERS; i < (first + count) * NUM_REGISTERS; ++i) {
+            h = (h ^ Rows_[i]) * 0x100000001b3;
+        }
+        return h;
+    }
+
+private:
+    std::vector<uint16_t> Rows_;
+};
+
+} // namespace
+
+auto findPSGLoops(const uint8_t* registers, size_t registerStride, const uint8_t* mask, size_t maskStride,
+                  size_t frames, size_t minPeriod) -> std::vector<PSGLoop> {
+    if (minPeriod == 0) {
+        throw std::invalid_argument("Minimum loop period must be positive");
+    }
+    std::vector<PSGLoop> loops;
+    if (frames < 3 * minPeriod) {
+        return loops;
+    }
+    const Frames rows(registers, registerStride, mask, maskStride, frames);
+    // Blocks of minPeriod frames by hash: where they started so far, the most recent last
+    std::unordered_map<uint64_t, std::vector<size_t>> starts;
+    std::vector<uint64_t> hashes(frames - minPeriod + 1);
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        hashes[i] = rows.hash(i, minPeriod);
+    }
+
+    // Where the repeats at a period were found to end, so a run is not compared again frame by frame
+    std::unordered_map<size_t, size_t> runEnds;
+    size_t indexed = 0;    // blocks starting before this are in starts
+    size_t i = minPeriod;  // the first frame that may repeat a block
+    while (i + minPeriod <= frames) {
+        // Only blocks at least minPeriod before i are candidates
+        for (; indexed + minPeriod <= i; ++indexed) {
+            starts[hashes[indexed]].push_back(indexed);
+        }
+        PSGLoop best {0, 0, i};
+        const auto found = starts.find(hashes[i]);
+        if (found != starts.end()) {
+            const auto& candidates = found->second;
+            const size_t first = candidates.size() - std::min(candidates.size(), MAX_CANDIDATES);
+            for (size_t c = candidates.size(); c-- > first;) {
+                const size_t period = i - candidates[c];
+                size_t& runEnd = runEnds[period];
+                size_t end = std::max(i, runEnd);
+                while (end < frames && rows.equal(end, end - period)) {
+                    ++end;
+                }
+                runEnd = end;
+                if (end > best.end) {
+                    best = {candidates[c], period, end};
+                }
+            }
+        }
+        // The first time, then at least two repeats
+        if (best.period && best.end >= best.start + 3 * best.period) {
+            loops.push_back(best);
+            i = best.end;
+        } else {
+            ++i;
+        }
+    }
+    return loops;
+}
+
+auto getHeardStateParts(const uint8_t* initial, const uint8_t* registers, size_t registerStride, const uint8_t* mask,
+                        size_t maskStride, size_t first, size_t last) -> ChipStateParts {
+    ChipStateParts heard {};
+    heard.tone[0] = heard.tone[1] = heard.tone[2] = heard.noise = heard.envelope = false;
+    uint8_t r[NUM_REGISTERS];
+    std::copy(initial, initial + NUM_REGISTERS, r);
+    for (size_t i = first; i < last; ++i) {
+        for (int reg = 0; reg < NUM_REGISTERS; ++reg) {
+            if (!mask[i * maskStride + reg]) {
+                r[reg] = registers[i * registerStride + reg];
+            }
+        }
+        for (int chan = 0; chan < TONE_CHANNELS; ++chan) {
+            heard.tone[chan] = heard.tone[chan] || !(r[MIXER_REGISTER] >> chan & 1);
+            heard.noise = heard.noise || !(r[MIXER_REGISTER] >> (chan + 3) & 1);
+            heard.envelope = heard.envelope || (r[VOLUME_REGISTER + chan] & ENVELOPE_MODE);
+        }
+    }
+    return heard;
+}
+
+} // namespace uZX::Chip
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "aychip.h"
+
+namespace uZX::Chip {
+
+/*****************************************************************************/
+/*  Repeated blocks of frames in a PSG register stream                       */
+/*****************************************************************************/
+
+// Frames [start, end) where every frame from start + period on writes the same registers
+// as the frame period frames before it: the block [start, start + period) and its repeats
+struct PSGLoop {
+    size_t start;
+    size_t period;
+    size_t end;
+};
+
+// Finds loops of at least minPeriod frames repeated at least twice after the first time,
+// earliest first and not overlapping each other's repeats. Of the candidates at a frame the
+// one repeated furthest wins. Frames are rows of 14 registers and mask, true where the
+// register is not written, like render_psg takes them, the values of masked registers do
+// not matter.
+auto findPSGLoops(const uint8_t* registers, size_t registerStride, const uint8_t* mask, size_t maskStride,
+                  size_t frames, size_t minPeriod) -> std::vector<PSGLoop>;
+
+// Parts of the chip state heard in frames [first, last), starting from the initial registers:
+// the tone of a channel while the mixer has it on, the noise while any channel has it on and
+// the envelope while any channel plays it. The rest may differ without a change of the sound.
+auto getHeardStateParts(const uint8_t* initial, const uint8_t* registers, size_t registerStride, const uint8_t* mask,
+                        size_t maskStride, size_t first, size_t last) -> ChipStateParts;
+
+} // namespace uZX::Chip
@@ -0,0 +1,189 @@
+#include "randompsg.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "aychip.h"
+
+namespace uZX::Chip {
+
+namespace {
+
+constexpr int NUM_REGISTERS = AYInterface::NUM_REGISTERS;
+constexpr int ENVELOPE_SHAPE_REGISTER = 13;
+constexpr int MIDI_NOTES = 128;
+
+// splitmix64: small, fast and the same on every platform, unlike the std distributions
+class Random {
+public:
+    Random(uint64_t seed, uint64_t index) : State_(seed) {
+        State_ = next() ^ index;
+        next();
+    }
+
+    auto next() -> uint64_t {
+        uint64_t z = (State_ += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [lo, hi]
+    auto range(int lo, int hi) -> int {
+        const uint64_t span = static_cast<uint64_t>(hi - lo) + 1;
+        return lo + static_cast<int>((next() >> 32) * span >> 32);
+    }
+
+    auto chance(double p) -> bool {
+        return static_cast<double>(next() >> 11) * 0x1.0p-53 < p;
+    }
+
+private:
+    uint64_t State_;
+};
+
+auto notePeriod(double clock, int note) -> int {
+    const double frequency = 440.0 * std::pow(2.0, (note - 69) / 12.0);
+    return static_cast<int>(std::lround(clock / (16 * frequency)));
+}
+
+auto checkRange(int lo, int hi, int min, int max, const char* name) -> void {
+    if (lo < min || hi > max || lo > hi) {
+        throw std::invalid_argument(std::string(name) + " range must be within " + std::to_string(min)
+                                    + ".." + std::to_string(max) + " and not empty");
+    }
+}
+
+auto checkChance(double p, const char* name) -> void {
+    if (!(p >= 0 && p <= 1)) {
+        throw std::invalid_argument(std::string(name) + " must be from 0 to 1");
+    }
+}
+
+struct Voice {
+    int period = 1;
+    int volume = 0;
+    bool tone = false;
+    bool noise = false;
+    bool envelope = false;
+};
+
+} // namespace
+
+RandomPSG::RandomPSG(const RandomPSGConfig& config, double clock)
+    : Config_(config)
+    , Clock_(clock)
+{
+    checkRange(config.tonePeriodMin, config.tonePeriodMax, 1, 0xfff, "Tone period");
+    checkRange(config.noisePeriodMin, config.noisePeriodMax, 0, 0x1f, "Noise period");
+    checkRange(config.envelopePeriodMin, config.envelopePeriodMax, 0, 0xffff, "Envelope period");
+    checkRange(config.volumeMin, 15, 0, 15, "Volume");
+    checkChance(config.noteChance, "Note chance");
+    checkChance(config.restChance, "Rest chance");
+    checkChance(config.toneChance, "Tone chance");
+    checkChance(config.noiseChance, "Noise chance");
+    checkChance(config.envelopeChance, "Envelope chance");
+    checkChance(config.decayChance, "Decay chance");
+    if (config.envelopeShapes == 0) {
+        throw std::invalid_argument("At least one envelope shape must be allowed");
+    }
+    if (!(clock > 0)) {
+        throw std::invalid_argument("Clock must be positive");
+    }
+    if (config.notes) {
+        // Periods fall as notes rise, so the notes within the range are contiguous
+        NoteMin_ = MIDI_NOTES;
+        NoteMax_ = -1;
+        for (int note = 0; note < MIDI_NOTES; ++note) {
+            const int period = notePeriod(clock, note);
+            if (period >= config.tonePeriodMin && period <= config.tonePeriodMax) {
+                NoteMin_ = std::min(NoteMin_, note);
+                NoteMax_ = std::max(NoteMax_, note);
+            }
+        }
+        if (NoteMin_ > NoteMax_) {
+            throw std::invalid_argument("No note has a tone period within the range at this clock");
+        }
+    }
+}
+
+auto RandomPSG::generate(uint64_t seed, uint64_t index, size_t frames, uint8_t* registers, bool* mask) const -> void {
+    const RandomPSGConfig& c = Config_;
+    Random random(seed, index);
+    auto tonePeriod = [&] {
+        return c.notes ? notePeriod(Clock_, random.range(NoteMin_, NoteMax_)) : random.range(c.tonePeriodMin, c.tonePeriodMax);
+    };
+    // Rests keep the tone period, so even the first one has a period within the range
+    Voice voices[TONE_CHANNELS];
+    for (Voice& voice : voices) {
+        voice.period = tonePeriod();
+    }
+    int noisePeriod = random.range(c.noisePeriodMin, c.noisePeriodMax);
+    int envelopePeriod = random.range(c.envelopePeriodMin, c.envelopePeriodMax);
+    int allowedShapes[16];
+    int numShapes = 0;
+    for (int shape = 0; shape < 16; ++shape) {
+        if (c.envelopeShapes >> shape & 1) {
+            allowedShapes[numShapes++] = shape;
+        }
+    }
+    int envelopeShape = allowedShapes[random.range(0, numShapes - 1)];
+
+    std::array<uint8_t, NUM_REGISTERS> last {};
+    for (size_t frame = 0; frame < frames; ++frame) {
+        bool retrigger = frame == 0;
+        for (Voice& voice : voices) {
+            if (frame == 0 || random.chance(c.noteChance)) {
+                if (random.chance(c.restChance)) {
+                    voice.volume = 0;
+                    voice.tone = voice.noise = voice.envelope = false;
+                    continue;
+                }
+                voice.tone = random.chance(c.toneChance);
+                voice.noise = random.chance(c.noiseChance);
+                voice.tone = voice.tone || !voice.noise;
+                voice.volume = random.range(c.volumeMin, 15);
+                voice.period = tonePeriod();
+                if (voice.noise) {
+                    noisePeriod = random.range(c.noisePeriodMin, c.noisePeriodMax);
+                }
+                voice.envelope = random.chance(c.envelopeChance);
+                if (voice.envelope) {
+                    envelopePeriod = random.range(c.envelopePeriodMin, c.envelopePeriodMax);
+                    envelopeShape = allowedShapes[random.range(0, numShapes - 1)];
+                    retrigger = true;
+                }
+            } else if (!voice.envelope && voice.volume > 0 && random.chance(c.decayChance)) {
+                --voice.volume;
+            }
+        }
+
+        uint8_t* r = registers + frame * NUM_REGISTERS;
+        int mixer = 0;
+        for (int chan = 0; chan < TONE_CHANNELS; ++chan) {
+            const Voice& voice = voices[chan];
+            r[chan * 2] = voice.period & 0xff;
+            r[chan * 2 + 1] = voice.period >> 8;
+            r[8 + chan] = static_cast<uint8_t>(voice.volume | (voice.envelope ? 0x10 : 0));
+            mixer |= (voice.tone ? 0 : 1) << chan;
+            mixer |= (voice.noise ? 0 : 1) << (chan + 3);
+        }
+        r[6] = static_cast<uint8_t>(noisePeriod);
+        r[7] = static_cast<uint8_t>(mixer);
+        r[11] = envelopePeriod & 0xff;
+        r[12] = envelopePeriod >> 8;
+        r[ENVELOPE_SHAPE_REGISTER] = static_cast<uint8_t>(envelopeShape);
+
+        bool* m = mask + frame * NUM_REGISTERS;
+        for (int reg = 0; reg < NUM_REGISTERS; ++reg) {
+            m[reg] = frame > 0 && r[reg] == last[reg];
+        }
+        m[ENVELOPE_SHAPE_REGISTER] = !retrigger;
+        std::copy(r, r + NUM_REGISTERS, last.begin());
+    }
+}
+
+} // namespace uZX::Chip
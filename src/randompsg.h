@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace uZX::Chip {
+
+/*****************************************************************************/
+/*  Random but musical PSG register sequences, e.g. for training datasets    */
+/*****************************************************************************/
+
+// Constraints of the generated sequences. Every frame every channel starts a new note with
+// noteChance, otherwise its volume may decay by one. A note is a rest with restChance, or
+// a tone, noise or both at a random volume, played by the envelope with envelopeChance.
+struct RandomPSGConfig {
+    int tonePeriodMin = 16;
+    int tonePeriodMax = 2048;
+    // Tone periods of equal tempered notes (A4 = 440 Hz at the chip clock) within the range
+    bool notes = true;
+    int noisePeriodMin = 1;
+    int noisePeriodMax = 31;
+    int envelopePeriodMin = 64;
+    int envelopePeriodMax = 8192;
+    uint16_t envelopeShapes = 0xff00;    // bit per allowed R13 shape, shapes 0-7 repeat 9 and 15
+    int volumeMin = 8;
+    double noteChance = 0.15;
+    double restChance = 0.1;
+    double toneChance = 0.9;
+    double noiseChance = 0.2;
+    double envelopeChance = 0.1;
+    double decayChance = 0.2;
+};
+
+// Generates the sequences of a dataset: sequence index of seed is always the same, whatever
+// the order or the thread it is generated in, so a dataset can be made in parallel and in parts
+class RandomPSG {
+public:
+    // Throws std::invalid_argument on empty or out of range constraints
+    RandomPSG(const RandomPSGConfig& config, double clock);
+
+    // Fills frames (14) registers and mask rows, as render_psg takes them. Unchanged registers
+    // are masked, R13 is written only when an envelope note starts, the first frame writes all.
+    auto generate(uint64_t seed, uint64_t index, size_t frames, uint8_t* registers, bool* mask) const -> void;
+
+private:
+    RandomPSGConfig Config_;
+    int NoteMin_ = 0;    // MIDI notes with tone periods within the range
+    int NoteMax_ = 0;
+    double Clock_;
+};
+
+} // namespace uZX::Chip
@@ -0,0 +1,127 @@
+#include "realtime.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace uZX::Chip {
+
+namespace {
+
+constexpr int STEREO = 2;
+
+} // namespace
+
+RealtimeAyumi::RealtimeAyumi(const AyumiEmulator& chip, size_t bufferSamples, size_t blockSamples, size_t queueSize)
+    : Chip_(chip)
+    , BlockSamples_(blockSamples)
+    , Writes_(queueSize)
+    // Whole blocks, so a block never wraps around the end of the ring
+    , Audio_((std::max(bufferSamples, blockSamples) + blockSamples - 1) / std::max<size_t>(blockSamples, 1) * blockSamples * STEREO)
+{
+    if (blockSamples == 0 || queueSize == 0) {
+        throw std::invalid_argument("Block and queue sizes must be positive");
+    }
+    BlockWrites_.reserve(Writes_.getCapacity());
+}
+
+RealtimeAyumi::~RealtimeAyumi() {
+    stop();
+}
+
+auto RealtimeAyumi::start() -> void {
+    if (Running_.exchange(true)) {
+        return;
+    }
+    Thread_ = std::thread([this] { run(); });
+}
+
+auto RealtimeAyumi::stop() -> void {
+    Running_ = false;
+    if (Thread_.joinable()) {
+        Thread_.join();
+    }
+}
+
+auto RealtimeAyumi::isRunning() const -> bool {
+    return Running_;
+}
+
+auto RealtimeAyumi::write(double time, int reg, uint8_t value) -> bool {
+    if (reg < 0 || reg >= AYInterface::NUM_REGISTERS) {
+        throw std::out_of_range("Register index out of bounds");
+    }
+    if (!Writes_.push({time, reg, value})) {
+        DroppedWrites_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+auto RealtimeAyumi::pull(float* out, size_t numSamples) -> size_t {
+    const size_t got = Audio_.read(out, numSamples * STEREO) / STEREO;
+    if (got < numSamples) {
+        std::fill(out + got * STEREO, out + numSamples * STEREO, 0.0f);
+        Underruns_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return got;
+}
+
+auto RealtimeAyumi::getSampleRate() const -> int {
+    return Chip_.getSampleRate();
+}
+
+auto RealtimeAyumi::getPosition() const -> uint64_t {
+    return Audio_.getReadPosition() / STEREO;
+}
+
+auto RealtimeAyumi::getBufferedSamples() const -> size_t {
+    return Audio_.getSize() / STEREO;
+}
+
+auto RealtimeAyumi::getUnderruns() const -> uint64_t {
+    return Underruns_.load(std::memory_order_relaxed);
+}
+
+auto RealtimeAyumi::getDroppedWrites() const -> uint64_t {
+    return DroppedWrites_.load(std::memory_order_relaxed);
+}
+
+auto RealtimeAyumi::getLateWrites() const -> uint64_t {
+    return LateWrites_.load(std::memory_order_relaxed);
+}
+
+// Renders while there is room for a block, otherwise waits half a block
+auto RealtimeAyumi::run() -> void {
+    const std::chrono::duration<double> wait(0.5 * BlockSamples_ / Chip_.getSampleRate());
+    while (Running_.load(std::memory_order_relaxed)) {
+        if (Audio_.getWritable() < BlockSamples_ * STEREO) {
+            std::this_thread::sleep_for(wait);
+            continue;
+        }
+        renderBlock();
+    }
+}
+
+auto RealtimeAyumi::renderBlock() -> void {
+    const double blockEnd = static_cast<double>(Rendered_ + BlockSamples_);
+    const double clocksPerSample = Chip_.getClock() / Chip_.getSampleRate();
+    // processEvents wants times from the start of the block that do not decrease
+    double lastTime = 0;
+    for (const RegisterWrite* write = Writes_.front(); write && write->time < blockEnd; write = Writes_.front()) {
+        double time = (write->time - static_cast<double>(Rendered_)) * clocksPerSample;
+        if (time < 0) {
+            LateWrites_.fetch_add(1, std::memory_order_relaxed);
+        }
+        lastTime = std::max(lastTime, time);
+        BlockWrites_.push_back({lastTime, write->reg, write->value});
+        Writes_.pop();
+    }
+    float* out = Audio_.writePointer();
+    Chip_.processEvents(out, out + 1, BlockSamples_, BlockWrites_.data(), BlockWrites_.size(), true, STEREO);
+    BlockWrites_.clear();
+    Audio_.commitWrite(BlockSamples_ * STEREO);
+    Rendered_ += BlockSamples_;
+}
+
+} // namespace uZX::Chip
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "utils/spsc.h"
+#include "aychip.h"
+
+namespace uZX::Chip {
+
+/*****************************************************************************/
+/*  Ayumi played in real time: register writes from a control thread,        */
+/*  audio pulled from an audio callback, rendered ahead by its own thread     */
+/*****************************************************************************/
+
+// A control thread queues register writes timed in samples from the start of the stream,
+// a render thread renders blocks ahead of time into a ring buffer, and the audio callback
+// pulls interleaved stereo from it. While running, write() may be called from one thread and
+// pull() from one other thread, neither of them locks or allocates.
+class RealtimeAyumi {
+public:
+    using RegisterWrite = AyumiEmulator::RegisterWrite;
+
+    // Plays a copy of chip. bufferSamples is rounded up to whole blocks, it is the most
+    // rendered ahead and so the output latency once the buffer is full.
+    RealtimeAyumi(const AyumiEmulator& chip, size_t bufferSamples = 4096, size_t blockSamples = 256,
+                  size_t queueSize = 4096);
+    RealtimeAyumi(const RealtimeAyumi&) = delete;
+    auto operator=(const RealtimeAyumi&) -> RealtimeAyumi& = delete;
+    ~RealtimeAyumi();
+
+    // Starts or stops the render thread, a stopped stream starts again where it was
+    auto start() -> void;
+    auto stop() -> void;
+    auto isRunning() const -> bool;
+
+    // Queues a write of value to register reg at time in samples from the start of the stream.
+    // A write lands on the chip tick of its time, like in AyumiEmulator::processEvents, writes
+    // of already rendered time land at the start of the next block and count as late.
+    // Returns false, and counts the write as dropped, when the queue is full.
+    auto write(double time, int reg, uint8_t value) -> bool;
+    // Copies numSamples interleaved left and right samples to out, whatever is not rendered yet
+    // is silence and counts as an underrun. Returns the samples there were.
+    auto pull(float* out, size_t numSamples) -> size_t;
+
+    auto getSampleRate() const -> int;
+    // Samples pulled so far, the time of the next sample pull() returns
+    auto getPosition() const -> uint64_t;
+    // Samples rendered and not pulled yet: a write at getPosition() + getBufferedSamples()
+    // is the earliest one that can land on time
+    auto getBufferedSamples() const -> size_t;
+    auto getUnderruns() const -> uint64_t;
+    auto getDroppedWrites() const -> uint64_t;
+    auto getLateWrites() const -> uint64_t;
+
+private:
+    auto run() -> void;
+    auto renderBlock() -> void;
+
+    AyumiEmulator Chip_;
+    const size_t BlockSamples_;
+    SpscQueue<RegisterWrite> Writes_;
+    SpscRing<float> Audio_;
+    std::vector<RegisterWrite> BlockWrites_;    // render thread: writes of the block, in clock cycles
+    uint64_t Rendered_ = 0;                     // render thread: samples rendered so far
+
+    std::thread Thread_;
+    std::atomic<bool> Running_ {false};
+    std::atomic<uint64_t> Underruns_ {0};
+    std::atomic<uint64_t> DroppedWrites_ {0};
+    std::atomic<uint64_t> LateWrites_ {0};
+};
+
+} // namespace uZX::Chip
@@ -0,0 +1,283 @@
+#include "songfile.h"
+
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+#include "lha.h"
+
+namespace uZX::Chip {
+
+namespace {
+
+constexpr size_t PSG_HEADER_SIZE = 16;
+constexpr size_t YM5_HEADER_SIZE = 34;
+constexpr size_t VTX_HEADER_SIZE = 16;
+constexpr int ENVELOPE_SHAPE_REGISTER = 13;
+constexpr uint8_t NO_ENVELOPE_WRITE = 0xff;    // R13 value of YM and VTX frames that do not restart the envelope
+
+auto readBE16(const uint8_t* p) -> uint32_t {
+    return (p[0] << 8) | p[1];
+}
+
+auto readBE32(const uint8_t* p) -> uint32_t {
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+auto readLE16(const uint8_t* p) -> uint32_t {
+    return p[0] | (p[1] << 8);
+}
+
+auto readLE32(const uint8_t* p) -> uint32_t {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Reads a NUL terminated string at offset and moves offset past it
+auto readString(const uint8_t* data, size_t size, size_t& offset) -> std::string {
+    const auto* begin = data + offset;
+    const auto* end = static_cast<const uint8_t*>(std::memchr(begin, 0, size - offset));
+    if (!end) {
+        throw std::runtime_error("Unterminated string in song header");
+    }
+    offset += end - begin + 1;
+    return std::string(begin, end);
+}
+
+auto startsWith(const uint8_t* data, size_t size, const char* prefix) -> bool {
+    const size_t length = std::strlen(prefix);
+    return size >= length && std::memcmp(data, prefix, length) == 0;
+}
+
+auto isYM(const uint8_t* data, size_t size) -> bool {
+    return startsWith(data, size, "YM") && size >= 4 && (data[3] == '!' || data[3] == 'b');
+}
+
+auto isVTX(const uint8_t* data, size_t size) -> bool {
+    if (size < 2) {
+        return false;
+    }
+    const int first = std::tolower(data[0]);
+    const int second = std::tolower(data[1]);
+    return (first == 'a' && second == 'y') || (first == 'y' && second == 'm');
+}
+
+} // namespace
+
+
+auto playFrame(AYInterface& chip, const SongFrame& frame) -> void {
+    chip.setRegisters(frame.registers.data(), frame.mask.data());
+}
+
+
+auto SongFile::open(const std::string& path) -> SongFile {
+    SongFile song;
+    song.Mapped_ = MappedFile(path);
+    song.Data_ = song.Mapped_.data();
+    song.Size_ = song.Mapped_.size();
+    song.parse();
+    return song;
+}
+
+auto SongFile::fromBytes(std::vector<uint8_t> data) -> SongFile {
+    SongFile song;
+    song.Owned_ = std::move(data);
+    song.Data_ = song.Owned_.data();
+    song.Size_ = song.Owned_.size();
+    song.parse();
+    return song;
+}
+
+auto SongFile::parse() -> void {
+    if (startsWith(Data_, Size_, "PSG\x1a")) {
+        parsePSG();
+    } else if (LHA::isArchive(Data_, Size_) || isYM(Data_, Size_)) {
+        parseYM();
+    } else if (isVTX(Data_, Size_)) {
+        parseVTX();
+    } else {
+        throw std::runtime_error("Unknown song format");
+    }
+}
+
+// "PSG\x1a", version, frame rate (version 10 and later), padding, then a stream of commands:
+// 0xff ends a frame, 0xfe n skips n*4 frames, 0xfd ends the song, 0..15 v writes v to a register
+auto SongFile::parsePSG() -> void {
+    if (Size_ < PSG_HEADER_SIZE) {
+        throw std::runtime_error("PSG: truncated header");
+    }
+    Format_ = SongFormatEnum::PSG;
+    if (Data_[4] >= 10 && Data_[5]) {
+        FrameRate_ = Data_[5];
+    }
+    Frames_ = Data_ + PSG_HEADER_SIZE;
+    FramesSize_ = Size_ - PSG_HEADER_SIZE;
+    // Every 0xff starts a frame, writes before the first one go to the first frame too
+    if (FramesSize_ && Frames_[0] == 0xff) {
+        ++Frames_;
+        --FramesSize_;
+    }
+    SongFrameReader reader(*this);
+    SongFrame frame;
+    while (reader.next(frame)) {
+    }
+    NumFrames_ = reader.getPosition();
+}
+
+// Mostly LHA packed. YM2!/YM3!/YM3b are plain 14 interleaved registers per frame,
+// YM5!/YM6! have a header with the song info and digidrums followed by 16 registers per frame.
+// Effects encoded in the spare register bits (SID, digidrums, Sync Buzzer) are not emulated.
+auto SongFile::parseYM() -> void {
+    if (LHA::isArchive(Data_, Size_)) {
+        Owned_ = LHA::unpackFirstFile(Data_, Size_);
+        Data_ = Owned_.data();
+        Size_ = Owned_.size();
+    }
+    Format_ = SongFormatEnum::YM;
+    Type_ = AYInterface::TypeEnum::YM;
+    Clock_ = 2000000;
+    if (startsWith(Data_, Size_, "YM2!") || startsWith(Data_, Size_, "YM3!")) {
+        Frames_ = Data_ + 4;
+        NumFrames_ = (Size_ - 4) / SongFrame::NUM_REGISTERS;
+        return;
+    }
+    if (startsWith(Data_, Size_, "YM3b")) {
+        if (Size_ < 8) {
+            throw std::runtime_error("YM: truncated file");
+        }
+        Frames_ = Data_ + 4;
+        NumFrames_ = (Size_ - 8) / SongFrame::NUM_REGISTERS;
+        LoopFrame_ = readLE32(Data_ + Size_ - 4);
+        return;
+    }
+    if (!startsWith(Data_, Size_, "YM5!") && !startsWith(Data_, Size_, "YM6!")) {
+        throw std::runtime_error("YM: unsupported version");
+    }
+    if (Size_ < YM5_HEADER_SIZE || std::memcmp(Data_ + 4, "LeOnArD!", 8) != 0) {
+        throw std::runtime_error("YM: bad header");
+    }
+    NumFrames_ = readBE32(Data_ + 12);
+    Interleaved_ = readBE32(Data_ + 16) & 1;
+    const size_t numDrums = readBE16(Data_ + 20);
+    Clock_ = readBE32(Data_ + 22);
+    if (const int frameRate = readBE16(Data_ + 26)) {
+        FrameRate_ = frameRate;
+    }
+    LoopFrame_ = readBE32(Data_ + 28);
+    size_t offset = YM5_HEADER_SIZE + readBE16(Data_ + 32);
+    for (size_t i = 0; i < numDrums; ++i) {
+        if (offset + 4 > Size_) {
+            throw std::runtime_error("YM: truncated digidrums");
+        }
+        offset += 4 + readBE32(Data_ + offset);
+    }
+    if (offset > Size_) {
+        throw std::runtime_error("YM: truncated digidrums");
+    }
+    Title_ = readString(Data_, Size_, offset);
+    Author_ = readString(Data_, Size_, offset);
+    Comment_ = readString(Data_, Size_, offset);
+    RegistersPerFrame_ = 16;
+    if ((Size_ - offset) / RegistersPerFrame_ < NumFrames_) {
+        throw std::runtime_error("YM: truncated frames");
+    }
+    Frames_ = Data_ + offset;
+}
+
+// "ay" or "ym", stereo layout, loop frame, clock, frame rate, year, unpacked size,
+// title, author, program, tracker and comment, then -lh5- packed interleaved registers
+auto SongFile::parseVTX() -> void {
+    if (Size_ < VTX_HEADER_SIZE) {
+        throw std::runtime_error("VTX: truncated header");
+    }
+    Format_ = SongFormatEnum::VTX;
+    Type_ = std::tolower(Data_[0]) == 'y' ? AYInterface::TypeEnum::YM : AYInterface::TypeEnum::AY;
+    LoopFrame_ = readLE16(Data_ + 3);
+    Clock_ = readLE32(Data_ + 5);
+    if (Data_[9]) {
+        FrameRate_ = Data_[9];
+    }
+    const size_t unpackedSize = readLE32(Data_ + 12);
+    size_t offset = VTX_HEADER_SIZE;
+    Title_ = readString(Data_, Size_, offset);
+    Author_ = readString(Data_, Size_, offset);
+    readString(Data_, Size_, offset);
+    readString(Data_, Size_, offset);
+    Comment_ = readString(Data_, Size_, offset);
+    Owned_ = LHA::decodeLH5(Data_ + offset, Size_ - offset, unpackedSize);
+    Data_ = Owned_.data();
+    Size_ = Owned_.size();
+    Frames_ = Data_;
+    NumFrames_ = Size_ / SongFrame::NUM_REGISTERS;
+}
+
+auto SongFile::frames() const -> SongFrameReader {
+    return SongFrameReader(*this);
+}
+
+auto SongFile::readAll(uint8_t* registers, bool* mask) const -> void {
+    SongFrameReader reader(*this);
+    SongFrame frame;
+    for (size_t i = 0; reader.next(frame); ++i) {
+        std::memcpy(registers + i * SongFrame::NUM_REGISTERS, frame.registers.data(), SongFrame::NUM_REGISTERS);
+        std::memcpy(mask + i * SongFrame::NUM_REGISTERS, frame.mask.data(), SongFrame::NUM_REGISTERS * sizeof(bool));
+    }
+}
+
+
+SongFrameReader::SongFrameReader(const SongFile& song)
+    : Song_(song)
+{}
+
+auto SongFrameReader::next(SongFrame& frame) -> bool {
+    const uint8_t* data = Song_.Frames_;
+    frame.mask.fill(true);
+    if (Song_.Format_ == SongFormatEnum::PSG) {
+        if (EmptyFrames_) {
+            --EmptyFrames_;
+        } else if (Offset_ < Song_.FramesSize_ && data[Offset_] != 0xfd) {
+            while (Offset_ < Song_.FramesSize_) {
+                const uint8_t command = data[Offset_++];
+                if (command == 0xff) {
+                    break;
+                }
+                if (command == 0xfe) {
+                    const size_t count = Offset_ < Song_.FramesSize_ ? data[Offset_++] : 0;
+                    if (count) {
+                        EmptyFrames_ = count * 4 - 1;
+                        break;
+                    }
+                    continue;
+                }
+                if (command == 0xfd || Offset_ == Song_.FramesSize_) {
+                    Offset_ = Song_.FramesSize_;
+                    break;
+                }
+                const uint8_t value = data[Offset_++];
+                if (command < SongFrame::NUM_REGISTERS) {
+                    Registers_[command] = value;
+                    frame.mask[command] = false;
+                }
+            }
+        } else {
+            return false;
+        }
+    } else {
+        if (Position_ >= Song_.NumFrames_) {
+            return false;
+        }
+        for (int i = 0; i < SongFrame::NUM_REGISTERS; ++i) {
+            const uint8_t value = Song_.Interleaved_ ? data[i * Song_.NumFrames_ + Position_]
+                                                     : data[Position_ * Song_.RegistersPerFrame_ + i];
+            if (i == ENVELOPE_SHAPE_REGISTER && value == NO_ENVELOPE_WRITE) {
+                continue;
+            }
+            Registers_[i] = value;
+            frame.mask[i] = false;
+        }
+    }
+    frame.registers = Registers_;
+    ++Position_;
+    return true;
+}
+
+} // namespace uZX::Chip
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "utils/mapped_file.h"
+#include "utils/tools.h"
+#include "aychip.h"
+
+namespace uZX::Chip {
+
+/*****************************************************************************/
+/*  Readers of register dump files: PSG, YM (YM2!-YM6!, LHA packed or not)  */
+/*  and VTX                                                                  */
+/*****************************************************************************/
+
+struct SongFormatEnum {
+    enum Enum {
+        PSG,
+        YM,
+        VTX
+    };
+    static inline constexpr std::string_view labels[] {
+        "PSG",
+        "YM",
+        "VTX"
+    };
+};
+using SongFormat = EnumChoice<SongFormatEnum>;
+
+// Registers R0-R13 for one frame. Mask is inverted like in Ayumi.set_registers_masked:
+// true means the register is not written in this frame. Masked registers keep the last
+// written value, so registers alone always hold the full chip state.
+struct SongFrame {
+    static constexpr int NUM_REGISTERS = 14;
+
+    std::array<uint8_t, NUM_REGISTERS> registers {};
+    std::array<bool, NUM_REGISTERS> mask {};
+};
+
+// Writes the unmasked registers of a frame, like AYInterface::setRegisters
+auto playFrame(AYInterface& chip, const SongFrame& frame) -> void;
+
+class SongFrameReader;
+
+// A register dump file. Files are memory mapped and frames are decoded on the fly,
+// only packed YM and VTX files are unpacked into memory, as their registers are
+// stored column by column. Unknown or broken files throw std::runtime_error.
+class SongFile {
+public:
+    using ChipType = AYInterface::ChipType;
+
+    static auto open(const std::string& path) -> SongFile;
+    static auto fromBytes(std::vector<uint8_t> data) -> SongFile;
+
+    SongFile(SongFile&&) = default;
+    auto operator=(SongFile&&) -> SongFile& = default;
+
+    auto getFormat() const -> SongFormat { return Format_; }
+    auto getType() const -> ChipType { return Type_; }
+    auto getClock() const -> double { return Clock_; }
+    // 50 when the file does not say or says 0
+    auto getFrameRate() const -> float { return FrameRate_; }
+    auto getLoopFrame() const -> size_t { return LoopFrame_; }
+    auto getTitle() const -> const std::string& { return Title_; }
+    auto getAuthor() const -> const std::string& { return Author_; }
+    auto getComment() const -> const std::string& { return Comment_; }
+    auto getNumFrames() const -> size_t { return NumFrames_; }
+
+    // Lazy reader of frames from the first one
+    auto frames() const -> SongFrameReader;
+
+    // Decodes all the frames into (frames, 14) registers and mask arrays, as render_psg takes them
+    auto readAll(uint8_t* registers, bool* mask) const -> void;
+
+private:
+    friend class SongFrameReader;
+
+    SongFile() = default;
+    auto parse() -> void;
+    auto parsePSG() -> void;
+    auto parseYM() -> void;
+    auto parseVTX() -> void;
+
+    MappedFile Mapped_;
+    std::vector<uint8_t> Owned_;    // bytes given or unpacked
+    const uint8_t* Data_ = nullptr;
+    size_t Size_ = 0;
+
+    SongFormat Format_ = SongFormatEnum::PSG;
+    ChipType Type_ = AYInterface::TypeEnum::AY;
+    double Clock_ = 1773400;
+    float FrameRate_ = 50;
+    size_t LoopFrame_ = 0;
+    std::string Title_;
+    std::string Author_;
+    std::string Comment_;
+    size_t NumFrames_ = 0;
+
+    // Where the frames are: the PSG command stream, or a table of RegistersPerFrame_
+    // registers per frame, stored frame after frame or, if Interleaved_, register after register
+    const uint8_t* Frames_ = nullptr;
+    size_t FramesSize_ = 0;
+    size_t RegistersPerFrame_ = SongFrame::NUM_REGISTERS;
+    bool Interleaved_ = true;
+};
+
+// Cursor over the frames of a SongFile, which must outlive it
+class SongFrameReader {
+public:
+    explicit SongFrameReader(const SongFile& song);
+
+    // Decodes the next frame, returns false after the last one
+    auto next(SongFrame& frame) -> bool;
+    auto getPosition() const -> size_t { return Position_; }
+
+private:
+    const SongFile& Song_;
+    size_t Position_ = 0;
+    size_t Offset_ = 0;         // PSG stream offset
+    size_t EmptyFrames_ = 0;    // left from a PSG 0xFE command
+    std::array<uint8_t, SongFrame::NUM_REGISTERS> Registers_ {};
+};
+
+} // namespace uZX::Chip
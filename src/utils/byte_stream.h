@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace uZX {
+
+// Little-endian binary writer of numbers, floating point values are stored by their bits
+class ByteWriter {
+public:
+    template <typename T>
+    auto put(T value) -> void {
+        static_assert(std::is_arithmetic_v<T>);
+        uint8_t bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        if (!isLittleEndian()) {
+            std::reverse(bytes, bytes + sizeof(T));
+        }
+        putBytes(bytes, sizeof(T));
+    }
+
+    auto putBytes(const void* data, size_t size) -> void {
+        const size_t offset = Data_.size();
+        Data_.resize(offset + size);
+        std::memcpy(Data_.data() + offset, data, size);
+    }
+
+    auto data() const -> const std::vector<uint8_t>& {
+        return Data_;
+    }
+
+    auto release() -> std::vector<uint8_t> {
+        return std::move(Data_);
+    }
+
+    static auto isLittleEndian() -> bool {
+        const uint16_t one = 1;
+        uint8_t first;
+        std::memcpy(&first, &one, 1);
+        return first == 1;
+    }
+
+private:
+    std::vector<uint8_t> Data_;
+};
+
+// Reader of what ByteWriter writes, throws std::invalid_argument when the data ends too early
+class ByteReader {
+public:
+    ByteReader(const uint8_t* data, size_t size) : Data_(data), Size_(size) {}
+
+    template <typename T>
+    auto get() -> T {
+        static_assert(std::is_arithmetic_v<T>);
+        uint8_t bytes[sizeof(T)];
+        getBytes(bytes, sizeof(T));
+        if (!ByteWriter::isLittleEndian()) {
+            std::reverse(bytes, bytes + sizeof(T));
+        }
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    auto getBytes(void* out, size_t size) -> void {
+        if (size > Size_ - Offset_) {
+            throw std::invalid_argument("Unexpected end of data");
+        }
+        std::memcpy(out, Data_ + Offset_, size);
+        Offset_ += size;
+    }
+
+    auto atEnd() const -> bool {
+        return Offset_ == Size_;
+    }
+
+private:
+    const uint8_t* Data_;
+    size_t Size_;
+    size_t Offset_ = 0;
+};
+
+} // namespace uZX
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+// The part of the DLPack ABI (https://dmlc.github.io/dlpack/latest/c_api.html) needed to
+// write into tensors of other libraries, e.g. torch.Tensor, in place. The layout of these
+// structs is fixed by the standard and must not be changed.
+extern "C" {
+
+enum DLDeviceType : int32_t {
+    kDLCPU = 1,
+};
+
+struct DLDevice {
+    DLDeviceType device_type;
+    int32_t device_id;
+};
+
+enum DLDataTypeCode : uint8_t {
+    kDLInt = 0,
+    kDLUInt = 1,
+    kDLFloat = 2,
+};
+
+struct DLDataType {
+    uint8_t code;
+    uint8_t bits;
+    uint16_t lanes;
+};
+
+struct DLTensor {
+    void* data;
+    DLDevice device;
+    int32_t ndim;
+    DLDataType dtype;
+    int64_t* shape;
+    int64_t* strides;   // in elements, nullptr means compact row-major
+    uint64_t byte_offset;
+};
+
+struct DLManagedTensor {
+    DLTensor dl_tensor;
+    void* manager_ctx;
+    void (*deleter)(DLManagedTensor* self);
+};
+
+} // extern "C"
+
+namespace uZX {
+
+// Owns a DLManagedTensor taken from a "dltensor" capsule and calls its deleter when
+// done, which is what the consumer side of the protocol has to do.
+class DLPackTensor {
+public:
+    explicit DLPackTensor(DLManagedTensor* managed = nullptr) : Managed_(managed) {}
+    DLPackTensor(const DLPackTensor&) = delete;
+    DLPackTensor(DLPackTensor&& other) noexcept : Managed_(std::exchange(other.Managed_, nullptr)) {}
+    auto operator=(DLPackTensor&& other) noexcept -> DLPackTensor& {
+        std::swap(Managed_, other.Managed_);
+        return *this;
+    }
+    ~DLPackTensor() {
+        if (Managed_ && Managed_->deleter) {
+            Managed_->deleter(Managed_);
+        }
+    }
+
+    auto tensor() const -> const DLTensor& {
+        return Managed_->dl_tensor;
+    }
+
+    // Address of the first element
+    auto data() const -> void* {
+        return static_cast<char*>(tensor().data) + tensor().byte_offset;
+    }
+
+    // Stride of dimension dim in elements
+    auto stride(int dim) const -> int64_t {
+        if (tensor().strides) {
+            return tensor().strides[dim];
+        }
+        int64_t stride = 1;
+        for (int i = dim + 1; i < tensor().ndim; ++i) {
+            stride *= tensor().shape[i];
+        }
+        return stride;
+    }
+
+    template <typename T>
+    auto isOfType(uint8_t code) const -> bool {
+        const auto& dtype = tensor().dtype;
+        return dtype.code == code && dtype.bits == sizeof(T) * 8 && dtype.lanes == 1;
+    }
+
+private:
+    DLManagedTensor* Managed_;
+};
+
+} // namespace uZX
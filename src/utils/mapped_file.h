@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace uZX {
+
+// Read-only memory mapping of a whole file. Pages are loaded by the OS on first
+// access, so opening a big file costs nothing until its data is actually read.
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Can not open " + path);
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            CloseHandle(file);
+            throw std::runtime_error("Can not get size of " + path);
+        }
+        Size_ = static_cast<size_t>(size.QuadPart);
+        if (Size_) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                Data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+        if (Size_ && !Data_) {
+            throw std::runtime_error("Can not map " + path);
+        }
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Can not open " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Can not get size of " + path);
+        }
+        Size_ = static_cast<size_t>(st.st_size);
+        if (Size_) {
+            void* data = mmap(nullptr, Size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Can not map " + path);
+            }
+            Data_ = static_cast<const uint8_t*>(data);
+        }
+        ::close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept
+        : Data_(std::exchange(other.Data_, nullptr))
+        , Size_(std::exchange(other.Size_, 0))
+    {}
+    auto operator=(MappedFile&& other) noexcept -> MappedFile& {
+        std::swap(Data_, other.Data_);
+        std::swap(Size_, other.Size_);
+        return *this;
+    }
+
+    ~MappedFile() {
+        if (!Data_) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(Data_);
+#else
+        munmap(const_cast<uint8_t*>(Data_), Size_);
+#endif
+    }
+
+    auto data() const -> const uint8_t* {
+        return Data_;
+    }
+
+    auto size() const -> size_t {
+        return Size_;
+    }
+
+private:
+    const uint8_t* Data_ = nullptr;
+    size_t Size_ = 0;
+};
+
+} // namespace uZX
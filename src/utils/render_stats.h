@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Build with -DPYAYAY_STATS=1 (PYAYAY_STATS=1 pip install .) to count the render hot paths.
+// Otherwise every counting statement is discarded at compile time and the counters stay zero.
+#ifndef PYAYAY_STATS
+#define PYAYAY_STATS 0
+#endif
+
+namespace uZX {
+
+// Cumulative counters of rendering. Timings are in CPU timestamp counter cycles on x86
+// and in nanoseconds elsewhere.
+struct RenderStats {
+    static constexpr bool ENABLED = PYAYAY_STATS != 0;
+
+    uint64_t samples = 0;
+    uint64_t blocks = 0;
+    uint64_t ticks = 0;
+    uint64_t steadyTicks = 0;       // of ticks, passed in closed form while the output did not change
+    uint64_t registerWrites = 0;    // through the R0-R13 registers
+    uint64_t envelopeResets = 0;    // R13 writes, every one restarts the envelope
+    uint64_t mixerCycles = 0;       // chip ticks, the mix of their levels and the interpolator update
+    uint64_t interpolationCycles = 0;
+    uint64_t firCycles = 0;
+    uint64_t dcCycles = 0;          // DC filter, master volume and the output conversion
+
+    auto operator+=(const RenderStats& other) -> RenderStats& {
+        samples += other.samples;
+        blocks += other.blocks;
+        ticks += other.ticks;
+        steadyTicks += other.steadyTicks;
+        registerWrites += other.registerWrites;
+        envelopeResets += other.envelopeResets;
+        mixerCycles += other.mixerCycles;
+        interpolationCycles += other.interpolationCycles;
+        firCycles += other.firCycles;
+        dcCycles += other.dcCycles;
+        return *this;
+    }
+
+    static auto now() -> uint64_t {
+        if constexpr (!ENABLED) {
+            return 0;
+        }
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+};
+
+} // namespace uZX
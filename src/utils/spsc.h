@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace uZX {
+
+// Lock-free queue of one producer thread and one consumer thread. Capacity is rounded up to a
+// power of two and allocated once, push and pop never allocate.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        Items_.resize(size);
+    }
+
+    auto getCapacity() const -> size_t {
+        return Items_.size();
+    }
+
+    // Producer: false when the queue is full
+    auto push(const T& item) -> bool {
+        const uint64_t tail = Tail_.load(std::memory_order_relaxed);
+        if (tail - Head_.load(std::memory_order_acquire) == Items_.size()) {
+            return false;
+        }
+        Items_[tail & (Items_.size() - 1)] = item;
+        Tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: the oldest item, nullptr when the queue is empty
+    auto front() const -> const T* {
+        const uint64_t head = Head_.load(std::memory_order_relaxed);
+        if (head == Tail_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &Items_[head & (Items_.size() - 1)];
+    }
+
+    // Consumer: drops the item front() returned
+    auto pop() -> void {
+        Head_.store(Head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    std::vector<T> Items_;
+    // Positions only grow, so full and empty are told apart without a spare slot
+    alignas(64) std::atomic<uint64_t> Head_ {0};
+    alignas(64) std::atomic<uint64_t> Tail_ {0};
+};
+
+// Lock-free ring buffer of samples between one writer thread and one reader thread
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : Data_(capacity) {}
+
+    auto getCapacity() const -> size_t {
+        return Data_.size();
+    }
+
+    // Items written and not read yet, from any thread
+    auto getSize() const -> size_t {
+        return static_cast<size_t>(Write_.load(std::memory_order_acquire) - Read_.load(std::memory_order_acquire));
+    }
+
+    // Writer: contiguous free space at writePointer(), it may be less than all the free space
+    // when the free space wraps around the end
+    auto getWritable() const -> size_t {
+        const uint64_t write = Write_.load(std::memory_order_relaxed);
+        const size_t free = Data_.size() - static_cast<size_t>(write - Read_.load(std::memory_order_acquire));
+        return std::min(free, Data_.size() - static_cast<size_t>(write % Data_.size()));
+    }
+
+    auto writePointer() -> T* {
+        return Data_.data() + Write_.load(std::memory_order_relaxed) % Data_.size();
+    }
+
+    // Writer: publishes count items written at writePointer()
+    auto commitWrite(size_t count) -> void {
+        Write_.store(Write_.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // Reader: copies up to count items to out, returns how many there were
+    auto read(T* out, size_t count) -> size_t {
+        const uint64_t read = Read_.load(std::memory_order_relaxed);
+        count = std::min(count, static_cast<size_t>(Write_.load(std::memory_order_acquire) - read));
+        const size_t begin = static_cast<size_t>(read % Data_.size());
+        const size_t first = std::min(count, Data_.size() - begin);
+        std::copy(Data_.begin() + begin, Data_.begin() + begin + first, out);
+        std::copy(Data_.begin(), Data_.begin() + (count - first), out + first);
+        Read_.store(read + count, std::memory_order_release);
+        return count;
+    }
+
+    // Items read so far
+    auto getReadPosition() const -> uint64_t {
+        return Read_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> Data_;
+    alignas(64) std::atomic<uint64_t> Read_ {0};
+    alignas(64) std::atomic<uint64_t> Write_ {0};
+};
+
+} // namespace uZX
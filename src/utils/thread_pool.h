@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+namespace uZX {
+
+// Runs a fixed set of independent tasks on a number of threads with work stealing.
+// Tasks are dealt out round-robin, biggest first, to per-thread deques. A thread takes
+// tasks from the front of its own deque and, when it runs dry, steals from the back of
+// the fullest other deque, so tasks of very different lengths (a 2 second jingle and
+// a 10 minute song) keep every thread busy until the end.
+class WorkStealingPool {
+public:
+    // 0 threads means one per hardware thread
+    explicit WorkStealingPool(size_t numThreads = 0)
+        : NumThreads_(numThreads ? numThreads : std::max(1u, std::thread::hardware_concurrency()))
+    {}
+
+    auto getNumThreads() const -> size_t {
+        return NumThreads_;
+    }
+
+    // Calls task(i) for every i in [0, costs.size()), costs are only used to order the work.
+    // The calling thread is one of the workers. The first exception thrown by a task is
+    // rethrown after all the threads are joined, the remaining tasks are skipped.
+    template <typename Task>
+    auto run(const std::vector<size_t>& costs, Task&& task) -> void {
+        const size_t numThreads = std::min(NumThreads_, costs.size());
+        if (numThreads == 0) {
+            return;
+        }
+        std::vector<size_t> order(costs.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&costs](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+        std::vector<Queue> queues(numThreads);
+        for (size_t i = 0; i < order.size(); ++i) {
+            queues[i % numThreads].tasks.push_back(order[i]);
+        }
+
+        std::atomic<bool> failed {false};
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        auto worker = [&](size_t self) {
+            size_t index;
+            while (!failed && (pop(queues[self], index) || steal(queues, self, index))) {
+                try {
+                    task(index);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    failed = true;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(numThreads - 1);
+        for (size_t i = 1; i < numThreads; ++i) {
+            threads.emplace_back(worker, i);
+        }
+        worker(0);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    static auto pop(Queue& queue, size_t& index) -> bool {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        index = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    static auto steal(std::vector<Queue>& queues, size_t self, size_t& index) -> bool {
+        // Nothing is ever added, so if the victim was emptied meanwhile just look again
+        while (true) {
+            size_t victim = self;
+            size_t most = 0;
+            for (size_t i = 0; i < queues.size(); ++i) {
+                if (i == self) {
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(queues[i].mutex);
+                if (queues[i].tasks.size() > most) {
+                    most = queues[i].tasks.size();
+                    victim = i;
+                }
+            }
+            if (victim == self) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(queues[victim].mutex);
+            if (!queues[victim].tasks.empty()) {
+                index = queues[victim].tasks.back();
+                queues[victim].tasks.pop_back();
+                return true;
+            }
+        }
+    }
+
+    size_t NumThreads_;
+};
+
+} // namespace uZX
@@ -1,9 +1,21 @@
+#include <analysis.h>
 #include <aychip.h>
+#include <psgloops.h>
+#include <randompsg.h>
+#include <realtime.h>
+#include <songfile.h>
+#include <utils/dlpack.h>
+#include <utils/thread_pool.h>
 
+#include <cmath>
 #include <cstddef>
+#include <optional>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <stdexcept>
+#include <tuple>
+#include <utility>
 
 namespace py = pybind11;
 using namespace uZX::Chip;
@@ -11,7 +23,7 @@ using namespace uZX::Chip;
 
 class RegisterWrapper {
 public:
-    RegisterWrapper(AyumiEmulator& emulator) : AY_(emulator) {}
+    RegisterWrapper(AYInterface& emulator) : AY_(emulator) {}
 
     auto setR(size_t index, int value) -> void {
         if (index < 0 || index >= std::size(AY_.R)) {
@@ -20,13 +32,715 @@ public:
         AY_.R[index] = value;
     }
 
+    auto getR(size_t index) const -> int {
+        if (index >= std::size(AY_.R)) {
+            throw std::out_of_range("Register index out of bounds");
+        }
+        return AY_.getRegister(index);
+    }
+
+private:
+    AYInterface& AY_;
+};
+
+
+// Number of output samples for frames of PSG data
+static auto psgSamples(size_t frames, float fps, int sampleRate) -> size_t {
+    float duration_sec = frames / fps;
+    return static_cast<size_t>(std::ceil(duration_sec * sampleRate));
+}
+
+// Checks (frames, 14) uint8 PSG registers and a mask of the same shape
+static auto checkPSGBuffers(const py::buffer_info& psgInfo, const py::buffer_info& maskInfo) -> void {
+    if (maskInfo.ndim != 2 || psgInfo.ndim != 2) {
+        throw std::invalid_argument("Incompatible buffers dimension, must be 2");
+    }
+    if (psgInfo.shape[1] != AyumiBatch::NUM_REGISTERS) {
+        throw std::invalid_argument("Values dim 1 must match number of registers (14)");
+    }
+    if (maskInfo.shape[1] != AyumiBatch::NUM_REGISTERS) {
+        throw std::invalid_argument("Mask dim 1 must match number of registers (14)");
+    }
+    if (maskInfo.shape[0] != psgInfo.shape[0]) {
+        throw std::invalid_argument("Buffer sizes must match");
+    }
+    if (psgInfo.format != py::format_descriptor<uint8_t>::format()) {
+        throw std::invalid_argument("Values buffer format must be uint8_t");
+    }
+    if (maskInfo.format != py::format_descriptor<bool>::format()) {
+        throw std::invalid_argument("Mask buffer format must be bool");
+    }
+    if (maskInfo.strides[1] != sizeof(bool) || psgInfo.strides[1] != sizeof(uint8_t)) {
+        throw std::invalid_argument("PSG buffers must be contiguous");
+    }
+}
+
+// Checks (chips, frames, 14) uint8 PSG registers of several chips and a mask of the same shape
+static auto checkChipsPSGBuffers(const py::buffer_info& psgInfo, const py::buffer_info& maskInfo, size_t chips) -> void {
+    if (maskInfo.ndim != 3 || psgInfo.ndim != 3) {
+        throw std::invalid_argument("Incompatible buffers dimension, must be 3");
+    }
+    if (psgInfo.shape[0] != static_cast<py::ssize_t>(chips)) {
+        throw std::invalid_argument("PSG dim 0 must match number of chips");
+    }
+    if (psgInfo.shape[2] != AyumiBatch::NUM_REGISTERS) {
+        throw std::invalid_argument("Values dim 2 must match number of registers (14)");
+    }
+    if (maskInfo.shape[0] != psgInfo.shape[0] || maskInfo.shape[1] != psgInfo.shape[1] || maskInfo.shape[2] != psgInfo.shape[2]) {
+        throw std::invalid_argument("Buffer sizes must match");
+    }
+    if (psgInfo.format != py::format_descriptor<uint8_t>::format()) {
+        throw std::invalid_argument("Values buffer format must be uint8_t");
+    }
+    if (maskInfo.format != py::format_descriptor<bool>::format()) {
+        throw std::invalid_argument("Mask buffer format must be bool");
+    }
+    if (maskInfo.strides[2] != sizeof(bool) || psgInfo.strides[2] != sizeof(uint8_t)) {
+        throw std::invalid_argument("PSG buffers must be contiguous");
+    }
+}
+
+// Distance between samples in floats for a byte stride, 0 if it can not be rendered to
+static auto floatStride(py::ssize_t byteStride) -> size_t {
+    if (byteStride <= 0 || byteStride % sizeof(float) != 0) {
+        return 0;
+    }
+    return byteStride / sizeof(float);
+}
+
+// Checks a pair of 1-dimensional float output buffers of at least samples size with equal strides,
+// returns the stride in floats
+static auto checkOutputBuffers(const py::buffer_info& outLeftInfo, const py::buffer_info& outRightInfo, size_t samples) -> size_t {
+    if (outLeftInfo.ndim != 1 || outRightInfo.ndim != 1) {
+        throw std::invalid_argument("Incompatible buffers dimension, must be 1");
+    }
+    if (outLeftInfo.size != outRightInfo.size) {
+        throw std::invalid_argument("Buffer sizes must match");
+    }
+    if (outLeftInfo.format != py::format_descriptor<float>::format() || outRightInfo.format != py::format_descriptor<float>::format()) {
+        throw std::runtime_error("Buffer format must be float");
+    }
+    if (outLeftInfo.strides[0] != outRightInfo.strides[0] || !floatStride(outLeftInfo.strides[0])) {
+        throw std::runtime_error("Output buffers must have equal positive strides");
+    }
+    if (outLeftInfo.size < static_cast<py::ssize_t>(samples)) {
+        throw std::invalid_argument("Buffer sizes must be at least" + std::to_string(samples)
+                                 + " got " + std::to_string(outLeftInfo.size));
+    }
+    return floatStride(outLeftInfo.strides[0]);
+}
+
+// Writable float32 output of a few planes, the stereo sides or the tone channels, taken from
+// a buffer, e.g. numpy.ndarray, or a DLPack tensor, e.g. torch.Tensor. Any strides work:
+// a C-contiguous (samples, 2) array is interleaved stereo, a transposed one is planar.
+struct OutputArray {
+    float* planes[TONE_CHANNELS];
+    size_t stride;                // between samples, in floats
+    py::buffer_info info;         // holds the buffer while rendering
+    uZX::DLPackTensor tensor;     // or the tensor
+};
+
+// Stereo outputs are (samples, 2), channel outputs are (3, samples)
+struct OutputShape {
+    int planes;
+    bool planesFirst;
+
+    auto describe() const -> std::string {
+        return planesFirst ? "(" + std::to_string(planes) + ", samples)" : "(samples, " + std::to_string(planes) + ")";
+    }
+};
+
+constexpr OutputShape STEREO_SHAPE {2, false};
+constexpr OutputShape CHANNELS_SHAPE {TONE_CHANNELS, true};
+
+// Returns the sample and plane dimensions of a checked shape
+static auto checkOutputShape(py::ssize_t ndim, const py::ssize_t* shape, OutputShape layout, size_t samples) -> std::pair<int, int> {
+    const int sampleDim = layout.planesFirst ? 1 : 0;
+    const int planeDim = 1 - sampleDim;
+    if (ndim != 2 || shape[planeDim] != layout.planes) {
+        throw std::invalid_argument("Output must be of " + layout.describe() + " shape");
+    }
+    if (shape[sampleDim] < static_cast<py::ssize_t>(samples)) {
+        throw std::invalid_argument("Output must have at least " + std::to_string(samples)
+                                 + " samples, got " + std::to_string(shape[sampleDim]));
+    }
+    return {sampleDim, planeDim};
+}
+
+static auto requestOutputArray(const py::object& out, size_t samples, OutputShape layout) -> OutputArray {
+    OutputArray output;
+    if (py::isinstance<py::buffer>(out)) {
+        output.info = out.cast<py::buffer>().request(true);
+        const auto& info = output.info;
+        if (info.format != py::format_descriptor<float>::format()) {
+            throw std::invalid_argument("Output format must be float32");
+        }
+        const auto [sampleDim, planeDim] = checkOutputShape(info.ndim, info.shape.data(), layout, samples);
+        output.stride = floatStride(info.strides[sampleDim]);
+        if (!output.stride || info.strides[planeDim] % sizeof(float) != 0) {
+            throw std::invalid_argument("Output strides must be positive multiples of float size");
+        }
+        for (int i = 0; i < layout.planes; ++i) {
+            output.planes[i] = static_cast<float*>(info.ptr) + i * (info.strides[planeDim] / static_cast<py::ssize_t>(sizeof(float)));
+        }
+        return output;
+    }
+    if (!py::hasattr(out, "__dlpack__")) {
+        throw std::invalid_argument("Output must support the buffer protocol or DLPack");
+    }
+    py::object capsule = out.attr("__dlpack__")();
+    auto* managed = static_cast<DLManagedTensor*>(PyCapsule_GetPointer(capsule.ptr(), "dltensor"));
+    if (!managed) {
+        throw py::error_already_set();
+    }
+    // The capsule is consumed, from now on the deleter is called by DLPackTensor
+    PyCapsule_SetName(capsule.ptr(), "used_dltensor");
+    output.tensor = uZX::DLPackTensor(managed);
+    const auto& tensor = output.tensor.tensor();
+    if (tensor.device.device_type != kDLCPU) {
+        throw std::invalid_argument("Output tensor must be on CPU");
+    }
+    if (!output.tensor.isOfType<float>(kDLFloat)) {
+        throw std::invalid_argument("Output format must be float32");
+    }
+    const py::ssize_t shape[2] = {tensor.ndim > 0 ? tensor.shape[0] : 0, tensor.ndim > 1 ? tensor.shape[1] : 0};
+    const auto [sampleDim, planeDim] = checkOutputShape(tensor.ndim, shape, layout, samples);
+    if (output.tensor.stride(sampleDim) <= 0) {
+        throw std::invalid_argument("Output strides must be positive");
+    }
+    output.stride = output.tensor.stride(sampleDim);
+    for (int i = 0; i < layout.planes; ++i) {
+        output.planes[i] = static_cast<float*>(output.tensor.data()) + i * output.tensor.stride(planeDim);
+    }
+    return output;
+}
+
+// Returns out or, when it is None, a new C-contiguous array of the layout
+static auto outputObject(const py::object& out, size_t samples, OutputShape layout) -> py::object {
+    if (!out.is_none()) {
+        return out;
+    }
+    const auto samplesDim = static_cast<py::ssize_t>(samples);
+    const auto planesDim = static_cast<py::ssize_t>(layout.planes);
+    return py::array_t<float>(layout.planesFirst ? std::vector<py::ssize_t>{planesDim, samplesDim}
+                                                 : std::vector<py::ssize_t>{samplesDim, planesDim});
+}
+
+// First sample of frame i, the frames of renderFrames are split into samples by it
+static auto frameSample(size_t i, float samples_per_frame) -> size_t {
+    return std::round(i * samples_per_frame);
+}
+
+// Renders frames [first, last) one by one, setFrame(i) sets the registers of frame i.
+// outs are left and right for the stereo mix or one per channel for EngineOutput::CHANNELS,
+// from frame 0 on.
+template <EngineOutput Output = EngineOutput::STEREO, typename Chip, typename SetFrame>
+static auto renderFrameRange(Chip& AY, size_t first, size_t last, float* const* outs, size_t stride,
+                             float fps, bool remove_dc, SetFrame&& setFrame) -> void {
+    constexpr int planes = Output == EngineOutput::STEREO ? 2 : TONE_CHANNELS;
+    float samples_per_frame = static_cast<float>(AY.getSampleRate()) / fps;
+    float* block[planes];
+    for (size_t i = first; i < last; ++i) {
+        setFrame(i);
+        const size_t sample_begin_frame = std::round(i * samples_per_frame);
+        const size_t sample_end_frame = std::round((i + 1) * samples_per_frame);
+        const size_t samples_to_render = sample_end_frame - sample_begin_frame;
+        for (int j = 0; j < planes; ++j) {
+            block[j] = outs[j] + sample_begin_frame * stride;
+        }
+        if constexpr (Output == EngineOutput::STEREO) {
+            AY.processBlock(block[0], block[1], samples_to_render, remove_dc, stride);
+        } else {
+            AY.processBlockChannels(block, samples_to_render, remove_dc, stride);
+        }
+    }
+}
+
+// Renders frames one by one, setFrame(i) sets the registers of frame i
+template <EngineOutput Output = EngineOutput::STEREO, typename Chip, typename SetFrame>
+static auto renderFrames(Chip& AY, size_t frames, float* const* outs, size_t stride,
+                         float fps, bool remove_dc, SetFrame&& setFrame) -> void {
+    renderFrameRange<Output>(AY, 0, frames, outs, stride, fps, remove_dc, std::forward<SetFrame>(setFrame));
+}
+
+// Plays frames [first, last) like renderFrameRange but without rendering, only the last warm-up
+// samples are rendered, so rendering from frame last on sounds as if everything was rendered
+template <typename SetFrame>
+static auto skipFrameRange(AyumiEmulator& AY, size_t first, size_t last, float fps, bool remove_dc,
+                           SetFrame&& setFrame) -> void {
+    float samples_per_frame = static_cast<float>(AY.getSampleRate()) / fps;
+    const size_t samples_begin = frameSample(first, samples_per_frame);
+    const size_t samples_end = frameSample(last, samples_per_frame);
+    const size_t warm_up_begin = samples_end - std::min(samples_end - samples_begin, AY.getWarmUpSamples(remove_dc));
+    for (size_t i = first; i < last; ++i) {
+        setFrame(i);
+        const size_t sample_begin_frame = std::round(i * samples_per_frame);
+        const size_t sample_end_frame = std::round((i + 1) * samples_per_frame);
+        const size_t split = std::clamp(warm_up_begin, sample_begin_frame, sample_end_frame);
+        AY.advance(split - sample_begin_frame);
+        AY.skip(sample_end_frame - split, remove_dc);
+    }
+}
+
+// Plays frames like renderFrames but without rendering, only the last warm-up samples
+// are rendered, so rendering from frame frames on sounds as if everything was rendered
+template <typename SetFrame>
+static auto skipFrames(AyumiEmulator& AY, size_t frames, float fps, bool remove_dc, SetFrame&& setFrame) -> void {
+    skipFrameRange(AY, 0, frames, fps, remove_dc, std::forward<SetFrame>(setFrame));
+}
+
+// Plays checked PSG registers frame by frame, does not touch Python objects
+template <EngineOutput Output = EngineOutput::STEREO, typename Chip>
+static auto renderPSG(Chip& AY, const py::buffer_info& psgInfo, const py::buffer_info& maskInfo,
+                      float* const* outs, size_t stride, float fps, bool remove_dc) -> void {
+    const auto* psgPtr = static_cast<const uint8_t*>(psgInfo.ptr);
+    const auto* maskPtr = static_cast<const uint8_t*>(maskInfo.ptr);
+    renderFrames<Output>(AY, psgInfo.shape[0], outs, stride, fps, remove_dc, [&](size_t i) {
+        AY.setRegisters(psgPtr + i * psgInfo.strides[0], reinterpret_cast<const bool*>(maskPtr + i * maskInfo.strides[0]));
+    });
+}
+
+// Plays checked PSG registers like renderPSG, but once two times through a loop of findPSGLoops
+// start from chip states equivalent in the parts the loop can hear, the times after the next one
+// are copied from it instead of rendered. The copied frames are only played through, without
+// rendering, for the chip state after them. Returns the number of frames copied.
+static auto renderPSGReusingLoops(AyumiEmulator& AY, const py::buffer_info& psgInfo, const py::buffer_info& maskInfo,
+                                  float* const* outs, size_t stride, float fps, bool remove_dc, size_t minPeriod) -> size_t {
+    const auto* psgPtr = static_cast<const uint8_t*>(psgInfo.ptr);
+    const auto* maskPtr = static_cast<const uint8_t*>(maskInfo.ptr);
+    const size_t frames = psgInfo.shape[0];
+    const auto loops = findPSGLoops(psgPtr, psgInfo.strides[0], maskPtr, maskInfo.strides[0], frames, minPeriod);
+    auto setFrame = [&](size_t i) {
+        AY.setRegisters(psgPtr + i * psgInfo.strides[0], reinterpret_cast<const bool*>(maskPtr + i * maskInfo.strides[0]));
+    };
+    const float samples_per_frame = static_cast<float>(AY.getSampleRate()) / fps;
+    size_t frame = 0;
+    size_t copied = 0;
+    for (const auto& loop : loops) {
+        // Every frame copied must be as long as the one it is copied from, and the output of a time
+        // through must not remember anything from before the one before it. A loop may start
+        // within the repeats of the one before, the chip state there is gone then.
+        const size_t shift = frameSample(loop.start + loop.period, samples_per_frame) - frameSample(loop.start, samples_per_frame);
+        bool aligned = loop.start >= frame && shift >= AY.getWarmUpSamples(remove_dc);
+        for (size_t i = loop.start + loop.period; i <= loop.end && aligned; ++i) {
+            aligned = frameSample(i, samples_per_frame) - frameSample(i - loop.period, samples_per_frame) == shift;
+        }
+        if (!aligned) {
+            continue;
+        }
+        renderFrameRange(AY, frame, loop.start, outs, stride, fps, remove_dc, setFrame);
+        frame = loop.start;
+        // Times through the loop until one starts like the one before it, the counters of a
+        // loop usually settle after the first time
+        std::optional<AyumiEmulator> previous;
+        ChipStateParts previousHeard;
+        bool repeating = false;
+        for (; frame + loop.period <= loop.end; frame += loop.period) {
+            uint8_t initial[AYInterface::NUM_REGISTERS];
+            for (int reg = 0; reg < AYInterface::NUM_REGISTERS; ++reg) {
+                initial[reg] = AY.getRegister(reg);
+            }
+            AyumiEmulator start(AY);
+            start.setRegisters(psgPtr + frame * psgInfo.strides[0],
+                               reinterpret_cast<const bool*>(maskPtr + frame * maskInfo.strides[0]));
+            if (previous && start.isEquivalent(*previous, previousHeard)) {
+                repeating = true;
+                break;
+            }
+            previousHeard = getHeardStateParts(initial, psgPtr, psgInfo.strides[0], maskPtr, maskInfo.strides[0],
+                                               frame, frame + loop.period);
+            previous.emplace(std::move(start));
+            renderFrameRange(AY, frame, frame + loop.period, outs, stride, fps, remove_dc, setFrame);
+        }
+        if (!repeating) {
+            continue;
+        }
+        // This time sounds like the one before, with the same filter history, so the later ones sound like it
+        renderFrameRange(AY, frame, frame + loop.period, outs, stride, fps, remove_dc, setFrame);
+        frame += loop.period;
+        for (size_t sample = frameSample(frame, samples_per_frame); sample < frameSample(loop.end, samples_per_frame); ++sample) {
+            for (float* out : {outs[0], outs[1]}) {
+                out[sample * stride] = out[(sample - shift) * stride];
+            }
+        }
+        skipFrameRange(AY, frame, loop.end, fps, remove_dc, setFrame);
+        copied += loop.end - frame;
+        frame = loop.end;
+    }
+    renderFrameRange(AY, frame, frames, outs, stride, fps, remove_dc, setFrame);
+    return copied;
+}
+
+// Plays checked PSG registers like renderPSG and hands every frame to the analyzer right after
+// rendering it, while it is in cache. Frames go to keep as (samples, 2) if it is given, otherwise
+// to a buffer of one frame that is used again and again.
+template <typename Chip>
+static auto analyzePSG(Chip& AY, const py::buffer_info& psgInfo, const py::buffer_info& maskInfo,
+                       float fps, bool remove_dc, AudioAnalyzer& analyzer, float* keep) -> void {
+    const auto* psgPtr = static_cast<const uint8_t*>(psgInfo.ptr);
+    const auto* maskPtr = static_cast<const uint8_t*>(maskInfo.ptr);
+    float samples_per_frame = static_cast<float>(AY.getSampleRate()) / fps;
+    std::vector<float> frame(keep ? 0 : (static_cast<size_t>(std::ceil(samples_per_frame)) + 1) * 2);
+    for (size_t i = 0; i < static_cast<size_t>(psgInfo.shape[0]); ++i) {
+        AY.setRegisters(psgPtr + i * psgInfo.strides[0], reinterpret_cast<const bool*>(maskPtr + i * maskInfo.strides[0]));
+        const size_t sample_begin_frame = std::round(i * samples_per_frame);
+        const size_t sample_end_frame = std::round((i + 1) * samples_per_frame);
+        const size_t samples_to_render = sample_end_frame - sample_begin_frame;
+        float* out = keep ? keep + sample_begin_frame * 2 : frame.data();
+        AY.processBlock(out, out + 1, samples_to_render, remove_dc, 2);
+        analyzer.addFrame(out, samples_to_render);
+    }
+}
+
+// Iterator of render_psg output in fixed (chunkSamples, 2) chunks. The frames are split into
+// samples like in renderFrames, a frame that does not fit into a chunk goes on in the next one,
+// so the chunks put together are the render_psg output. Every chunk is the same array.
+class PSGStream {
+public:
+    PSGStream(AYInterface& AY, const py::buffer& psg, const py::buffer& mask, float fps, size_t chunkSamples, bool removeDC)
+        : AY_(AY)
+        , PsgInfo_(psg.request())
+        , MaskInfo_(mask.request())
+        , SamplesPerFrame_(static_cast<float>(AY.getSampleRate()) / fps)
+        , RemoveDC_(removeDC)
+        , Chunk_(std::vector<py::ssize_t>{static_cast<py::ssize_t>(chunkSamples), 2})
+    {
+        checkPSGBuffers(PsgInfo_, MaskInfo_);
+        if (chunkSamples == 0) {
+            throw std::invalid_argument("Chunk samples must be greater than 0");
+        }
+    }
+
+    // The next chunk, the last one may be shorter
+    auto next() -> py::array_t<float> {
+        const auto frames = static_cast<size_t>(PsgInfo_.shape[0]);
+        const auto chunkSamples = static_cast<size_t>(Chunk_.shape(0));
+        float* chunk = Chunk_.mutable_data();
+        size_t filled = 0;
+        {
+            py::gil_scoped_release release;
+            while (filled < chunkSamples && (FrameLeft_ || Frame_ < frames)) {
+                if (!FrameLeft_) {
+                    AY_.setRegisters(static_cast<const uint8_t*>(PsgInfo_.ptr) + Frame_ * PsgInfo_.strides[0],
+                                     reinterpret_cast<const bool*>(static_cast<const uint8_t*>(MaskInfo_.ptr) + Frame_ * MaskInfo_.strides[0]));
+                    const size_t begin = std::round(Frame_ * SamplesPerFrame_);
+                    const size_t end = std::round((Frame_ + 1) * SamplesPerFrame_);
+                    FrameLeft_ = end - begin;
+                    ++Frame_;
+                    continue;
+                }
+                const size_t samples = std::min(FrameLeft_, chunkSamples - filled);
+                AY_.processBlock(chunk + filled * 2, chunk + filled * 2 + 1, samples, RemoveDC_, 2);
+                filled += samples;
+                FrameLeft_ -= samples;
+            }
+        }
+        if (!filled) {
+            throw py::stop_iteration();
+        }
+        if (filled == chunkSamples) {
+            return Chunk_;
+        }
+        return py::array_t<float>(std::vector<py::ssize_t>{static_cast<py::ssize_t>(filled), 2},
+                                  std::vector<py::ssize_t>{2 * sizeof(float), sizeof(float)}, chunk, Chunk_);
+    }
+
 private:
-    AyumiEmulator& AY_;
+    AYInterface& AY_;
+    py::buffer_info PsgInfo_;    // hold the PSG buffers while streaming
+    py::buffer_info MaskInfo_;
+    const float SamplesPerFrame_;
+    const bool RemoveDC_;
+    py::array_t<float> Chunk_;
+    size_t Frame_ = 0;           // next frame to set
+    size_t FrameLeft_ = 0;       // samples of the last set frame not rendered yet
 };
 
+// Plays checked (chips, frames, 14) PSG registers on the chips of a TurboSound frame by frame
+static auto renderTurboSoundPSG(TurboSound& TS, const py::buffer_info& psgInfo, const py::buffer_info& maskInfo,
+                                float* const* outs, size_t stride, float fps, bool remove_dc) -> void {
+    const auto* psgPtr = static_cast<const uint8_t*>(psgInfo.ptr);
+    const auto* maskPtr = static_cast<const uint8_t*>(maskInfo.ptr);
+    renderFrames(TS, psgInfo.shape[1], outs, stride, fps, remove_dc, [&](size_t i) {
+        for (size_t chip = 0; chip < TS.getNumChips(); ++chip) {
+            TS.getChip(chip).setRegisters(psgPtr + chip * psgInfo.strides[0] + i * psgInfo.strides[1],
+                reinterpret_cast<const bool*>(maskPtr + chip * maskInfo.strides[0] + i * maskInfo.strides[1]));
+        }
+    });
+}
+
+// Quality from its label: "draft", "standard" or "high", or a Quality value
+static auto parseQuality(const py::object& quality) -> Quality {
+    if (py::isinstance<py::str>(quality)) {
+        const auto label = quality.cast<std::string>();
+        const auto labels = Quality::getLabels();
+        for (size_t i = 0; i < labels.size(); ++i) {
+            if (labels[i] == label) {
+                return static_cast<int>(i);
+            }
+        }
+        throw std::invalid_argument("Quality must be draft, standard or high, got " + label);
+    }
+    return quality.cast<QualityEnum::Enum>();
+}
+
+// DC filter from its label: "box" or "iir", or a DcFilter value
+static auto parseDcFilter(const py::object& filter) -> DcFilter {
+    if (py::isinstance<py::str>(filter)) {
+        const auto label = filter.cast<std::string>();
+        const auto labels = DcFilter::getLabels();
+        for (size_t i = 0; i < labels.size(); ++i) {
+            if (labels[i] == label) {
+                return static_cast<int>(i);
+            }
+        }
+        throw std::invalid_argument("DC filter must be box or iir, got " + label);
+    }
+    return filter.cast<DcFilterEnum::Enum>();
+}
+
+static auto songFrameArrays(const SongFrame& frame) -> py::tuple {
+    py::array_t<uint8_t> registers(SongFrame::NUM_REGISTERS, frame.registers.data());
+    py::array_t<bool> mask(SongFrame::NUM_REGISTERS, frame.mask.data());
+    return py::make_tuple(registers, mask);
+}
+
+// Methods of every AYInterface implementation: registers, settings and stereo rendering
+template <typename Chip>
+static auto defChipMethods(py::class_<Chip>& cls) -> void {
+    cls
+        .def_property_readonly_static("AY", [](py::object) { return AYInterface::TypeEnum::AY; })
+        .def_property_readonly_static("YM", [](py::object) { return AYInterface::TypeEnum::YM; })
+
+        .def_property_readonly("R", [](Chip& AY) { return RegisterWrapper(AY); },
+              py::return_value_policy::reference_internal)
+
+        .def("set_registers", [](Chip& AY, const std::vector<uint8_t>& regs, const std::vector<uint8_t>& values) {
+            if (regs.size() != values.size()) {
+                throw std::invalid_argument("Buffer sizes must match");
+            }
+            for (size_t i = 0; i < regs.size(); ++i) {
+                if (regs[i] < 0 || regs[i] >= std::size(AY.R)) {
+                    throw std::out_of_range("Register index out of bounds");
+                }
+                AY.R[regs[i]] = values[i];
+            }
+        }, py::arg("registers"), py::arg("values"))
+
+        .def("set_registers_masked", [](Chip& AY, const py::buffer& values, const py::buffer& mask) {
+            auto maskInfo = mask.request();
+            auto valuesInfo = values.request();
+            if (maskInfo.ndim != 1 || valuesInfo.ndim != 1) {
+                throw std::invalid_argument("Incompatible buffers dimension, must be 1");
+            }
+            if (valuesInfo.size != static_cast<int>(std::size(AY.R))) {
+                throw std::invalid_argument("Values size must match number of registers (14)");
+            }
+            if (maskInfo.size != valuesInfo.size) {
+                throw std::invalid_argument("Buffer sizes must match");
+            }
+            if (valuesInfo.format != py::format_descriptor<uint8_t>::format()) {
+                throw std::invalid_argument("Values buffer format must be uint8_t");
+            }
+            if (maskInfo.format != py::format_descriptor<bool>::format()) {
+                throw std::invalid_argument("Mask buffer format must be bool");
+            }
+            if (maskInfo.strides[0] != sizeof(bool) || valuesInfo.strides[0] != sizeof(uint8_t)) {
+                throw std::invalid_argument("Buffers must be contiguous");
+            }
+            AY.setRegisters(static_cast<const uint8_t*>(valuesInfo.ptr), static_cast<const bool*>(maskInfo.ptr));
+        }, py::arg("values"), py::arg("mask"), "Set registers with mask. Mask is 14 bools, True means do not change the register")
+
+        .def("process_block", [](Chip& AY, py::buffer outLeft, py::buffer outRight, int samples, bool remove_dc) {
+            auto outLeftInfo = outLeft.request();
+            auto outRightInfo = outRight.request();
+            if (outLeftInfo.ndim != 1 || outRightInfo.ndim != 1) {
+                throw std::invalid_argument("Incompatible buffers dimension, must be 1");
+            }
+            if (outLeftInfo.size != outRightInfo.size) {
+                throw std::invalid_argument("Buffer sizes must match");
+            }
+            if (outLeftInfo.format != py::format_descriptor<float>::format() || outRightInfo.format != py::format_descriptor<float>::format()) {
+                throw std::invalid_argument("Buffer format must be float");
+            }
+            if (outLeftInfo.strides[0] != outRightInfo.strides[0] || !floatStride(outLeftInfo.strides[0])) {
+                throw std::invalid_argument("Buffers must have equal positive strides");
+            }
+            if (outLeftInfo.size < samples || outRightInfo.size < samples) {
+                throw std::invalid_argument("Buffer sizes must be at least" + std::to_string(samples)
+                                         + " got " + std::to_string(outLeftInfo.size));
+            }
+            if (samples <= 0) {
+                throw std::invalid_argument("Samples must be greater than 0");
+            }
+            float* outLeftPtr = static_cast<float*>(outLeftInfo.ptr);
+            float* outRightPtr = static_cast<float*>(outRightInfo.ptr);
+            AY.processBlock(outLeftPtr, outRightPtr, samples, remove_dc, floatStride(outLeftInfo.strides[0]));
+        }, py::arg("out_left"), py::arg("out_right"), py::arg("samples"), py::arg("remove_dc") = true)
+
+        .def("process_block_stereo", [](Chip& AY, int samples, const py::object& out, bool remove_dc) {
+            if (samples <= 0) {
+                throw std::invalid_argument("Samples must be greater than 0");
+            }
+            py::object result = outputObject(out, samples, STEREO_SHAPE);
+            auto output = requestOutputArray(result, samples, STEREO_SHAPE);
+            AY.processBlock(output.planes[0], output.planes[1], samples, remove_dc, output.stride);
+            return result;
+        }, py::arg("samples"), py::arg("out") = py::none(), py::arg("remove_dc") = true,
+        "Render samples into a (samples, 2) float32 output and return it, see render_psg_stereo")
+
+        .def("reset", [](Chip& AY, int sampleRate, double clock, AYInterface::TypeEnum::Enum type) {
+            AY.Reset(sampleRate, clock, type);
+            },
+            py::arg("sample_rate") = 44100,
+            py::arg("clock") = 1773400.0,
+            py::arg("type") = AYInterface::TypeEnum::AY
+        )
+        .def("can_change_clock", &Chip::canChangeClock)
+        .def("can_change_clock_continously", &Chip::canChangeClockContinously)
+        .def("get_clock_values", &Chip::getClockValues)
+        .def("set_sample_rate", &Chip::setSampleRate, py::arg("sampleRate"),
+             "Change the sample rate on the fly, the chip and filter state are kept. Use reset for a clean start")
+        .def("get_sample_rate", &Chip::getSampleRate)
+
+        .def("set_type", [](Chip& AY, AYInterface::TypeEnum::Enum type) {
+            AY.setType(type);
+        }, py::arg("type"), "Switch between the AY and YM DAC tables on the fly, the chip and filter state are kept")
+        .def("get_type", [](Chip& AY) {
+            return static_cast<AYInterface::TypeEnum::Enum>(AY.getType()); })
+
+        .def("get_clock", &Chip::getClock)
+        .def("set_clock", &Chip::setClock, py::arg("rate"),
+             "Change the clock on the fly, the chip and filter state are kept, so it can be modulated between blocks")
+
+        .def("set_pan", &Chip::setPan,
+            py::arg("index"), py::arg("value"), py::arg("is_eqp") = false)
+        .def("get_pan", &Chip::getPan, py::arg("index"))
+
+        .def("set_tone_period", &Chip::setTonePeriod, py::arg("index"), py::arg("period"))
+        .def("get_tone_period", &Chip::getTonePeriod, py::arg("index"))
+        .def("set_mixer",  &Chip::setMixer, py::arg("index"), py::arg("tone"), py::arg("noise"), py::arg("envelope"))
+        .def("set_volume", &Chip::setVolume, py::arg("index"), py::arg("volume"))
+        .def("get_volume", &Chip::getVolume, py::arg("index"))
+        .def("set_envelope_period", &Chip::setEnvelopePeriod, py::arg("period"))
+        .def("get_envelope_period", &Chip::getEnvelopePeriod)
+
+        .def("set_envelope_shape", [](Chip& AY, AYInterface::EnvShapeEnum::Enum shape) {
+                AY.setEnvelopeShape(shape);
+            }, py::arg("shape"))
+        .def("set_envelope_shape", [](Chip& AY, int shape) {
+                AY.setEnvelopeShape(shape);
+            }, py::arg("shape"))
+        .def("get_envelope_shape", [](const Chip& AY) {
+                return static_cast<AYInterface::EnvShapeEnum::Enum>(AY.getEnvelopeShape());
+            })
+
+        .def("set_noise_period", &Chip::setNoisePeriod, py::arg("period"))
+        .def("get_noise_period", &Chip::getNoisePeriod)
+
+        .def("set_master_volume", &Chip::setMasterVolume, py::arg("volume"))
+        .def("get_master_volume", &Chip::getMasterVolume)
+
+        .def("__copy__", [](const Chip& AY) {
+            return Chip(AY);
+        }, py::return_value_policy::copy)
+        .def("copy", [](const Chip& AY) {
+            return Chip(AY);
+        }, py::return_value_policy::copy)
+        ;
+}
+
+// PSG rendering of single chips, (frames, 14) registers
+template <typename Chip>
+static auto defPSGMethods(py::class_<Chip>& cls) -> void {
+    cls
+        .def("render_psg", [](Chip& AY, const py::buffer& psg, const py::buffer& mask,
+                              py::buffer outLeft, py::buffer outRight, float fps, bool remove_dc) {
+            auto psgInfo = psg.request();
+            auto maskInfo = mask.request();
+            auto outLeftInfo = outLeft.request();
+            auto outRightInfo = outRight.request();
+            checkPSGBuffers(psgInfo, maskInfo);
+            const size_t stride = checkOutputBuffers(outLeftInfo, outRightInfo, psgSamples(psgInfo.shape[0], fps, AY.getSampleRate()));
+            float* outs[] = {static_cast<float*>(outLeftInfo.ptr), static_cast<float*>(outRightInfo.ptr)};
+            renderPSG(AY, psgInfo, maskInfo, outs, stride, fps, remove_dc);
+        }, py::arg("psg"), py::arg("mask"), py::arg("out_left"), py::arg("out_right"), py::arg("fps"), py::arg("remove_dc") = true)
+
+        .def("stream_psg", [](Chip& AY, const py::buffer& psg, const py::buffer& mask, float fps,
+                              size_t chunk_samples, bool remove_dc) {
+            return PSGStream(AY, psg, mask, fps, chunk_samples, remove_dc);
+        }, py::arg("psg"), py::arg("mask"), py::arg("fps"), py::arg("chunk_samples") = 4096, py::arg("remove_dc") = true,
+        py::keep_alive<0, 1>(),
+        "Render PSG registers lazily: an iterator of (chunk_samples, 2) float32 chunks, the last one may be "
+        "shorter. Every chunk is the same reused array, copy it to keep it past the next one. "
+        "Put together the chunks are the render_psg_stereo output, in constant memory")
+
+        .def("analyze_psg", [](Chip& AY, const py::buffer& psg, const py::buffer& mask, float fps,
+                               const std::vector<std::string>& features, size_t fft_size, size_t hop_size,
+                               size_t mels, double fmin, double fmax, bool decibels, bool keep_audio, bool remove_dc) {
+            auto psgInfo = psg.request();
+            auto maskInfo = mask.request();
+            checkPSGBuffers(psgInfo, maskInfo);
+            AnalysisConfig config;
+            config.fftSize = fft_size;
+            config.hopSize = hop_size;
+            config.numMels = mels;
+            config.melMin = fmin;
+            config.melMax = fmax;
+            config.decibels = decibels;
+            AudioAnalyzer analyzer(AY.getSampleRate(), config);
+
+            const auto frames = static_cast<py::ssize_t>(psgInfo.shape[0]);
+            const size_t samples = psgSamples(psgInfo.shape[0], fps, AY.getSampleRate());
+            const auto windows = static_cast<py::ssize_t>(analyzer.getNumWindows(samples));
+            py::dict result;
+            float* outputs[4] = {};
+            for (const auto& feature : features) {
+                py::array_t<float> array;
+                if (feature == "rms" || feature == "peak") {
+                    array = py::array_t<float>(std::vector<py::ssize_t>{frames, 2});
+                    outputs[feature == "rms" ? 0 : 1] = array.mutable_data();
+                } else if (feature == "spectrum") {
+                    array = py::array_t<float>(std::vector<py::ssize_t>{windows, static_cast<py::ssize_t>(analyzer.getNumBins())});
+                    outputs[2] = array.mutable_data();
+                } else if (feature == "mel") {
+                    array = py::array_t<float>(std::vector<py::ssize_t>{windows, static_cast<py::ssize_t>(mels)});
+                    outputs[3] = array.mutable_data();
+                } else {
+                    throw std::invalid_argument("Features must be rms, peak, spectrum or mel, got " + feature);
+                }
+                result[feature.c_str()] = array;
+            }
+            analyzer.setOutputs(outputs[0], outputs[1], outputs[2], outputs[3]);
+            float* keep = nullptr;
+            if (keep_audio) {
+                py::array_t<float> audio(std::vector<py::ssize_t>{static_cast<py::ssize_t>(samples), 2});
+                keep = audio.mutable_data();
+                result["audio"] = audio;
+            }
+            {
+                py::gil_scoped_release release;
+                analyzePSG(AY, psgInfo, maskInfo, fps, remove_dc, analyzer, keep);
+            }
+            return result;
+        }, py::arg("psg"), py::arg("mask"), py::arg("fps"),
+           py::arg("features") = std::vector<std::string>{"rms", "peak", "mel"},
+           py::arg("fft_size") = 1024, py::arg("hop_size") = 256, py::arg("mels") = 64,
+           py::arg("fmin") = 0.0, py::arg("fmax") = 0.0, py::arg("decibels") = false,
+           py::arg("keep_audio") = false, py::arg("remove_dc") = true,
+        "Render PSG registers and analyze every frame right after it is rendered, without keeping the audio "
+        "unless keep_audio. Returns a dict of float32 features: rms and peak are (frames, 2) levels per PSG "
+        "frame, spectrum is the (windows, fft_size / 2 + 1) power spectrogram and mel the (windows, mels) "
+        "mel spectrogram, fmin to fmax Hz (0 is the Nyquist frequency), of the mono mix with a Hann window. "
+        "Window w covers samples [w * hop_size, w * hop_size + fft_size), a sine of amplitude A has a power "
+        "of A^2. With keep_audio the (samples, 2) audio is returned too, like render_psg_stereo")
+        ;
+}
+
 
 PYBIND11_MODULE(pyayay, m) {
     m.doc() = "Python bindings for Ayumi sound chip emulator";
+    m.attr("STATS_ENABLED") = py::bool_(uZX::RenderStats::ENABLED);
 
     py::enum_<AYInterface::TypeEnum::Enum>(m, "ChipType")
         .value("AY", AYInterface::TypeEnum::AY, "AY-3-8910")
@@ -52,45 +766,541 @@ PYBIND11_MODULE(pyayay, m) {
         .value("UP_HOLD_BOTTOM_F",   AYInterface::EnvShapeEnum::UP_HOLD_BOTTOM_F,   "/|__"  )
         .export_values();
 
+    py::enum_<PrecisionEnum::Enum>(m, "Precision")
+        .value("FLOAT64", PrecisionEnum::FLOAT64, "Double precision, same output as the original Ayumi")
+        .value("FLOAT32", PrecisionEnum::FLOAT32, "Single precision, half of the state size")
+        .export_values();
+
+    py::enum_<QualityEnum::Enum>(m, "Quality")
+        .value("DRAFT", QualityEnum::DRAFT, "4x oversampling and a 64 tap FIR, fastest, more aliasing")
+        .value("STANDARD", QualityEnum::STANDARD, "8x oversampling and a 192 tap FIR, the original Ayumi")
+        .value("HIGH", QualityEnum::HIGH, "16x oversampling and a 384 tap FIR, least aliasing, about twice slower")
+        .export_values();
+
+    py::enum_<DcFilterEnum::Enum>(m, "DcFilter")
+        .value("BOX", DcFilterEnum::BOX, "1024 sample moving average, the original Ayumi")
+        .value("IIR", DcFilterEnum::IIR, "One-pole high-pass with the same cutoff, no delay line")
+        .export_values();
+
+    py::enum_<SongFormatEnum::Enum>(m, "SongFormat")
+        .value("PSG", SongFormatEnum::PSG, "PSG register dump")
+        .value("YM", SongFormatEnum::YM, "YM2!-YM6! register dump, LHA packed or not")
+        .value("VTX", SongFormatEnum::VTX, "Vortex Tracker register dump")
+        .export_values();
+
+    m.def("find_psg_loops", [](const py::buffer& psg, const py::buffer& mask, size_t min_period) {
+        auto psgInfo = psg.request();
+        auto maskInfo = mask.request();
+        checkPSGBuffers(psgInfo, maskInfo);
+        std::vector<std::tuple<size_t, size_t, size_t>> result;
+        for (const auto& loop : findPSGLoops(static_cast<const uint8_t*>(psgInfo.ptr), psgInfo.strides[0],
+                                             static_cast<const uint8_t*>(maskInfo.ptr), maskInfo.strides[0],
+                                             psgInfo.shape[0], min_period)) {
+            result.emplace_back(loop.start, loop.period, loop.end);
+        }
+        return result;
+    }, py::arg("psg"), py::arg("mask"), py::arg("min_period") = 16,
+    "Repeated blocks of frames in (frames, 14) PSG registers and mask, as (start, period, end) tuples: every frame "
+    "of [start + period, end) writes the same registers as the one period frames before it, repeating the block "
+    "at start at least twice. The values of masked registers do not matter");
+
+    py::class_<RandomPSGConfig>(m, "RandomPSGConfig",
+        "Constraints of Ayumi.render_random_psg sequences. Every frame every channel starts a new note with "
+        "note_chance, otherwise its volume may decay by one. A note is a rest with rest_chance, or a tone, noise "
+        "or both at a random volume, played by the envelope with envelope_chance")
+        .def(py::init<>())
+        .def_readwrite("tone_period_min", &RandomPSGConfig::tonePeriodMin)
+        .def_readwrite("tone_period_max", &RandomPSGConfig::tonePeriodMax)
+        .def_readwrite("notes", &RandomPSGConfig::notes,
+                       "Tone periods of equal tempered notes, A4 = 440 Hz at the chip clock, within the range")
+        .def_readwrite("noise_period_min", &RandomPSGConfig::noisePeriodMin)
+        .def_readwrite("noise_period_max", &RandomPSGConfig::noisePeriodMax)
+        .def_readwrite("envelope_period_min", &RandomPSGConfig::envelopePeriodMin)
+        .def_readwrite("envelope_period_max", &RandomPSGConfig::envelopePeriodMax)
+        .def_readwrite("envelope_shapes", &RandomPSGConfig::envelopeShapes, "Bit per allowed R13 shape")
+        .def_readwrite("volume_min", &RandomPSGConfig::volumeMin)
+        .def_readwrite("note_chance", &RandomPSGConfig::noteChance)
+        .def_readwrite("rest_chance", &RandomPSGConfig::restChance)
+        .def_readwrite("tone_chance", &RandomPSGConfig::toneChance)
+        .def_readwrite("noise_chance", &RandomPSGConfig::noiseChance)
+        .def_readwrite("envelope_chance", &RandomPSGConfig::envelopeChance)
+        .def_readwrite("decay_chance", &RandomPSGConfig::decayChance)
+        ;
+
     py::class_<RegisterWrapper>(m, "Register")
         .def(py::init<AyumiEmulator&>())
         .def("__setitem__", &RegisterWrapper::setR)
+        .def("__getitem__", &RegisterWrapper::getR)
         ;
 
-    py::class_<AyumiEmulator>(m, "Ayumi")
-        .def_property_readonly_static("AY", [](py::object) { return AYInterface::TypeEnum::AY; })
-        .def_property_readonly_static("YM", [](py::object) { return AYInterface::TypeEnum::YM; })
-
-        .def(py::init<int, double, AYInterface::TypeEnum::Enum>(),
+    py::class_<AyumiEmulator> ayumi(m, "Ayumi");
+    defChipMethods(ayumi);
+    defPSGMethods(ayumi);
+    ayumi
+        .def(py::init([](int sampleRate, double clock, AYInterface::TypeEnum::Enum type,
+                         PrecisionEnum::Enum precision, const py::object& quality, const py::object& dcFilter) {
+                return std::make_unique<AyumiEmulator>(sampleRate, clock, type, precision, parseQuality(quality),
+                                                       parseDcFilter(dcFilter));
+             }),
              py::arg("sample_rate") = 44100,
              py::arg("clock") = 1773400,
-             py::arg("type") = AYInterface::TypeEnum::AY
+             py::arg("type") = AYInterface::TypeEnum::AY,
+             py::arg("precision") = PrecisionEnum::FLOAT64,
+             py::arg("quality") = "standard",
+             py::arg("dc_filter") = "box"
         )
-        .def_property_readonly("R", [](AyumiEmulator& AY) { return RegisterWrapper(AY); },
-              py::return_value_policy::reference_internal)
+        .def("get_precision", [](const AyumiEmulator& AY) {
+            return static_cast<PrecisionEnum::Enum>(AY.getPrecision()); })
+        .def("get_quality", [](const AyumiEmulator& AY) {
+            return static_cast<QualityEnum::Enum>(AY.getQuality()); })
+        .def("set_dc_filter", [](AyumiEmulator& AY, const py::object& filter) {
+            AY.setDcFilter(parseDcFilter(filter)); }, py::arg("filter"))
+        .def("get_dc_filter", [](const AyumiEmulator& AY) {
+            return static_cast<DcFilterEnum::Enum>(AY.getDcFilter()); })
+        .def("seek_psg", [](AyumiEmulator& AY, const py::buffer& psg, const py::buffer& mask, float fps, size_t frames, bool remove_dc) {
+            auto psgInfo = psg.request();
+            auto maskInfo = mask.request();
+            checkPSGBuffers(psgInfo, maskInfo);
+            if (frames > static_cast<size_t>(psgInfo.shape[0])) {
+                throw std::out_of_range("Frames out of bounds");
+            }
+            const auto* psgPtr = static_cast<const uint8_t*>(psgInfo.ptr);
+            const auto* maskPtr = static_cast<const uint8_t*>(maskInfo.ptr);
+            skipFrames(AY, frames, fps, remove_dc, [&](size_t i) {
+                AY.setRegisters(psgPtr + i * psgInfo.strides[0], reinterpret_cast<const bool*>(maskPtr + i * maskInfo.strides[0]));
+            });
+        }, py::arg("psg"), py::arg("mask"), py::arg("fps"), py::arg("frames"), py::arg("remove_dc") = true,
+        "Play the first frames of PSG registers without rendering them: the chip jumps over each frame "
+        "in closed form and only the last few ms are rendered to fill the filters. Then render_psg of "
+        "psg[frames:] sounds like the rest of a render_psg of the whole song")
 
-        .def("set_registers", [](AyumiEmulator& AY, const std::vector<uint8_t>& regs, const std::vector<uint8_t>& values) {
-            if (regs.size() != values.size()) {
+        .def("render_psg_stereo", [](AyumiEmulator& AY, const py::buffer& psg, const py::buffer& mask,
+                                     float fps, const py::object& out, bool remove_dc) {
+            auto psgInfo = psg.request();
+            auto maskInfo = mask.request();
+            checkPSGBuffers(psgInfo, maskInfo);
+            const size_t samples = psgSamples(psgInfo.shape[0], fps, AY.getSampleRate());
+            py::object result = outputObject(out, samples, STEREO_SHAPE);
+            auto output = requestOutputArray(result, samples, STEREO_SHAPE);
+            renderPSG(AY, psgInfo, maskInfo, output.planes, output.stride, fps, remove_dc);
+            return result;
+        }, py::arg("psg"), py::arg("mask"), py::arg("fps"), py::arg("out") = py::none(), py::arg("remove_dc") = true,
+        "Render PSG registers into a (samples, 2) float32 output and return it. out may be any (samples, 2) "
+        "float32 buffer or CPU DLPack tensor, e.g. torch.Tensor, it is filled in place. "
+        "When out is None a new interleaved numpy array is returned")
+
+        .def("render_psg_stems", [](AyumiEmulator& AY, const py::buffer& psg, const py::buffer& mask,
+                                    float fps, const py::object& out, bool remove_dc) {
+            auto psgInfo = psg.request();
+            auto maskInfo = mask.request();
+            checkPSGBuffers(psgInfo, maskInfo);
+            const size_t samples = psgSamples(psgInfo.shape[0], fps, AY.getSampleRate());
+            py::object result = outputObject(out, samples, CHANNELS_SHAPE);
+            auto output = requestOutputArray(result, samples, CHANNELS_SHAPE);
+            renderPSG<EngineOutput::CHANNELS>(AY, psgInfo, maskInfo, output.planes, output.stride, fps, remove_dc);
+            return result;
+        }, py::arg("psg"), py::arg("mask"), py::arg("fps"), py::arg("out") = py::none(), py::arg("remove_dc") = true,
+        "Render PSG registers into a (3, samples) float32 output with channels A, B and C unmixed, "
+        "in one pass over the chip. Pan does not apply, out works like in render_psg_stereo")
+
+        .def("render_events", [](AyumiEmulator& AY, const py::array_t<double, py::array::c_style | py::array::forcecast>& times,
+                                 const py::array_t<uint8_t, py::array::c_style | py::array::forcecast>& registers,
+                                 const py::array_t<uint8_t, py::array::c_style | py::array::forcecast>& values,
+                                 const py::object& samplesArg, const std::string& unit, const py::object& out, bool remove_dc) {
+            if (times.ndim() != 1 || registers.ndim() != 1 || values.ndim() != 1) {
+                throw std::invalid_argument("Incompatible buffers dimension, must be 1");
+            }
+            if (registers.size() != times.size() || values.size() != times.size()) {
                 throw std::invalid_argument("Buffer sizes must match");
             }
-            for (size_t i = 0; i < regs.size(); ++i) {
-                if (regs[i] < 0 || regs[i] >= std::size(AY.R)) {
+            if (unit != "clock" && unit != "sample") {
+                throw std::invalid_argument("Unit must be 'clock' or 'sample'");
+            }
+            // Everything is converted to clock cycles, samples are counted in samples
+            const double clocksPerSample = AY.getClock() / AY.getSampleRate();
+            const double toClock = unit == "clock" ? 1 : clocksPerSample;
+            std::vector<AyumiEmulator::RegisterWrite> writes(times.size());
+            for (size_t i = 0; i < writes.size(); ++i) {
+                writes[i] = {times.data()[i] * toClock, registers.data()[i], values.data()[i]};
+                if (writes[i].reg >= static_cast<int>(std::size(AY.R))) {
                     throw std::out_of_range("Register index out of bounds");
                 }
-                AY.R[regs[i]] = values[i];
+                if (!(writes[i].time >= (i ? writes[i - 1].time : 0))) {
+                    throw std::invalid_argument("Times must be non-negative and must not decrease");
+                }
             }
-        }, py::arg("registers"), py::arg("values"))
+            const size_t lastSample = writes.empty() ? 0 : static_cast<size_t>(writes.back().time / clocksPerSample);
+            const size_t samples = samplesArg.is_none() ? lastSample + 1 : samplesArg.cast<size_t>();
+            if (samples == 0 || (!writes.empty() && lastSample >= samples)) {
+                throw std::invalid_argument("Samples must be positive and cover all the writes");
+            }
+            py::object result = outputObject(out, samples, STEREO_SHAPE);
+            auto output = requestOutputArray(result, samples, STEREO_SHAPE);
+            py::gil_scoped_release release;
+            AY.processEvents(output.planes[0], output.planes[1], samples, writes.data(), writes.size(), remove_dc, output.stride);
+            return result;
+        }, py::arg("times"), py::arg("registers"), py::arg("values"), py::arg("samples") = py::none(),
+           py::arg("unit") = "clock", py::arg("out") = py::none(), py::arg("remove_dc") = true,
+        "Render register writes, each at its own time in chip clock cycles or samples (unit='sample') from now. "
+        "A write lands on the first chip tick after its time, not on a sample or block boundary. "
+        "samples defaults to the end of the last write's sample. Returns a (samples, 2) float32 output like render_psg_stereo")
+
+        .def("render_song", [](AyumiEmulator& AY, const SongFile& song, const py::object& out, bool remove_dc) {
+            if (!(song.getFrameRate() > 0)) {
+                throw std::invalid_argument("Song frame rate must be positive");
+            }
+            const size_t samples = psgSamples(song.getNumFrames(), song.getFrameRate(), AY.getSampleRate());
+            py::object result = outputObject(out, samples, STEREO_SHAPE);
+            auto output = requestOutputArray(result, samples, STEREO_SHAPE);
+            py::gil_scoped_release release;
+            auto reader = song.frames();
+            SongFrame frame;
+            renderFrames(AY, song.getNumFrames(), output.planes, output.stride, song.getFrameRate(), remove_dc,
+                         [&](size_t) {
+                reader.next(frame);
+                playFrame(AY, frame);
+            });
+            return result;
+        }, py::arg("song"), py::arg("out") = py::none(), py::arg("remove_dc") = true,
+        "Render a Song at its frame rate into a (samples, 2) float32 output like render_psg_stereo, "
+        "frames are decoded on the fly")
+
+        .def("render_psg_batch", [](const AyumiEmulator& AY, const std::vector<py::buffer>& psgs, const std::vector<py::buffer>& masks,
+                                    const std::vector<py::buffer>& outsLeft, const std::vector<py::buffer>& outsRight,
+                                    float fps, bool remove_dc, size_t threads) {
+            const size_t songs = psgs.size();
+            if (masks.size() != songs || outsLeft.size() != songs || outsRight.size() != songs) {
+                throw std::invalid_argument("Lists of PSG, masks and outputs must have the same length");
+            }
+            std::vector<py::buffer_info> psgInfos, maskInfos, outLeftInfos, outRightInfos;
+            std::vector<size_t> costs, strides;
+            for (size_t i = 0; i < songs; ++i) {
+                psgInfos.push_back(psgs[i].request());
+                maskInfos.push_back(masks[i].request());
+                outLeftInfos.push_back(outsLeft[i].request(true));
+                outRightInfos.push_back(outsRight[i].request(true));
+                checkPSGBuffers(psgInfos[i], maskInfos[i]);
+                costs.push_back(psgSamples(psgInfos[i].shape[0], fps, AY.getSampleRate()));
+                strides.push_back(checkOutputBuffers(outLeftInfos[i], outRightInfos[i], costs[i]));
+            }
+            // Buffer infos are released only after the GIL is taken back
+            py::gil_scoped_release release;
+            uZX::WorkStealingPool(threads).run(costs, [&](size_t i) {
+                AyumiEmulator song(AY);
+                float* outs[] = {static_cast<float*>(outLeftInfos[i].ptr), static_cast<float*>(outRightInfos[i].ptr)};
+                renderPSG(song, psgInfos[i], maskInfos[i], outs, strides[i], fps, remove_dc);
+            });
+        }, py::arg("psgs"), py::arg("masks"), py::arg("outs_left"), py::arg("outs_right"), py::arg("fps"),
+           py::arg("remove_dc") = true, py::arg("threads") = 0,
+        "Render a list of PSG songs in parallel, every song starts from a copy of this emulator. "
+        "The GIL is released while rendering, threads=0 uses all the cores")
+
+        .def("render_psg_looped", [](AyumiEmulator& AY, const py::buffer& psg, const py::buffer& mask,
+                                     float fps, const py::object& out, bool remove_dc, size_t min_period) {
+            auto psgInfo = psg.request();
+            auto maskInfo = mask.request();
+            checkPSGBuffers(psgInfo, maskInfo);
+            const size_t samples = psgSamples(psgInfo.shape[0], fps, AY.getSampleRate());
+            py::object result = outputObject(out, samples, STEREO_SHAPE);
+            auto output = requestOutputArray(result, samples, STEREO_SHAPE);
+            size_t copied;
+            {
+                py::gil_scoped_release release;
+                copied = renderPSGReusingLoops(AY, psgInfo, maskInfo, output.planes, output.stride, fps, remove_dc, min_period);
+            }
+            return py::make_tuple(result, copied);
+        }, py::arg("psg"), py::arg("mask"), py::arg("fps"), py::arg("out") = py::none(), py::arg("remove_dc") = true,
+           py::arg("min_period") = 16,
+        "render_psg_stereo for looped songs: once two times through a loop found by find_psg_loops start with "
+        "the same chip logic state (registers, engine phase and the tone counters, noise LFSR and envelope the "
+        "loop plays), the times after the next one are copied from it instead of emulated. Loops that never get "
+        "there are emulated as usual. The output matches render_psg_stereo up to rounding. "
+        "Returns the output and the number of frames copied")
+
+        .def("render_random_psg", [](const AyumiEmulator& AY, size_t count, size_t frames, float fps, uint64_t seed,
+                                     uint64_t first, const RandomPSGConfig& config, bool remove_dc, size_t threads) {
+            if (frames == 0) {
+                throw std::invalid_argument("Frames must be greater than 0");
+            }
+            const RandomPSG generator(config, AY.getClock());
+            const size_t samples = psgSamples(frames, fps, AY.getSampleRate());
+            const auto rows = static_cast<py::ssize_t>(frames);
+            const auto sequences = static_cast<py::ssize_t>(count);
+            py::array_t<uint8_t> registers(std::vector<py::ssize_t>{sequences, rows, AYInterface::NUM_REGISTERS});
+            py::array_t<bool> mask(std::vector<py::ssize_t>{sequences, rows, AYInterface::NUM_REGISTERS});
+            py::array_t<float> audio(std::vector<py::ssize_t>{sequences, static_cast<py::ssize_t>(samples), 2});
+            uint8_t* registersPtr = registers.mutable_data();
+            bool* maskPtr = mask.mutable_data();
+            float* audioPtr = audio.mutable_data();
+            {
+                py::gil_scoped_release release;
+                uZX::WorkStealingPool(threads).run(std::vector<size_t>(count, samples), [&](size_t i) {
+                    const size_t offset = i * frames * AYInterface::NUM_REGISTERS;
+                    generator.generate(seed, first + i, frames, registersPtr + offset, maskPtr + offset);
+                    AyumiEmulator song(AY);
+                    float* outs[] = {audioPtr + i * samples * 2, audioPtr + i * samples * 2 + 1};
+                    renderFrames(song, frames, outs, 2, fps, remove_dc, [&](size_t frame) {
+                        const size_t row = offset + frame * AYInterface::NUM_REGISTERS;
+                        song.setRegisters(registersPtr + row, maskPtr + row);
+                    });
+                });
+            }
+            return py::make_tuple(registers, mask, audio);
+        }, py::arg("count"), py::arg("frames"), py::arg("fps") = 50, py::arg("seed") = 0, py::arg("first") = 0,
+           py::arg("config") = RandomPSGConfig(), py::arg("remove_dc") = true, py::arg("threads") = 0,
+        "Generate count random PSG sequences of frames frames under config and render them in parallel "
+        "from copies of this emulator. Returns (count, frames, 14) registers and mask like render_psg takes "
+        "and (count, samples, 2) float32 audio. Sequence first + i of seed is always the same, so a dataset "
+        "can be made in parts. The GIL is released while rendering, threads=0 uses all the cores")
+
+        .def("process_block_channels", [](AyumiEmulator& AY, int samples, const py::object& out, bool remove_dc) {
+            if (samples <= 0) {
+                throw std::invalid_argument("Samples must be greater than 0");
+            }
+            py::object result = outputObject(out, samples, CHANNELS_SHAPE);
+            auto output = requestOutputArray(result, samples, CHANNELS_SHAPE);
+            AY.processBlockChannels(output.planes, samples, remove_dc, output.stride);
+            return result;
+        }, py::arg("samples"), py::arg("out") = py::none(), py::arg("remove_dc") = true,
+        "Render samples into a (3, samples) float32 output with channels A, B and C unmixed, see render_psg_stems")
+
+        .def("skip", &AyumiEmulator::skip, py::arg("samples"), py::arg("remove_dc") = true,
+             "Fast forward by samples without rendering them, like process_block with the output thrown away")
+        .def("advance_ticks", &AyumiEmulator::advanceTicks, py::arg("ticks"),
+             "Advance tone, noise and envelope generators by chip ticks (clock / 8) in closed form. "
+             "Nothing is rendered and the output filters are not touched")
+
+        .def("stats", [](const AyumiEmulator& AY) {
+            const uZX::RenderStats stats = AY.getStats();
+            py::dict result;
+            result["samples"] = stats.samples;
+            result["blocks"] = stats.blocks;
+            result["ticks"] = stats.ticks;
+            result["steady_ticks"] = stats.steadyTicks;
+            result["register_writes"] = stats.registerWrites;
+            result["envelope_resets"] = stats.envelopeResets;
+            result["mixer_cycles"] = stats.mixerCycles;
+            result["interpolation_cycles"] = stats.interpolationCycles;
+            result["fir_cycles"] = stats.firCycles;
+            result["dc_cycles"] = stats.dcCycles;
+            return result;
+        },
+        "Cumulative render counters as a dict: samples, blocks, chip ticks (steady_ticks of them passed "
+        "in closed form), R0-R13 writes, envelope resets and the time spent in the mixer, interpolator, "
+        "FIR and DC filter, in CPU cycles on x86 and nanoseconds elsewhere. Counted only when the module "
+        "is built with PYAYAY_STATS=1 (see STATS_ENABLED), otherwise all zero")
+        .def("reset_stats", &AyumiEmulator::resetStats, "Zero the counters of stats()")
+
+        .def("save_state", [](const AyumiEmulator& AY, bool compact) {
+            const auto state = AY.saveState(compact);
+            return py::bytes(reinterpret_cast<const char*>(state.data()), state.size());
+        }, py::arg("compact") = false,
+        "Snapshot of the settings and the chip state as bytes. The compact one leaves out the filter "
+        "history, it is about a hundred bytes instead of tens of KB, and after loading it the output "
+        "filters start from silence")
+        .def("load_state", [](AyumiEmulator& AY, const py::bytes& state) {
+            const std::string data = state;
+            AY.loadState(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+        }, py::arg("state"), "Restore a save_state snapshot, including the sample rate, clock, type and precision")
+        .def(py::pickle(
+            [](const AyumiEmulator& AY) {
+                const auto state = AY.saveState();
+                return py::bytes(reinterpret_cast<const char*>(state.data()), state.size());
+            },
+            [](const py::bytes& state) {
+                const std::string data = state;
+                AyumiEmulator AY;
+                AY.loadState(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+                return AY;
+            }))
+        ;
+
+    py::class_<BlepEmulator> blep(m, "Blep",
+        "The chip logic of Ayumi rendered with band-limited steps at the output sample rate. "
+        "Several times faster than Ayumi, with the output delayed by BLEP_DELAY samples and "
+        "a bit more aliasing near the Nyquist frequency");
+    defChipMethods(blep);
+    defPSGMethods(blep);
+    blep
+        .def(py::init<int, double, AYInterface::TypeEnum::Enum>(),
+             py::arg("sample_rate") = 44100,
+             py::arg("clock") = 1773400,
+             py::arg("type") = AYInterface::TypeEnum::AY
+        )
+        .def_property_readonly_static("BLEP_DELAY", [](py::object) { return BlepEmulator::BLEP_DELAY; })
+        ;
+
+    py::class_<TurboSound> turboSound(m, "TurboSound",
+        "Several AY chips mixed to one output, e.g. TurboSound: every chip has its own clock, type and pan, "
+        "the mix is decimated and DC filtered once. Registers and chip settings go to the selected chip");
+    defChipMethods(turboSound);
+    turboSound
+        .def(py::init([](size_t chips, int sampleRate, double clock, AYInterface::TypeEnum::Enum type,
+                         PrecisionEnum::Enum precision, const py::object& quality, const py::object& dcFilter) {
+                return std::make_unique<TurboSound>(chips, sampleRate, clock, type, precision, parseQuality(quality),
+                                                    parseDcFilter(dcFilter));
+             }),
+             py::arg("chips") = 2,
+             py::arg("sample_rate") = 44100,
+             py::arg("clock") = 1773400,
+             py::arg("type") = AYInterface::TypeEnum::AY,
+             py::arg("precision") = PrecisionEnum::FLOAT64,
+             py::arg("quality") = "standard",
+             py::arg("dc_filter") = "box"
+        )
+        .def("__len__", &TurboSound::getNumChips)
+        .def("get_num_chips", &TurboSound::getNumChips)
+        .def("select_chip", &TurboSound::selectChip, py::arg("chip"))
+        .def("get_selected_chip", &TurboSound::getSelectedChip)
+        .def("get_precision", [](const TurboSound& TS) {
+            return static_cast<PrecisionEnum::Enum>(TS.getPrecision()); })
+        .def("get_quality", [](const TurboSound& TS) {
+            return static_cast<QualityEnum::Enum>(TS.getQuality()); })
+        .def("set_dc_filter", [](TurboSound& TS, const py::object& filter) {
+            TS.setDcFilter(parseDcFilter(filter)); }, py::arg("filter"))
+        .def("get_dc_filter", [](const TurboSound& TS) {
+            return static_cast<DcFilterEnum::Enum>(TS.getDcFilter()); })
+
+        .def("render_psg", [](TurboSound& TS, const py::buffer& psg, const py::buffer& mask,
+                              py::buffer outLeft, py::buffer outRight, float fps, bool remove_dc) {
+            auto psgInfo = psg.request();
+            auto maskInfo = mask.request();
+            auto outLeftInfo = outLeft.request();
+            auto outRightInfo = outRight.request();
+            checkChipsPSGBuffers(psgInfo, maskInfo, TS.getNumChips());
+            const size_t stride = checkOutputBuffers(outLeftInfo, outRightInfo, psgSamples(psgInfo.shape[1], fps, TS.getSampleRate()));
+            float* outs[] = {static_cast<float*>(outLeftInfo.ptr), static_cast<float*>(outRightInfo.ptr)};
+            renderTurboSoundPSG(TS, psgInfo, maskInfo, outs, stride, fps, remove_dc);
+        }, py::arg("psg"), py::arg("mask"), py::arg("out_left"), py::arg("out_right"), py::arg("fps"), py::arg("remove_dc") = true,
+        "Render (chips, frames, 14) PSG registers and mask, one song per chip, into the mixed left and right outputs")
+
+        .def("render_psg_stereo", [](TurboSound& TS, const py::buffer& psg, const py::buffer& mask,
+                                     float fps, const py::object& out, bool remove_dc) {
+            auto psgInfo = psg.request();
+            auto maskInfo = mask.request();
+            checkChipsPSGBuffers(psgInfo, maskInfo, TS.getNumChips());
+            const size_t samples = psgSamples(psgInfo.shape[1], fps, TS.getSampleRate());
+            py::object result = outputObject(out, samples, STEREO_SHAPE);
+            auto output = requestOutputArray(result, samples, STEREO_SHAPE);
+            renderTurboSoundPSG(TS, psgInfo, maskInfo, output.planes, output.stride, fps, remove_dc);
+            return result;
+        }, py::arg("psg"), py::arg("mask"), py::arg("fps"), py::arg("out") = py::none(), py::arg("remove_dc") = true,
+        "Render (chips, frames, 14) PSG registers and mask into a (samples, 2) float32 output like Ayumi.render_psg_stereo")
+        ;
+
+    py::class_<PSGStream>(m, "PSGStream")
+        .def("__iter__", [](const py::object& self) { return self; })
+        .def("__next__", &PSGStream::next)
+        ;
+
+    py::class_<SongFrameReader>(m, "SongFrames")
+        .def("__iter__", [](const py::object& self) { return self; })
+        .def("__next__", [](SongFrameReader& reader) {
+            SongFrame frame;
+            if (!reader.next(frame)) {
+                throw py::stop_iteration();
+            }
+            return songFrameArrays(frame);
+        })
+        ;
+
+    py::class_<SongFile>(m, "Song")
+        .def(py::init([](const py::object& path) {
+            return SongFile::open(py::module_::import("os").attr("fspath")(path).cast<std::string>());
+        }), py::arg("path"), "Open a .psg, .ym or .vtx file, the format is detected from the contents")
+        .def_static("from_bytes", [](const py::bytes& data) {
+            const std::string bytes = data;
+            return SongFile::fromBytes(std::vector<uint8_t>(bytes.begin(), bytes.end()));
+        }, py::arg("data"))
+        .def_property_readonly("format", [](const SongFile& song) {
+            return static_cast<SongFormatEnum::Enum>(song.getFormat()); })
+        .def_property_readonly("type", [](const SongFile& song) {
+            return static_cast<AYInterface::TypeEnum::Enum>(song.getType()); })
+        .def_property_readonly("clock", &SongFile::getClock)
+        .def_property_readonly("fps", &SongFile::getFrameRate)
+        .def_property_readonly("loop_frame", &SongFile::getLoopFrame)
+        .def_property_readonly("title", &SongFile::getTitle)
+        .def_property_readonly("author", &SongFile::getAuthor)
+        .def_property_readonly("comment", &SongFile::getComment)
+        .def("__len__", &SongFile::getNumFrames)
+        .def("__iter__", &SongFile::frames, py::keep_alive<0, 1>(),
+             "Lazy iterator of (registers, mask) frames")
+        .def("to_arrays", [](const SongFile& song) {
+            const auto frames = static_cast<py::ssize_t>(song.getNumFrames());
+            py::array_t<uint8_t> registers(std::vector<py::ssize_t>{frames, SongFrame::NUM_REGISTERS});
+            py::array_t<bool> mask(std::vector<py::ssize_t>{frames, SongFrame::NUM_REGISTERS});
+            song.readAll(registers.mutable_data(), mask.mutable_data());
+            return py::make_tuple(registers, mask);
+        }, "All the frames as (frames, 14) registers and mask arrays for render_psg")
+        ;
+
+    py::class_<AyumiBatch>(m, "AyumiBatch")
+        .def(py::init([](size_t chips, int sampleRate, double clock, AYInterface::TypeEnum::Enum type,
+                         const py::object& dcFilter) {
+                return std::make_unique<AyumiBatch>(chips, sampleRate, clock, type, parseDcFilter(dcFilter));
+             }),
+             py::arg("chips"),
+             py::arg("sample_rate") = 44100,
+             py::arg("clock") = 1773400,
+             py::arg("type") = AYInterface::TypeEnum::AY,
+             py::arg("dc_filter") = "box"
+        )
+        .def("reset", [](AyumiBatch& batch, int sampleRate, double clock, AYInterface::TypeEnum::Enum type) {
+            batch.Reset(sampleRate, clock, type);
+            },
+            py::arg("sample_rate") = 44100,
+            py::arg("clock") = 1773400.0,
+            py::arg("type") = AYInterface::TypeEnum::AY
+        )
+        .def("__len__", &AyumiBatch::getNumChips)
+        .def("get_num_chips", &AyumiBatch::getNumChips)
+        .def("get_sample_rate", &AyumiBatch::getSampleRate)
+        .def("get_clock", &AyumiBatch::getClock)
+        .def("get_type", [](AyumiBatch& batch) {
+            return static_cast<AYInterface::TypeEnum::Enum>(batch.getType()); })
+        .def("set_dc_filter", [](AyumiBatch& batch, const py::object& filter) {
+            batch.setDcFilter(parseDcFilter(filter)); }, py::arg("filter"))
+        .def("get_dc_filter", [](const AyumiBatch& batch) {
+            return static_cast<DcFilterEnum::Enum>(batch.getDcFilter()); })
 
-        .def("set_registers_masked", [](AyumiEmulator& AY, const py::buffer& values, const py::buffer& mask) {
+        .def("set_pan", &AyumiBatch::setPan,
+            py::arg("index"), py::arg("value"), py::arg("is_eqp") = false)
+        .def("get_pan", &AyumiBatch::getPan, py::arg("index"))
+        .def("set_master_volume", &AyumiBatch::setMasterVolume, py::arg("volume"))
+        .def("get_master_volume", &AyumiBatch::getMasterVolume)
+
+        .def("set_register", [](AyumiBatch& batch, size_t chip, size_t reg, uint8_t value) {
+            if (chip >= batch.getNumChips()) {
+                throw std::out_of_range("Chip index out of bounds");
+            }
+            if (reg >= AyumiBatch::NUM_REGISTERS) {
+                throw std::out_of_range("Register index out of bounds");
+            }
+            batch.setRegister(chip, reg, value);
+        }, py::arg("chip"), py::arg("register"), py::arg("value"))
+        .def("get_register", [](const AyumiBatch& batch, size_t chip, size_t reg) {
+            if (chip >= batch.getNumChips()) {
+                throw std::out_of_range("Chip index out of bounds");
+            }
+            if (reg >= AyumiBatch::NUM_REGISTERS) {
+                throw std::out_of_range("Register index out of bounds");
+            }
+            return batch.getRegister(chip, reg);
+        }, py::arg("chip"), py::arg("register"))
+
+        .def("set_registers_masked", [](AyumiBatch& batch, const py::buffer& values, const py::buffer& mask) {
             auto maskInfo = mask.request();
             auto valuesInfo = values.request();
-            if (maskInfo.ndim != 1 || valuesInfo.ndim != 1) {
-                throw std::invalid_argument("Incompatible buffers dimension, must be 1");
+            if (maskInfo.ndim != 2 || valuesInfo.ndim != 2) {
+                throw std::invalid_argument("Incompatible buffers dimension, must be 2");
             }
-            if (valuesInfo.size != static_cast<int>(std::size(AY.R))) {
-                throw std::invalid_argument("Values size must match number of registers (14)");
+            if (valuesInfo.shape[0] != static_cast<py::ssize_t>(batch.getNumChips())) {
+                throw std::invalid_argument("Values dim 0 must match number of chips");
             }
-            if (maskInfo.size != valuesInfo.size) {
+            if (valuesInfo.shape[1] != AyumiBatch::NUM_REGISTERS) {
+                throw std::invalid_argument("Values dim 1 must match number of registers (14)");
+            }
+            if (maskInfo.shape[0] != valuesInfo.shape[0] || maskInfo.shape[1] != valuesInfo.shape[1]) {
                 throw std::invalid_argument("Buffer sizes must match");
             }
             if (valuesInfo.format != py::format_descriptor<uint8_t>::format()) {
@@ -99,46 +1309,53 @@ PYBIND11_MODULE(pyayay, m) {
             if (maskInfo.format != py::format_descriptor<bool>::format()) {
                 throw std::invalid_argument("Mask buffer format must be bool");
             }
-            if (maskInfo.strides[0] != sizeof(bool) || valuesInfo.strides[0] != sizeof(uint8_t)) {
-                throw std::invalid_argument("Buffers must be contiguous");
-            }
-            uint8_t* maskPtr = static_cast<uint8_t*>(maskInfo.ptr);
-            bool* valuesPtr = static_cast<bool*>(valuesInfo.ptr);
-            for (int i = 0; i < maskInfo.size; ++i) {
-                if (!maskPtr[i]) {
-                    AY.R[i] = valuesPtr[i];
+            const auto* valuesPtr = static_cast<const uint8_t*>(valuesInfo.ptr);
+            const auto* maskPtr = static_cast<const uint8_t*>(maskInfo.ptr);
+            for (size_t chip = 0; chip < batch.getNumChips(); ++chip) {
+                for (int reg = 0; reg < AyumiBatch::NUM_REGISTERS; ++reg) {
+                    if (!maskPtr[chip * maskInfo.strides[0] + reg * maskInfo.strides[1]]) {
+                        batch.setRegister(chip, reg, valuesPtr[chip * valuesInfo.strides[0] + reg * valuesInfo.strides[1]]);
+                    }
                 }
             }
-        }, py::arg("values"), py::arg("mask"), "Set registers with mask. Mask is a list of 14 bytes, 0 means do not change register, >0 means change register")
+        }, py::arg("values"), py::arg("mask"), "Set registers of all chips with (chips, 14) values and mask, mask is inverted like in Ayumi.set_registers_masked")
 
-        .def("render_psg", [](AyumiEmulator& AY, const py::buffer& psg, const py::buffer& mask,
+        .def("render_psg", [](AyumiBatch& batch, const py::buffer& psg, const py::buffer& mask,
                               py::buffer outLeft, py::buffer outRight, float fps, bool remove_dc) {
             auto psgInfo = psg.request();
             auto maskInfo = mask.request();
-            auto outLeftInfo = outLeft.request();
-            auto outRightInfo = outRight.request();
-            if (outLeftInfo.ndim != 1 || outRightInfo.ndim != 1) {
-                throw std::invalid_argument("Incompatible buffers dimension, must be 1");
+            auto outLeftInfo = outLeft.request(true);
+            auto outRightInfo = outRight.request(true);
+            const auto chips = static_cast<py::ssize_t>(batch.getNumChips());
+            if (outLeftInfo.ndim != 2 || outRightInfo.ndim != 2) {
+                throw std::invalid_argument("Incompatible output buffers dimension, must be 2");
             }
-            if (outLeftInfo.size != outRightInfo.size) {
+            if (outLeftInfo.shape[0] != chips || outRightInfo.shape[0] != chips) {
+                throw std::invalid_argument("Output buffers dim 0 must match number of chips");
+            }
+            if (outLeftInfo.shape[1] != outRightInfo.shape[1]) {
                 throw std::invalid_argument("Buffer sizes must match");
             }
             if (outLeftInfo.format != py::format_descriptor<float>::format() || outRightInfo.format != py::format_descriptor<float>::format()) {
                 throw std::runtime_error("Buffer format must be float");
             }
-            if (outLeftInfo.strides[0] != sizeof(float) || outRightInfo.strides[0] != sizeof(float)) {
-                throw std::runtime_error("Output buffers must be contiguous");
+            if (outLeftInfo.strides[1] != sizeof(float) || outRightInfo.strides[1] != sizeof(float)
+                || outLeftInfo.strides[0] != outRightInfo.strides[0] || outLeftInfo.strides[0] % sizeof(float) != 0) {
+                throw std::runtime_error("Output buffers must be row-contiguous with equal row strides");
             }
-            if (maskInfo.ndim != 2 || psgInfo.ndim != 2) {
-                throw std::invalid_argument("Incompatible buffers dimension, must be 2");
+            if (maskInfo.ndim != 3 || psgInfo.ndim != 3) {
+                throw std::invalid_argument("Incompatible buffers dimension, must be 3");
             }
-            if (psgInfo.shape[1] != static_cast<int>(std::size(AY.R))) {
-                throw std::invalid_argument("Values dim 1 must match number of registers (14)");
+            if (psgInfo.shape[0] != chips || maskInfo.shape[0] != chips) {
+                throw std::invalid_argument("PSG dim 0 must match number of chips");
+            }
+            if (psgInfo.shape[2] != AyumiBatch::NUM_REGISTERS) {
+                throw std::invalid_argument("Values dim 2 must match number of registers (14)");
             }
-            if (maskInfo.shape[1] != static_cast<int>(std::size(AY.R))) {
-                throw std::invalid_argument("Mask dim 1 must match number of registers (14)");
+            if (maskInfo.shape[2] != AyumiBatch::NUM_REGISTERS) {
+                throw std::invalid_argument("Mask dim 2 must match number of registers (14)");
             }
-            if (maskInfo.shape[0] != psgInfo.shape[0]) {
+            if (maskInfo.shape[1] != psgInfo.shape[1]) {
                 throw std::invalid_argument("Buffer sizes must match");
             }
             if (psgInfo.format != py::format_descriptor<uint8_t>::format()) {
@@ -147,119 +1364,114 @@ PYBIND11_MODULE(pyayay, m) {
             if (maskInfo.format != py::format_descriptor<bool>::format()) {
                 throw std::invalid_argument("Mask buffer format must be bool");
             }
-            if (maskInfo.strides[1] != sizeof(bool) || psgInfo.strides[1] != sizeof(uint8_t)) {
-                throw std::invalid_argument("PSG buffers must be contiguous");
-            }
-            float duration_sec = psgInfo.shape[0] / fps;
-            int samples = static_cast<int>(std::ceil(duration_sec * AY.getSampleRate()));
-            float samples_per_frame = static_cast<float>(AY.getSampleRate()) / fps;
-            if (outLeftInfo.size < samples || outRightInfo.size < samples) {
+            const auto frames = static_cast<size_t>(psgInfo.shape[1]);
+            float duration_sec = frames / fps;
+            int samples = static_cast<int>(std::ceil(duration_sec * batch.getSampleRate()));
+            float samples_per_frame = static_cast<float>(batch.getSampleRate()) / fps;
+            if (outLeftInfo.shape[1] < samples) {
                 throw std::invalid_argument("Buffer sizes must be at least" + std::to_string(samples)
-                                         + " got " + std::to_string(outLeftInfo.size));
+                                         + " got " + std::to_string(outLeftInfo.shape[1]));
             }
             float* outLeftPtr = static_cast<float*>(outLeftInfo.ptr);
             float* outRightPtr = static_cast<float*>(outRightInfo.ptr);
-            const int stride = 1;
-            uint8_t* psgPtr = static_cast<uint8_t*>(psgInfo.ptr);
-            uint8_t* maskPtr = static_cast<uint8_t*>(maskInfo.ptr);
-            for (size_t i = 0; i < static_cast<size_t>(psgInfo.shape[0]); ++i) {
-                for (size_t j = 0; j < std::size(AY.R); ++j) {
-                    if (!maskPtr[i * std::size(AY.R) + j]) {
-                        AY.R[j] = psgPtr[i * std::size(AY.R) + j];
+            const size_t chipStride = outLeftInfo.strides[0] / sizeof(float);
+            const auto* psgPtr = static_cast<const uint8_t*>(psgInfo.ptr);
+            const auto* maskPtr = static_cast<const uint8_t*>(maskInfo.ptr);
+            for (size_t i = 0; i < frames; ++i) {
+                for (py::ssize_t chip = 0; chip < chips; ++chip) {
+                    for (int reg = 0; reg < AyumiBatch::NUM_REGISTERS; ++reg) {
+                        if (!maskPtr[chip * maskInfo.strides[0] + i * maskInfo.strides[1] + reg * maskInfo.strides[2]]) {
+                            batch.setRegister(chip, reg, psgPtr[chip * psgInfo.strides[0] + i * psgInfo.strides[1] + reg * psgInfo.strides[2]]);
+                        }
                     }
                 }
                 const size_t sample_begin_frame = std::round(i * samples_per_frame);
                 const size_t sample_end_frame = std::round((i + 1) * samples_per_frame);
                 const size_t samples_to_render = sample_end_frame - sample_begin_frame;
-                AY.processBlock(outLeftPtr, outRightPtr, samples_to_render, stride, remove_dc);
+                batch.processBlock(outLeftPtr, outRightPtr, chipStride, samples_to_render, remove_dc);
                 outLeftPtr += samples_to_render;
                 outRightPtr += samples_to_render;
             }
-        }, py::arg("psg"), py::arg("mask"), py::arg("out_left"), py::arg("out_right"), py::arg("fps"), py::arg("remove_dc") = true)
+        }, py::arg("psg"), py::arg("mask"), py::arg("out_left"), py::arg("out_right"), py::arg("fps"), py::arg("remove_dc") = true,
+        "Render (chips, frames, 14) PSG registers and mask into (chips, samples) float32 outputs")
 
-        .def("process_block", [](AyumiEmulator& AY, py::buffer outLeft, py::buffer outRight, int samples, bool remove_dc) {
-            auto outLeftInfo = outLeft.request();
-            auto outRightInfo = outRight.request();
-            if (outLeftInfo.ndim != 1 || outRightInfo.ndim != 1) {
-                throw std::invalid_argument("Incompatible buffers dimension, must be 1");
+        .def("process_block", [](AyumiBatch& batch, py::buffer outLeft, py::buffer outRight, int samples, bool remove_dc) {
+            auto outLeftInfo = outLeft.request(true);
+            auto outRightInfo = outRight.request(true);
+            const auto chips = static_cast<py::ssize_t>(batch.getNumChips());
+            if (outLeftInfo.ndim != 2 || outRightInfo.ndim != 2) {
+                throw std::invalid_argument("Incompatible buffers dimension, must be 2");
             }
-            if (outLeftInfo.size != outRightInfo.size) {
+            if (outLeftInfo.shape[0] != chips || outRightInfo.shape[0] != chips) {
+                throw std::invalid_argument("Buffers dim 0 must match number of chips");
+            }
+            if (outLeftInfo.shape[1] != outRightInfo.shape[1]) {
                 throw std::invalid_argument("Buffer sizes must match");
             }
             if (outLeftInfo.format != py::format_descriptor<float>::format() || outRightInfo.format != py::format_descriptor<float>::format()) {
                 throw std::invalid_argument("Buffer format must be float");
             }
-            if (outLeftInfo.strides[0] != sizeof(float) || outRightInfo.strides[0] != sizeof(float)) {
-                throw std::invalid_argument("Buffers must be contiguous");
+            if (outLeftInfo.strides[1] != sizeof(float) || outRightInfo.strides[1] != sizeof(float)
+                || outLeftInfo.strides[0] != outRightInfo.strides[0] || outLeftInfo.strides[0] % sizeof(float) != 0) {
+                throw std::invalid_argument("Buffers must be row-contiguous with equal row strides");
             }
-            if (outLeftInfo.size < samples || outRightInfo.size < samples) {
+            if (outLeftInfo.shape[1] < samples) {
                 throw std::invalid_argument("Buffer sizes must be at least" + std::to_string(samples)
-                                         + " got " + std::to_string(outLeftInfo.size));
+                                         + " got " + std::to_string(outLeftInfo.shape[1]));
             }
             if (samples <= 0) {
                 throw std::invalid_argument("Samples must be greater than 0");
             }
-            float* outLeftPtr = static_cast<float*>(outLeftInfo.ptr);
-            float* outRightPtr = static_cast<float*>(outRightInfo.ptr);
-            const int stride = 1;
-            AY.processBlock(outLeftPtr, outRightPtr, samples, stride, remove_dc);
+            const size_t chipStride = outLeftInfo.strides[0] / sizeof(float);
+            batch.processBlock(static_cast<float*>(outLeftInfo.ptr), static_cast<float*>(outRightInfo.ptr),
+                               chipStride, samples, remove_dc);
         }, py::arg("out_left"), py::arg("out_right"), py::arg("samples"), py::arg("remove_dc") = true)
+        ;
 
-        .def("reset", [](AyumiEmulator& AY, int sampleRate, double clock, AYInterface::TypeEnum::Enum type) {
-            AY.Reset(sampleRate, clock, type);
-            },
-            py::arg("sample_rate") = 44100,
-            py::arg("clock") = 1773400.0,
-            py::arg("type") = AYInterface::TypeEnum::AY
+    py::class_<RealtimeAyumi>(m, "RealtimeAyumi",
+        "Real-time stream of an Ayumi copy: write() queues register writes, a render thread renders "
+        "ahead into a ring buffer and pull() takes the audio, without locks or the GIL")
+        .def(py::init<const AyumiEmulator&, size_t, size_t, size_t>(),
+             py::arg("ay"),
+             py::arg("buffer_samples") = 4096,
+             py::arg("block_samples") = 256,
+             py::arg("queue_size") = 4096
         )
-        .def("can_change_clock", &AyumiEmulator::canChangeClock)
-        .def("can_change_clock_continously", &AyumiEmulator::canChangeClockContinously)
-        .def("get_clock_values", &AyumiEmulator::getClockValues)
-        .def("set_sample_rate", &AyumiEmulator::setSampleRate, py::arg("sampleRate"))
-        .def("get_sample_rate", &AyumiEmulator::getSampleRate)
-
-        .def("set_type", [](AyumiEmulator& AY, AYInterface::TypeEnum::Enum type) {
-            AY.setType(type);
-        }, py::arg("type"))
-        .def("get_type", [](AyumiEmulator& AY) {
-            return static_cast<AYInterface::TypeEnum::Enum>(AY.getType()); })
-
-        .def("get_clock", &AyumiEmulator::getClock)
-        .def("set_clock", &AyumiEmulator::setClock, py::arg("rate"))
-
-        .def("set_pan", &AyumiEmulator::setPan,
-            py::arg("index"), py::arg("value"), py::arg("is_eqp") = false)
-        .def("get_pan", &AyumiEmulator::getPan, py::arg("index"))
-
-        .def("set_tone_period", &AyumiEmulator::setTonePeriod, py::arg("index"), py::arg("period"))
-        .def("get_tone_period", &AyumiEmulator::getTonePeriod, py::arg("index"))
-        .def("set_mixer",  &AyumiEmulator::setMixer, py::arg("index"), py::arg("tone"), py::arg("noise"), py::arg("envelope"))
-        .def("set_volume", &AyumiEmulator::setVolume, py::arg("index"), py::arg("volume"))
-        .def("get_volume", &AyumiEmulator::getVolume, py::arg("index"))
-        .def("set_envelope_period", &AyumiEmulator::setEnvelopePeriod, py::arg("period"))
-        .def("get_envelope_period", &AyumiEmulator::getEnvelopePeriod)
-
-        .def("set_envelope_shape", [](AyumiEmulator& AY, AYInterface::EnvShapeEnum::Enum shape) {
-                AY.setEnvelopeShape(shape);
-            }, py::arg("shape"))
-        .def("set_envelope_shape", [](AyumiEmulator& AY, int shape) {
-                AY.setEnvelopeShape(shape);
-            }, py::arg("shape"))
-        .def("get_envelope_shape", [](const AyumiEmulator& AY) {
-                return static_cast<AYInterface::EnvShapeEnum::Enum>(AY.getEnvelopeShape());
-            })
-
-        .def("set_noise_period", &AyumiEmulator::setNoisePeriod, py::arg("period"))
-        .def("get_noise_period", &AyumiEmulator::getNoisePeriod)
-
-        .def("set_master_volume", &AyumiEmulator::setMasterVolume, py::arg("volume"))
-        .def("get_master_volume", &AyumiEmulator::getMasterVolume)
-
-        .def("__copy__", [](const AyumiEmulator& AY) {
-            return AyumiEmulator(AY);
-        }, py::return_value_policy::copy)
-        .def("copy", [](const AyumiEmulator& AY) {
-            return AyumiEmulator(AY);
-        }, py::return_value_policy::copy)
+        .def("start", &RealtimeAyumi::start)
+        .def("stop", &RealtimeAyumi::stop, py::call_guard<py::gil_scoped_release>())
+        .def("is_running", &RealtimeAyumi::isRunning)
+        .def("__enter__", [](RealtimeAyumi& stream) -> RealtimeAyumi& {
+            stream.start();
+            return stream;
+        }, py::return_value_policy::reference)
+        .def("__exit__", [](RealtimeAyumi& stream, const py::object&, const py::object&, const py::object&) {
+            py::gil_scoped_release release;
+            stream.stop();
+        })
+        .def("write", &RealtimeAyumi::write, py::arg("time"), py::arg("reg"), py::arg("value"),
+        "Queue a register write at time in samples from the start of the stream. "
+        "Returns False when the queue is full and the write is dropped")
+        .def("pull", [](RealtimeAyumi& stream, py::buffer out) {
+            auto info = out.request(true);
+            if (info.format != py::format_descriptor<float>::format()) {
+                throw std::invalid_argument("Output format must be float32");
+            }
+            if (info.ndim != 2 || info.shape[1] != 2 || info.strides[1] != sizeof(float)
+                || info.strides[0] != 2 * sizeof(float)) {
+                throw std::invalid_argument("Output must be a C-contiguous (samples, 2) array");
+            }
+            py::gil_scoped_release release;
+            return stream.pull(static_cast<float*>(info.ptr), info.shape[0]);
+        }, py::arg("out"),
+        "Fill a C-contiguous (samples, 2) float32 output with the next samples. Samples not rendered yet "
+        "are silence and count as an underrun. Returns how many samples were rendered")
+        .def("get_sample_rate", &RealtimeAyumi::getSampleRate)
+        .def("get_position", &RealtimeAyumi::getPosition, "Samples pulled so far")
+        .def("get_latency", &RealtimeAyumi::getBufferedSamples,
+            "Samples rendered ahead and not pulled yet, the output latency")
+        .def("get_underruns", &RealtimeAyumi::getUnderruns)
+        .def("get_dropped_writes", &RealtimeAyumi::getDroppedWrites)
+        .def("get_late_writes", &RealtimeAyumi::getLateWrites,
+            "Writes that came after their time was rendered and landed later")
         ;
 }
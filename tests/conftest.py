@@ -0,0 +1,17 @@
+import numpy as np
+
+
+def random_psg(chips=None, frames=100, seed=1, masked=0.0, shape_masked=0.9, long_periods=False):
+    # Random registers and mask as render_psg takes them, (frames, 14) or (chips, frames, 14).
+    # Every register but R13 is not written with the chance masked, R13 with shape_masked, as
+    # writing it restarts the envelope. The first frame writes all of them.
+    # long_periods keeps tone and envelope periods at 256 and up, away from the clamped 0.
+    shape = (frames, 14) if chips is None else (chips, frames, 14)
+    rng = np.random.default_rng(seed)
+    psg = rng.integers(0, 256, size=shape, dtype=np.uint8)
+    if long_periods:
+        psg[..., [1, 3, 5, 12]] |= 1
+    mask = rng.random(shape) < masked
+    mask[..., 13] = rng.random(shape[:-1]) < shape_masked
+    mask[..., 0, :] = False
+    return psg, mask
@@ -0,0 +1,75 @@
+import numpy as np
+import pytest
+
+from pyayay import Ayumi
+
+from .conftest import random_psg
+
+
+def frame_bounds(frames, fps, sample_rate):
+    return [(round(i * sample_rate / fps), round((i + 1) * sample_rate / fps)) for i in range(frames)]
+
+
+def test_analyze_levels():
+    psg, mask = random_psg(frames=60, seed=3)
+    ay = Ayumi()
+    audio = ay.copy().render_psg_stereo(psg, mask, 50)
+    features = ay.analyze_psg(psg, mask, 50, features=["rms", "peak"], keep_audio=True)
+    assert set(features) == {"rms", "peak", "audio"}
+    np.testing.assert_array_equal(features["audio"], audio)
+
+    assert features["rms"].shape == (60, 2)
+    for i, (begin, end) in enumerate(frame_bounds(60, 50, 44100)):
+        frame = audio[begin:end]
+        np.testing.assert_allclose(features["rms"][i], np.sqrt(np.mean(frame.astype(np.float64) ** 2, axis=0)), rtol=1e-5)
+        np.testing.assert_array_equal(features["peak"][i], np.abs(frame).max(axis=0))
+
+
+def test_analyze_spectrum():
+    psg, mask = random_psg(frames=40, seed=3)
+    ay = Ayumi(sample_rate=32000)
+    features = ay.copy().analyze_psg(psg, mask, 50, features=["spectrum", "mel"], fft_size=512, hop_size=300,
+                                     mels=40, keep_audio=True)
+    audio = features["audio"]
+    mono = audio.mean(axis=1, dtype=np.float64)
+    windows = (len(mono) - 512) // 300 + 1
+    assert features["spectrum"].shape == (windows, 257)
+    assert features["mel"].shape == (windows, 40)
+
+    window = 0.5 - 0.5 * np.cos(2 * np.pi * np.arange(512) / 512)
+    frames = np.stack([mono[w * 300:w * 300 + 512] * window for w in range(windows)])
+    expected = np.abs(np.fft.rfft(frames)) ** 2 * 4 / window.sum() ** 2
+    np.testing.assert_allclose(features["spectrum"], expected, rtol=1e-3, atol=1e-6 * expected.max())
+    # mel bands are non-negative weightings of the power
+    assert np.all(features["mel"] >= 0)
+    assert features["mel"].sum() > 0
+
+    db = ay.copy().analyze_psg(psg, mask, 50, features=["spectrum"], fft_size=512, hop_size=300, decibels=True)
+    loud = expected > 1e-4 * expected.max()
+    np.testing.assert_allclose(db["spectrum"][loud], 10 * np.log10(expected[loud]), atol=0.01)
+
+
+def test_analyze_sine():
+    # a square wave tone peaks at its fundamental
+    ay = Ayumi(sample_rate=44100, clock=1773400)
+    psg = np.zeros((25, 14), dtype=np.uint8)
+    psg[:, 0] = 111    # about 1000 Hz
+    psg[:, 7] = 0b111110
+    psg[:, 8] = 15
+    mask = np.zeros_like(psg, dtype=bool)
+    spectrum = ay.analyze_psg(psg, mask, 50, features=["spectrum"], fft_size=4096)["spectrum"]
+    peak = spectrum[-1].argmax()
+    assert peak * 44100 / 4096 == pytest.approx(1773400 / (16 * 111), abs=44100 / 4096)
+
+
+def test_analyze_errors():
+    psg, mask = random_psg(frames=10, seed=3)
+    ay = Ayumi()
+    with pytest.raises(ValueError):
+        ay.analyze_psg(psg, mask, 50, features=["loudness"])
+    with pytest.raises(ValueError):
+        ay.analyze_psg(psg, mask, 50, fft_size=1000)
+    with pytest.raises(ValueError):
+        ay.analyze_psg(psg, mask, 50, fmin=1000, fmax=500)
+    # too short for a window: no spectrogram rows
+    assert ay.analyze_psg(psg[:1], mask[:1], 50, fft_size=2048)["mel"].shape == (0, 64)
@@ -1,10 +1,13 @@
 from array import array
 import math
+import pickle
 
 import pytest
 import numpy as np
 
-from pyayay import Ayumi, EnvShape, ChipType
+from pyayay import Ayumi, EnvShape, ChipType, Precision, Quality, DcFilter, STATS_ENABLED
+
+from .conftest import random_psg
 
 def bypass_initial_click(ay, duration_s=0.03):
     sample_rate = ay.get_sample_rate()
@@ -117,6 +120,23 @@ def test_clock():
     ay.reset(clock=1773400)
     assert ay.get_clock() == 1773400
 
+def test_retune_keeps_state():
+    ay = tone_ay()
+    bypass_initial_click(ay)
+    same = ay.copy()
+    same.set_clock(ay.get_clock())
+    same.set_sample_rate(ay.get_sample_rate())
+    same.set_type(ay.get_type())
+    np.testing.assert_array_equal(same.process_block_channels(1000), ay.process_block_channels(1000))
+
+    # No click on a clock change in the middle of a tone
+    out = np.zeros((2, 2000), dtype=np.float32)
+    ay.process_block(out[0, :1000], out[1, :1000], 1000)
+    ay.set_clock(ay.get_clock() * 1.05)
+    ay.process_block(out[0, 1000:], out[1, 1000:], 1000)
+    steps = np.abs(np.diff(out[0]))
+    assert steps[995:1005].max() <= steps[:995].max() * 1.1
+
 def test_sample_rate():
     ay = Ayumi(44100)
     assert ay.get_sample_rate() == 44100
@@ -135,6 +155,67 @@ def test_type():
     ay.reset(type=Ayumi.YM)
     assert ay.get_type() == Ayumi.YM
 
+def quality_tone(quality):
+    ay = Ayumi(quality=quality)
+    ay.set_tone_period(0, 100)
+    ay.set_mixer(0, True, False, False)
+    ay.set_volume(0, 15)
+    ay.process_block_stereo(4410)
+    return ay.process_block_stereo(44100)[:, 0]
+
+@pytest.mark.parametrize("quality, expected", [
+    ("draft", Quality.DRAFT), ("high", Quality.HIGH), (Quality.HIGH, Quality.HIGH)])
+def test_quality(quality, expected):
+    ay = Ayumi(quality=quality)
+    assert ay.get_quality() == expected
+    assert ay.copy().get_quality() == expected
+    restored = Ayumi()
+    restored.load_state(ay.save_state(compact=True))
+    assert restored.get_quality() == expected
+
+    # Every tier renders the same sound, only the filter and its delay differ
+    reference = quality_tone("standard")
+    out = quality_tone(quality)
+    lags = range(-16, 17)
+    assert max(np.corrcoef(reference[16:-16], out[16 + lag:len(out) - 16 + lag])[0, 1] for lag in lags) > 0.999
+    assert np.std(out) == pytest.approx(np.std(reference), rel=0.01)
+
+def test_quality_errors():
+    assert Ayumi().get_quality() == Quality.STANDARD
+    with pytest.raises(ValueError):
+        Ayumi(quality="ultra")
+
+def test_dc_filter():
+    assert Ayumi().get_dc_filter() == DcFilter.BOX
+    ay = Ayumi(dc_filter="iir")
+    assert ay.get_dc_filter() == DcFilter.IIR
+    assert ay.copy().get_dc_filter() == DcFilter.IIR
+    with pytest.raises(ValueError):
+        Ayumi(dc_filter="fir")
+
+    # a tone is all positive before the filter, both filters leave it centered at the same level
+    out = {}
+    for dc_filter in [DcFilter.BOX, DcFilter.IIR]:
+        ay = Ayumi(dc_filter=dc_filter)
+        ay.set_tone_period(0, 100)
+        ay.set_mixer(0, True, False, False)
+        ay.set_volume(0, 15)
+        ay.process_block_stereo(22050)
+        out[dc_filter] = ay.process_block_stereo(44100)[:, 0]
+        assert abs(np.mean(out[dc_filter])) < 1e-3
+    assert np.std(out[DcFilter.IIR]) == pytest.approx(np.std(out[DcFilter.BOX]), rel=0.01)
+
+    # the iir filter has no delay line, so its full state is small and restores exactly
+    ay = state_ay()
+    ay.set_dc_filter("iir")
+    ay.process_block_stereo(3333)
+    state = ay.save_state()
+    assert len(state) < len(state_ay().save_state()) // 4
+    restored = Ayumi()
+    restored.load_state(state)
+    assert restored.get_dc_filter() == DcFilter.IIR
+    np.testing.assert_array_equal(restored.process_block_stereo(5000), ay.process_block_stereo(5000))
+
 def test_pan():
     ay = Ayumi()
 
@@ -313,6 +394,47 @@ def test_registers_array_bounds():
     with pytest.raises(IndexError):
         ay.set_registers([15], [42])
 
+def test_registers_read_back():
+    ay = Ayumi()
+    # registers keep only the bits the chip has
+    ay.set_registers([1, 6, 7, 8, 13], [0xf3, 0xff, 0xff, 0xff, 0xff])
+    assert [ay.R[i] for i in [1, 6, 7, 8, 13]] == [0x03, 0x1f, 0xff, 0x1f, 0x0f]
+    # setters show up in the registers
+    ay.set_tone_period(1, 0x234)
+    ay.set_mixer(2, True, False, True)
+    assert (ay.R[2], ay.R[3]) == (0x34, 0x02)
+    assert ay.R[7] & 0b00100100 == 0b00100000
+    assert ay.R[10] & 0x10
+    with pytest.raises(IndexError):
+        ay.R[14]
+
+def test_registers_zero_fine_period():
+    # the chip makes period 0 into 1, that must not leak into the other register of the pair
+    ay = Ayumi()
+    ay.R[0] = 0
+    ay.R[1] = 1
+    assert ay.get_tone_period(0) == 0x100
+    ay.R[11] = 0
+    ay.R[12] = 2
+    assert ay.get_envelope_period() == 0x200
+
+def test_registers_first_write():
+    # a fresh chip has noise period 0, not the 1 of R6 = 0, so the first R6 = 0 must reach it
+    def render_noise(*periods):
+        ay = Ayumi()
+        ay.R[7] = 0b00110111
+        ay.R[8] = 15
+        for period in periods:
+            ay.R[6] = period
+        assert ay.get_noise_period() == (1 if periods else 0)
+        outLeft  = np.zeros(4410, dtype=np.float32)
+        outRight = np.zeros(4410, dtype=np.float32)
+        ay.process_block(outLeft, outRight, 4410)
+        return outLeft
+
+    np.testing.assert_array_equal(render_noise(0), render_noise(5, 0))
+    assert not np.array_equal(render_noise(0), render_noise())
+
 def test_registers_masked_error():
     ay = Ayumi()
     # array size must be 14
@@ -378,3 +500,399 @@ def test_psg_play():
 
     with pytest.raises(ValueError):
         ay.render_psg(data, mask[:-1], outLeft, outRight, 10)
+
+def test_block_sizes():
+    # output must not depend on how the rendering is split into blocks
+    def render(sizes):
+        ay = Ayumi()
+        ay.set_mixer(0, True, True, False)
+        ay.set_mixer(1, False, False, True)
+        ay.set_tone_period(0, 77)
+        ay.set_volume(0, 15)
+        ay.set_noise_period(3)
+        ay.set_envelope_shape(EnvShape.DOWN_UP_A)
+        ay.set_envelope_period(40)
+        outLeft  = np.zeros(sum(sizes), dtype=np.float32)
+        outRight = np.zeros(sum(sizes), dtype=np.float32)
+        pos = 0
+        for size in sizes:
+            ay.process_block(outLeft[pos:], outRight[pos:], size)
+            pos += size
+        return outLeft, outRight
+
+    left, right = render([4000])
+    for sizes in ([1] * 50 + [3950], [7, 9, 13, 8, 3963], [1001, 999, 2000]):
+        splitLeft, splitRight = render(sizes)
+        np.testing.assert_array_equal(left, splitLeft)
+        np.testing.assert_array_equal(right, splitRight)
+
+@pytest.mark.parametrize("type", [ChipType.AY, ChipType.YM])
+def test_float32_precision(type):
+    frames = 50 * 20
+    psg, mask = random_psg(frames=frames, seed=3, long_periods=True)
+
+    outputs = []
+    for precision in (Precision.FLOAT64, Precision.FLOAT32):
+        ay = Ayumi(type=type, precision=precision)
+        assert ay.get_precision() == precision
+        assert ay.copy().get_precision() == precision
+        samples = 44100 * frames // 50
+        outLeft  = np.zeros(samples, dtype=np.float32)
+        outRight = np.zeros(samples, dtype=np.float32)
+        ay.render_psg(psg, mask, outLeft, outRight, 50)
+        outputs.append(np.stack([outLeft, outRight]))
+
+    # measured max error of float32 against float64 is about 4e-7,
+    # it does not grow with time because the DC filter sums stay in double
+    error = np.abs(outputs[0] - outputs[1])
+    assert error.max() < 2e-6
+    assert np.sqrt(np.mean(error ** 2)) < 1e-7
+
+def test_render_psg_batch():
+    fps = 50
+    template = Ayumi(type=ChipType.YM)
+    template.set_pan(0, 0.1)
+    psgs, masks, outsLeft, outsRight = [], [], [], []
+    for seed, frames in enumerate((1, 7, 300, 40, 1500, 2)):
+        psg, mask = random_psg(frames=frames, seed=seed, masked=0.3, shape_masked=0.3, long_periods=True)
+        psgs.append(psg)
+        masks.append(mask)
+        samples = 44100 * frames // fps
+        outsLeft.append(np.zeros(samples, dtype=np.float32))
+        outsRight.append(np.zeros(samples, dtype=np.float32))
+
+    template.render_psg_batch(psgs, masks, outsLeft, outsRight, fps, threads=3)
+
+    for psg, mask, outLeft, outRight in zip(psgs, masks, outsLeft, outsRight):
+        ay = template.copy()
+        left = np.zeros_like(outLeft)
+        right = np.zeros_like(outRight)
+        ay.render_psg(psg, mask, left, right, fps)
+        np.testing.assert_array_equal(left, outLeft)
+        np.testing.assert_array_equal(right, outRight)
+
+    with pytest.raises(ValueError):
+        template.render_psg_batch(psgs, masks[:-1], outsLeft, outsRight, fps)
+
+    with pytest.raises(ValueError):
+        template.render_psg_batch(psgs, masks, outsLeft[:-1] + [np.zeros(10, dtype=np.float32)], outsRight, fps)
+
+def test_render_psg_keep_dc():
+    data = np.array([[0, 1, 0, 0, 0, 0, 0, 0b00111110, 15, 0, 0, 0, 0, 0]] * 10, dtype=np.uint8)
+    mask = np.zeros((10, 14), dtype=bool)
+    ay = Ayumi()
+    samples = 44100 // 50 * 10
+    outLeft  = np.zeros(samples, dtype=np.float32)
+    outRight = np.zeros(samples, dtype=np.float32)
+    ay.render_psg(data, mask, outLeft, outRight, 50, remove_dc=False)
+    # the whole buffer is written, and the DC of the square wave is kept
+    assert np.abs(outLeft[samples // 2:]).max() > 0.5
+    assert outLeft[100:].mean() > 0.1
+
+def tone_ay():
+    ay = Ayumi()
+    ay.set_pan(0, 0.2)
+    ay.set_tone_period(0, 100)
+    ay.set_mixer(0, True, False, False)
+    ay.set_volume(0, 15)
+    return ay
+
+def test_process_block_stereo():
+    samples = 3000
+    ay = tone_ay()
+    outLeft  = np.zeros(samples, dtype=np.float32)
+    outRight = np.zeros(samples, dtype=np.float32)
+    ay.copy().process_block(outLeft, outRight, samples)
+
+    # out=None allocates an interleaved array
+    out = ay.copy().process_block_stereo(samples)
+    assert out.shape == (samples, 2) and out.dtype == np.float32 and out.flags.c_contiguous
+    np.testing.assert_array_equal(out[:, 0], outLeft)
+    np.testing.assert_array_equal(out[:, 1], outRight)
+
+    # given out is filled in place and returned, planar (2, samples) buffers work transposed
+    planar = np.zeros((2, samples + 10), dtype=np.float32)
+    assert ay.copy().process_block_stereo(samples, out=planar.T) is not None
+    np.testing.assert_array_equal(planar[:, :samples], out.T)
+
+    # strided 1-d views are accepted by process_block as well
+    interleaved = np.zeros((samples, 2), dtype=np.float32)
+    ay.copy().process_block(interleaved[:, 0], interleaved[:, 1], samples)
+    np.testing.assert_array_equal(interleaved, out)
+
+    with pytest.raises(ValueError):
+        ay.process_block_stereo(samples, out=np.zeros((samples - 1, 2), dtype=np.float32))
+    with pytest.raises(ValueError):
+        ay.process_block_stereo(samples, out=np.zeros((samples, 2), dtype=np.float64))
+    with pytest.raises(ValueError):
+        ay.process_block_stereo(samples, out=np.zeros((samples, 3), dtype=np.float32))
+    with pytest.raises(ValueError):
+        ay.process_block(interleaved[:, 0], outRight, samples)
+
+class DLPackOnly:
+    """Exposes an array through DLPack only, like torch.Tensor"""
+    def __init__(self, array):
+        self.array = array
+    def __dlpack__(self, stream=None):
+        return self.array.__dlpack__()
+
+def test_process_block_dlpack():
+    samples = 1000
+    ay = tone_ay()
+    expected = ay.copy().process_block_stereo(samples)
+
+    out = np.zeros((2, samples), dtype=np.float32).T
+    tensor = DLPackOnly(out)
+    assert ay.copy().process_block_stereo(samples, out=tensor) is tensor
+    np.testing.assert_array_equal(out, expected)
+
+    with pytest.raises(ValueError):
+        ay.process_block_stereo(samples, out=DLPackOnly(np.zeros((samples, 2), dtype=np.float64)))
+    with pytest.raises(ValueError):
+        ay.process_block_stereo(samples, out=object())
+
+def test_process_block_torch():
+    torch = pytest.importorskip("torch")
+    samples = 1000
+    ay = tone_ay()
+    expected = ay.copy().process_block_stereo(samples)
+    out = torch.zeros((samples, 2), dtype=torch.float32)
+    ay.copy().process_block_stereo(samples, out=out)
+    np.testing.assert_array_equal(out.numpy(), expected)
+
+def test_render_psg_stereo():
+    fps = 50
+    frames = 30
+    data, mask = random_psg(frames=frames, seed=7, shape_masked=0)
+    samples = int(math.ceil(frames / fps * 44100))
+
+    outLeft  = np.zeros(samples, dtype=np.float32)
+    outRight = np.zeros(samples, dtype=np.float32)
+    Ayumi().render_psg(data, mask, outLeft, outRight, fps)
+
+    out = Ayumi().render_psg_stereo(data, mask, fps)
+    assert out.shape == (samples, 2)
+    np.testing.assert_array_equal(out[:, 0], outLeft)
+    np.testing.assert_array_equal(out[:, 1], outRight)
+
+    interleaved = np.zeros((samples, 2), dtype=np.float32)
+    Ayumi().render_psg(data, mask, interleaved[:, 0], interleaved[:, 1], fps)
+    np.testing.assert_array_equal(interleaved, out)
+
+@pytest.mark.parametrize("fps,chunk", [(50, 4096), (48.7, 1000), (50, 1)])
+def test_stream_psg(fps, chunk):
+    frames = 30
+    psg, mask = random_psg(frames=frames, seed=7, shape_masked=1)
+    samples = round(frames * 44100 / fps)
+    full = Ayumi().render_psg_stereo(psg, mask, fps)[:samples]
+
+    chunks = [c.copy() for c in Ayumi().stream_psg(psg, mask, fps, chunk_samples=chunk)]
+    assert all(len(c) == chunk for c in chunks[:-1])
+    assert 0 < len(chunks[-1]) <= chunk
+    np.testing.assert_array_equal(np.concatenate(chunks), full)
+
+def test_stream_psg_reuses_chunk():
+    psg = np.zeros((10, 14), dtype=np.uint8)
+    mask = np.zeros((10, 14), dtype=bool)
+    stream = Ayumi().stream_psg(psg, mask, 50, chunk_samples=256)
+    first = next(stream)
+    assert first.shape == (256, 2) and first.dtype == np.float32
+    assert next(stream) is first
+    with pytest.raises(ValueError):
+        Ayumi().stream_psg(psg, mask, 50, chunk_samples=0)
+
+def test_render_events():
+    rng = np.random.default_rng(3)
+    samples = 20000
+    times = np.sort(rng.choice(np.arange(1, samples), size=300, replace=False))
+    registers = rng.integers(0, 13, size=300)
+    values = rng.integers(0, 256, size=300)
+    ay = tone_ay()
+
+    out = ay.copy().render_events(times, registers, values, samples=samples, unit="sample")
+    assert out.shape == (samples, 2)
+
+    # writes at whole samples give the same as splitting blocks there
+    expected = np.zeros((samples, 2), dtype=np.float32)
+    split = ay.copy()
+    pos = 0
+    for time, reg, value in zip(times, registers, values):
+        if time > pos:
+            split.process_block_stereo(time - pos, out=expected[pos:time])
+            pos = time
+        split.R[reg] = value
+    split.process_block_stereo(samples - pos, out=expected[pos:])
+    np.testing.assert_array_equal(out, expected)
+
+    clock_times = times * (ay.get_clock() / ay.get_sample_rate())
+    np.testing.assert_allclose(ay.copy().render_events(clock_times, registers, values, samples=samples), out, atol=1e-6)
+
+    # by default the block ends right after the last write
+    assert ay.copy().render_events([10.5], [8], [0], unit="sample").shape == (11, 2)
+
+def test_render_events_sub_sample():
+    ay = Ayumi()
+    ay.R[7] = 0b00111111
+    ay.R[8] = 15
+    early = ay.copy().render_events([1000.3], [8], [0], samples=2000, unit="sample")
+    late = ay.copy().render_events([1000.7], [8], [0], samples=2000, unit="sample")
+    np.testing.assert_array_equal(early[:1000], late[:1000])
+    # the later write keeps the volume up for a couple more chip ticks
+    assert late[1000:1020, 0].sum() > early[1000:1020, 0].sum()
+
+def test_render_events_errors():
+    ay = Ayumi()
+    with pytest.raises(ValueError):
+        ay.render_events([20, 10], [0, 0], [1, 1])
+    with pytest.raises(ValueError):
+        ay.render_events([-1], [0], [1])
+    with pytest.raises(ValueError):
+        ay.render_events([10], [0, 1], [1])
+    with pytest.raises(IndexError):
+        ay.render_events([10], [14], [1])
+    with pytest.raises(ValueError):
+        ay.render_events([1000], [0], [1], samples=10, unit="sample")
+    with pytest.raises(ValueError):
+        ay.render_events([10], [0], [1], unit="seconds")
+
+def test_advance_ticks():
+    ay = Ayumi(type=ChipType.AY)
+    ay.R[0] = 100                   # tone repeats every 200 ticks
+    ay.R[6] = 1                     # noise LFSR repeats every 2 * (2 ** 17 - 1) ticks
+    ay.R[7] = 0b00110110
+    ay.R[8] = 15
+    ay.R[9] = 16
+    ay.R[11] = 1
+    ay.R[13] = 8                    # envelope repeats every 32 ticks
+    bypass_initial_click(ay)
+    expected = ay.copy().process_block_stereo(4410)
+    # whole periods of all the generators leave the chip as it was
+    ay.advance_ticks(1000 * 800 * (2 ** 17 - 1))
+    np.testing.assert_array_equal(ay.process_block_stereo(4410), expected)
+
+def test_skip():
+    ay = Ayumi(type=ChipType.AY, clock=1773400)
+    for reg, value in enumerate([0x5d, 1, 0x31, 0, 0xa0, 2, 7, 0x30, 15, 16, 12, 0x40, 0, 14]):
+        ay.R[reg] = value
+    skipped = ay.copy()
+    expected = ay.process_block_stereo(441000 + 4096)[441000:]
+    skipped.skip(441000)
+    np.testing.assert_allclose(skipped.process_block_stereo(4096), expected, atol=1e-6)
+
+def test_seek_psg():
+    fps = 50
+    psg, mask = random_psg(frames=1500, seed=8, masked=0.5, shape_masked=0.5)
+    ay = Ayumi()
+    full = ay.copy().render_psg_stereo(psg, mask, fps)
+    ay.seek_psg(psg, mask, fps, 1000)
+    rest = ay.render_psg_stereo(psg[1000:], mask[1000:], fps)
+    np.testing.assert_allclose(rest, full[44100 * 1000 // fps:], atol=1e-6)
+
+    with pytest.raises(IndexError):
+        ay.seek_psg(psg, mask, fps, 1501)
+
+def state_ay(precision=Precision.FLOAT64):
+    ay = Ayumi(sample_rate=48000, clock=1773400, type=ChipType.AY, precision=precision)
+    for reg, value in enumerate([0x5d, 1, 0x31, 0, 0xa0, 2, 7, 0x30, 15, 16, 12, 0x40, 0, 14]):
+        ay.R[reg] = value
+    ay.set_pan(1, 0.3, True)
+    ay.set_master_volume(0.7)
+    ay.process_block_stereo(3333)
+    return ay
+
+@pytest.mark.parametrize("precision", [Precision.FLOAT64, Precision.FLOAT32])
+def test_save_state(precision):
+    ay = state_ay(precision)
+    full = ay.save_state()
+    compact = ay.save_state(compact=True)
+    assert len(compact) < 100 < len(full)
+
+    restored = Ayumi()
+    restored.load_state(full)
+    assert restored.get_precision() == precision
+    assert restored.get_sample_rate() == 48000
+    assert restored.get_pan(1) == 0.3
+    expected = ay.process_block_stereo(5000)
+    np.testing.assert_array_equal(restored.process_block_stereo(5000), expected)
+
+    # without the filter history the output is the same once the filters are filled again
+    restored.load_state(compact)
+    np.testing.assert_allclose(restored.process_block_stereo(5000)[1200:], expected[1200:], atol=1e-6)
+
+def test_save_state_errors():
+    ay = Ayumi()
+    state = state_ay().save_state(compact=True)
+    with pytest.raises(ValueError):
+        ay.load_state(state[:-1])
+    with pytest.raises(ValueError):
+        ay.load_state(state + b"\0")
+    with pytest.raises(ValueError):
+        ay.load_state(b"XXXX" + state[4:])
+
+def test_save_state_fresh():
+    ay = Ayumi()
+    restored = Ayumi()
+    restored.load_state(ay.save_state())
+    np.testing.assert_array_equal(restored.process_block_stereo(1000), ay.process_block_stereo(1000))
+
+def test_pickle():
+    ay = state_ay()
+    restored = pickle.loads(pickle.dumps(ay))
+    np.testing.assert_array_equal(restored.process_block_stereo(1000), ay.process_block_stereo(1000))
+
+def test_render_psg_stems():
+    psg, mask = random_psg(frames=100, seed=10, masked=0.5, shape_masked=0.5)
+    ay = Ayumi()
+    stereo = ay.copy().render_psg_stereo(psg, mask, 50)
+    stems = ay.copy().render_psg_stems(psg, mask, 50)
+    assert stems.shape == (3, 44100 * 2) and stems.dtype == np.float32
+    # everything after the chip is linear, so the stereo mix is the panned sum of the stems
+    pans = np.array([ay.get_pan(i) for i in range(3)])
+    np.testing.assert_allclose(stereo[:, 0], (1 - pans) @ stems, atol=1e-6)
+    np.testing.assert_allclose(stereo[:, 1], pans @ stems, atol=1e-6)
+
+    out = np.zeros((44100 * 2, 3), dtype=np.float32)
+    ay.copy().render_psg_stems(psg, mask, 50, out=out.T)
+    np.testing.assert_array_equal(out.T, stems)
+    with pytest.raises(ValueError):
+        ay.render_psg_stems(psg, mask, 50, out=out)
+
+def test_process_block_channels():
+    ay = tone_ay()
+    ay.set_tone_period(1, 150)
+    ay.set_mixer(1, True, False, False)
+    ay.set_volume(1, 15)
+    channels = ay.process_block_channels(4410)
+    assert np.abs(channels[0]).max() > 0.3
+    assert np.abs(channels[1]).max() > 0.3
+    assert np.abs(channels[2]).max() == 0
+
+def test_stats():
+    psg = np.zeros((10, 14), dtype=np.uint8)
+    psg[:, 7] = 0b00111110
+    psg[:, 8] = 15
+    psg[:, 0] = 100
+    mask = np.zeros((10, 14), dtype=bool)
+    mask[1:, 13] = True
+    ay = Ayumi(44100, 2000000, ChipType.AY)
+    ay.render_psg_stereo(psg, mask, 50)
+    stats = ay.stats()
+    assert set(stats) == {"samples", "blocks", "ticks", "steady_ticks", "register_writes", "envelope_resets",
+                          "mixer_cycles", "interpolation_cycles", "fir_cycles", "dc_cycles"}
+    if not STATS_ENABLED:
+        assert all(v == 0 for v in stats.values())
+        return
+    assert stats["samples"] == 8820
+    assert stats["blocks"] == 10
+    assert stats["ticks"] == pytest.approx(2000000 / 8 / 5, abs=1)
+    assert 0 < stats["steady_ticks"] < stats["ticks"]
+    assert stats["register_writes"] == 10 * 13 + 1
+    assert stats["envelope_resets"] == 1
+    assert all(stats[k] > 0 for k in ["mixer_cycles", "interpolation_cycles", "fir_cycles", "dc_cycles"])
+    # counters go on over copies and loaded states until reset_stats
+    copy = ay.copy()
+    copy.load_state(ay.save_state())
+    copy.process_block_stereo(100)
+    assert copy.stats()["samples"] == 8920
+    copy.reset_stats()
+    assert all(v == 0 for v in copy.stats().values())
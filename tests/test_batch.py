@@ -0,0 +1,91 @@
+import pytest
+import numpy as np
+
+from pyayay import Ayumi, AyumiBatch, ChipType, DcFilter
+
+from .conftest import random_psg
+
+
+def render_single(psg, mask, samples, fps, type, dc_filter="box"):
+    ay = Ayumi(type=type, dc_filter=dc_filter)
+    outLeft  = np.zeros(samples, dtype=np.float32)
+    outRight = np.zeros(samples, dtype=np.float32)
+    ay.render_psg(psg, mask, outLeft, outRight, fps)
+    return outLeft, outRight
+
+
+@pytest.mark.parametrize("chips", [1, 5, 8, 19])
+@pytest.mark.parametrize("type", [ChipType.AY, ChipType.YM])
+def test_batch_matches_single(chips, type):
+    fps = 50
+    frames = 20
+    psg, mask = random_psg(chips, frames, long_periods=True)
+    samples = 44100 * frames // fps
+
+    batch = AyumiBatch(chips, type=type)
+    assert len(batch) == chips
+    outLeft  = np.zeros((chips, samples), dtype=np.float32)
+    outRight = np.zeros((chips, samples), dtype=np.float32)
+    batch.render_psg(psg, mask, outLeft, outRight, fps)
+
+    for chip in range(chips):
+        left, right = render_single(psg[chip], mask[chip], samples, fps, type)
+        np.testing.assert_allclose(outLeft[chip], left, atol=1e-5)
+        np.testing.assert_allclose(outRight[chip], right, atol=1e-5)
+
+
+def test_batch_dc_filter():
+    fps = 50
+    frames = 20
+    psg, mask = random_psg(3, frames, seed=2, long_periods=True)
+    samples = 44100 * frames // fps
+
+    batch = AyumiBatch(3, dc_filter="iir")
+    assert batch.get_dc_filter() == DcFilter.IIR
+    outLeft  = np.zeros((3, samples), dtype=np.float32)
+    outRight = np.zeros((3, samples), dtype=np.float32)
+    batch.render_psg(psg, mask, outLeft, outRight, fps)
+    for chip in range(3):
+        left, right = render_single(psg[chip], mask[chip], samples, fps, ChipType.AY, "iir")
+        np.testing.assert_allclose(outLeft[chip], left, atol=1e-5)
+        np.testing.assert_allclose(outRight[chip], right, atol=1e-5)
+
+    batch.set_dc_filter(DcFilter.BOX)
+    assert batch.get_dc_filter() == DcFilter.BOX
+
+
+def test_batch_registers():
+    batch = AyumiBatch(3)
+    batch.set_register(2, 7, 0b00111110)
+    assert batch.get_register(2, 7) == 0b00111110
+    assert batch.get_register(1, 7) == 0
+
+    values = np.full((3, 14), 9, dtype=np.uint8)
+    mask = np.ones((3, 14), dtype=bool)
+    mask[:, 8] = False
+    batch.set_registers_masked(values, mask)
+    assert [batch.get_register(i, 8) for i in range(3)] == [9, 9, 9]
+    assert batch.get_register(2, 7) == 0b00111110
+
+    with pytest.raises(IndexError):
+        batch.set_register(3, 0, 0)
+    with pytest.raises(IndexError):
+        batch.get_register(0, 14)
+
+
+def test_batch_process_block():
+    batch = AyumiBatch(4)
+    for chip in range(4):
+        batch.set_register(chip, 0, 100 + chip)
+        batch.set_register(chip, 7, 0b00111110)
+        batch.set_register(chip, 8, 15)
+    # rows of a wider buffer are fine as long as they are contiguous
+    outLeft  = np.zeros((4, 8000), dtype=np.float32)[:, :4410]
+    outRight = np.zeros((4, 8000), dtype=np.float32)[:, :4410]
+    batch.process_block(outLeft, outRight, 4410)
+    assert np.all(np.abs(outLeft[:, 1000:]).mean(axis=1) > 0.1)
+
+    with pytest.raises(ValueError):
+        batch.process_block(outLeft[:3], outRight[:3], 4410)
+    with pytest.raises(ValueError):
+        batch.process_block(outLeft, outRight, 5000)
@@ -0,0 +1,77 @@
+import numpy as np
+import pytest
+
+from pyayay import Ayumi, Blep, ChipType
+
+from .conftest import random_psg
+
+
+def tone(ay):
+    ay.set_pan(0, 0.5)
+    ay.set_tone_period(0, 100)
+    ay.set_mixer(0, True, False, False)
+    ay.set_volume(0, 15)
+    return ay
+
+
+def render(ay, samples):
+    out = np.zeros((2, samples), dtype=np.float32)
+    ay.process_block(out[0], out[1], samples)
+    return out
+
+
+def best_correlation(a, b, max_lag=2 * Blep.BLEP_DELAY):
+    # Blep is delayed differently from Ayumi, so compare at the best lag
+    n = len(a) - max_lag
+    return max(np.corrcoef(a[max_lag:n], b[max_lag + lag:n + lag])[0, 1] for lag in range(-max_lag, max_lag + 1))
+
+
+def test_blep_settings():
+    ay = Blep(sample_rate=48000, clock=2000000, type=ChipType.YM)
+    assert ay.get_sample_rate() == 48000
+    assert ay.get_clock() == 2000000
+    assert ay.get_type() == ChipType.YM
+    ay.R[1] = 2
+    ay.R[0] = 10
+    assert ay.get_tone_period(0) == 0x20a
+    ay.set_pan(2, 0.3)
+    assert ay.get_pan(2) == pytest.approx(0.3)
+    ay.set_clock(1773400)
+    assert ay.get_clock() == 1773400
+
+
+def test_blep_silence():
+    out = render(Blep(), 44100)
+    assert np.abs(out).max() < 1e-6
+
+
+def test_blep_copy():
+    ay = tone(Blep())
+    render(ay, 1000)
+    copy = ay.copy()
+    np.testing.assert_array_equal(render(copy, 3000), render(ay, 3000))
+
+
+@pytest.mark.parametrize("type", [ChipType.AY, ChipType.YM])
+def test_blep_quality_tone(type):
+    samples = 44100
+    reference = render(tone(Ayumi(type=type)), samples)[:, 4410:]
+    blep = render(tone(Blep(type=type)), samples)[:, 4410:]
+    for o in range(2):
+        assert best_correlation(reference[o], blep[o]) > 0.98
+        assert np.sqrt(np.mean(blep[o] ** 2) / np.mean(reference[o] ** 2)) == pytest.approx(1, abs=0.02)
+
+
+def test_blep_quality_psg():
+    fps = 50
+    psg, mask = random_psg(frames=100, seed=3)
+    samples = 44100 * len(psg) // fps
+    outs = []
+    for ay in (Ayumi(), Blep()):
+        out = np.zeros((2, samples), dtype=np.float32)
+        ay.render_psg(psg, mask, out[0], out[1], fps)
+        outs.append(out[:, 4410:])
+    reference, blep = outs
+    for o in range(2):
+        assert best_correlation(reference[o], blep[o]) > 0.97
+        assert np.sqrt(np.mean(blep[o] ** 2) / np.mean(reference[o] ** 2)) == pytest.approx(1, abs=0.03)
@@ -0,0 +1,79 @@
+import numpy as np
+import pytest
+
+from pyayay import Ayumi, find_psg_loops
+
+from .conftest import random_psg
+
+
+def looped_song(intro=37, period=64, repeats=10, tail=20, noise=False, seed=5):
+    # random frames with a block of period frames repeated, the tone periods fit the loop exactly
+    frames = intro + period * repeats + tail
+
+    def random_frames(count, seed):
+        psg, mask = random_psg(frames=count, seed=seed, masked=0.3)
+        psg[:, 0:6] = [50, 0, 125, 0, 244, 1]  # 50, 125 and 500
+        if not noise:
+            psg[:, 7] |= 0b111000
+        return psg, mask
+
+    psg, mask = np.zeros((frames, 14), dtype=np.uint8), np.zeros((frames, 14), dtype=bool)
+    psg[:intro + period], mask[:intro + period] = random_frames(intro + period, seed)
+    mask[intro, 13] = False   # the loop restarts the envelope
+    for i in range(1, repeats):
+        psg[intro + i * period:intro + (i + 1) * period] = psg[intro:intro + period]
+        mask[intro + i * period:intro + (i + 1) * period] = mask[intro:intro + period]
+    psg[frames - tail:], mask[frames - tail:] = random_frames(tail, seed + 1)
+    return psg, mask
+
+
+def test_find_loops():
+    psg, mask = looped_song()
+    assert find_psg_loops(psg, mask) == [(37, 64, 677)]
+    # the values of masked registers do not matter
+    scrambled = psg.copy()
+    scrambled[mask] = np.random.default_rng(1).integers(0, 256, size=mask.sum(), dtype=np.uint8)
+    assert find_psg_loops(scrambled, mask) == [(37, 64, 677)]
+    # two times through are not a loop yet
+    assert find_psg_loops(psg[:37 + 128], mask[:37 + 128]) == []
+    assert find_psg_loops(psg[:37 + 192], mask[:37 + 192]) == [(37, 64, 229)]
+
+
+def test_render_looped():
+    psg, mask = looped_song()
+    ay = Ayumi(sample_rate=44100, clock=2000000)
+    expected_ay = ay.copy()
+    expected = expected_ay.render_psg_stereo(psg, mask, 50)
+    audio, copied = ay.render_psg_looped(psg, mask, 50)
+    assert audio.shape == expected.shape
+    assert copied >= 5 * 64
+    np.testing.assert_allclose(audio, expected, atol=1e-6)
+    # the chip goes on from the same state
+    more, more_mask = looped_song(seed=6)
+    np.testing.assert_allclose(ay.render_psg_stereo(more[:50], more_mask[:50], 50),
+                               expected_ay.render_psg_stereo(more[:50], more_mask[:50], 50), atol=1e-6)
+
+    out = np.zeros_like(expected)
+    result, _ = Ayumi(sample_rate=44100, clock=2000000).render_psg_looped(psg, mask, 50, out=out)
+    assert result is out
+    np.testing.assert_array_equal(out, audio)
+
+
+def test_render_looped_fallback():
+    # the noise LFSR does not come back to the same state, so every frame is emulated
+    psg, mask = looped_song(noise=True)
+    ay = Ayumi(sample_rate=44100, clock=2000000)
+    expected = ay.copy().render_psg_stereo(psg, mask, 50)
+    audio, copied = ay.render_psg_looped(psg, mask, 50)
+    assert copied == 0
+    np.testing.assert_array_equal(audio, expected)
+
+
+def test_loop_errors():
+    psg, mask = looped_song()
+    with pytest.raises(ValueError):
+        find_psg_loops(psg, mask, min_period=0)
+    with pytest.raises(ValueError):
+        Ayumi().render_psg_looped(psg, mask, 50, min_period=0)
+    with pytest.raises(ValueError):
+        find_psg_loops(psg[:, :13], mask[:, :13])
@@ -0,0 +1,81 @@
+import numpy as np
+import pytest
+
+from pyayay import Ayumi, RandomPSGConfig
+
+
+def test_random_psg_reproducible():
+    ay = Ayumi()
+    psg, mask, audio = ay.render_random_psg(6, 100, seed=3)
+    assert psg.shape == (6, 100, 14) and psg.dtype == np.uint8
+    assert mask.shape == (6, 100, 14) and mask.dtype == bool
+    assert audio.shape == (6, 88200, 2) and audio.dtype == np.float32
+
+    # the same seed gives the same dataset, made at once or in parts, on any number of threads
+    again, again_mask, again_audio = ay.render_random_psg(6, 100, seed=3, threads=1)
+    np.testing.assert_array_equal(again, psg)
+    np.testing.assert_array_equal(again_mask, mask)
+    np.testing.assert_array_equal(again_audio, audio)
+    part, _, part_audio = ay.render_random_psg(2, 100, seed=3, first=4)
+    np.testing.assert_array_equal(part, psg[4:])
+    np.testing.assert_array_equal(part_audio, audio[4:])
+
+    other, _, _ = ay.render_random_psg(6, 100, seed=4)
+    assert not np.array_equal(other, psg)
+    assert not np.array_equal(psg[0], psg[1])
+
+
+def test_random_psg_audio_matches_render_psg():
+    ay = Ayumi(sample_rate=48000)
+    ay.set_pan(0, 0.1)
+    psg, mask, audio = ay.render_random_psg(3, 60, fps=60, seed=1)
+    for i in range(3):
+        expected = ay.copy().render_psg_stereo(psg[i], mask[i], 60)
+        np.testing.assert_array_equal(audio[i], expected)
+    assert np.abs(audio).max() > 0.01
+
+
+def test_random_psg_config():
+    config = RandomPSGConfig()
+    config.notes = False
+    config.tone_period_min = 200
+    config.tone_period_max = 300
+    config.noise_chance = 0
+    config.envelope_chance = 1
+    config.envelope_shapes = 1 << 14
+    config.rest_chance = 0
+    psg, mask, _ = Ayumi().render_random_psg(4, 200, seed=2, config=config)
+
+    periods = psg[:, :, 0:6:2] + 256 * psg[:, :, 1:6:2].astype(int)
+    assert periods.min() >= 200 and periods.max() <= 300
+    assert np.all((psg[:, :, 7] & 0b111000) == 0b111000)  # noise off
+    assert np.all(psg[:, :, 8:11] & 0x10)                  # envelope on
+    assert np.all(psg[:, :, 13] == 14)
+    assert not mask[:, 0].any()
+    # R13 restarts the envelope, so it is written only when a note starts
+    assert mask[:, 1:, 13].mean() > 0.3
+
+    notes = RandomPSGConfig()
+    notes.tone_period_min = 100
+    notes.tone_period_max = 1000
+    psg, _, _ = Ayumi(clock=1773400).render_random_psg(4, 200, seed=2, config=notes)
+    periods = psg[:, :, 0:6:2] + 256 * psg[:, :, 1:6:2].astype(int)
+    semitones = 12 * np.log2(1773400 / (16 * 440 * periods))
+    assert np.abs(semitones - np.round(semitones)).max() < 0.1
+
+
+def test_random_psg_errors():
+    config = RandomPSGConfig()
+    config.tone_period_min = 0
+    with pytest.raises(ValueError):
+        Ayumi().render_random_psg(1, 10, config=config)
+    config = RandomPSGConfig()
+    config.note_chance = 1.5
+    with pytest.raises(ValueError):
+        Ayumi().render_random_psg(1, 10, config=config)
+    config = RandomPSGConfig()
+    config.envelope_shapes = 0
+    with pytest.raises(ValueError):
+        Ayumi().render_random_psg(1, 10, config=config)
+    with pytest.raises(ValueError):
+        Ayumi().render_random_psg(1, 0)
@@ -0,0 +1,107 @@
+import time
+
+import pytest
+import numpy as np
+
+from pyayay import Ayumi, RealtimeAyumi
+
+from .conftest import random_psg
+
+
+def random_writes(samples, count, seed=1):
+    # one register of a random PSG frame per write
+    rng = np.random.default_rng(seed)
+    times = np.sort(rng.uniform(0, samples, count))
+    registers = rng.integers(0, 13, count).astype(np.uint8)
+    psg, _ = random_psg(frames=count, seed=seed)
+    return times, registers, psg[np.arange(count), registers]
+
+
+def wait_latency(stream, samples, timeout=10):
+    deadline = time.monotonic() + timeout
+    while stream.get_latency() < samples:
+        assert time.monotonic() < deadline, "render thread did not fill the buffer"
+        time.sleep(0.001)
+
+
+def test_stream_matches_render_events():
+    samples = 8192
+    ay = Ayumi()
+    times, registers, values = random_writes(samples, 300)
+    expected = ay.copy().render_events(times, registers, values, samples=samples, unit="sample")
+
+    stream = RealtimeAyumi(ay, buffer_samples=samples, block_samples=256)
+    for t, r, v in zip(times, registers, values):
+        assert stream.write(t, int(r), int(v))
+    with stream:
+        wait_latency(stream, samples)
+        out = np.zeros((samples, 2), dtype=np.float32)
+        assert stream.pull(out) == samples
+    assert np.allclose(out, expected, atol=1e-6)
+    assert stream.get_position() == samples
+    assert stream.get_underruns() == 0
+    assert stream.get_late_writes() == 0
+
+
+def test_stream_pulls_in_small_blocks():
+    samples = 4096
+    ay = Ayumi()
+    times, registers, values = random_writes(samples, 100, seed=2)
+    expected = ay.copy().render_events(times, registers, values, samples=samples, unit="sample")
+
+    stream = RealtimeAyumi(ay, buffer_samples=samples, block_samples=64)
+    for t, r, v in zip(times, registers, values):
+        stream.write(t, int(r), int(v))
+    with stream:
+        wait_latency(stream, samples)
+        blocks = [np.zeros((100, 2), dtype=np.float32) for _ in range(samples // 100)]
+        for block in blocks:
+            assert stream.pull(block) == 100
+    out = np.concatenate(blocks)
+    assert np.allclose(out, expected[:len(out)], atol=1e-6)
+
+
+def test_underrun():
+    stream = RealtimeAyumi(Ayumi())
+    out = np.ones((256, 2), dtype=np.float32)
+    assert stream.pull(out) == 0
+    assert np.all(out == 0)
+    assert stream.get_underruns() == 1
+    assert stream.get_position() == 0
+
+
+def test_late_writes():
+    stream = RealtimeAyumi(Ayumi(), buffer_samples=1024, block_samples=256)
+    with stream:
+        wait_latency(stream, 1024)
+        stream.write(0, 8, 15)
+        deadline = time.monotonic() + 10
+        out = np.zeros((256, 2), dtype=np.float32)
+        while stream.get_late_writes() == 0:
+            assert time.monotonic() < deadline
+            stream.pull(out)
+            time.sleep(0.001)
+
+
+def test_queue_full():
+    stream = RealtimeAyumi(Ayumi(), queue_size=4)
+    for i in range(4):
+        assert stream.write(i, 8, 15)
+    assert not stream.write(4, 8, 15)
+    assert stream.get_dropped_writes() == 1
+
+
+def test_write_bounds():
+    stream = RealtimeAyumi(Ayumi())
+    with pytest.raises(IndexError):
+        stream.write(0, 14, 0)
+    with pytest.raises(ValueError):
+        RealtimeAyumi(Ayumi(), block_samples=0)
+
+
+def test_output_layout():
+    stream = RealtimeAyumi(Ayumi())
+    with pytest.raises(ValueError):
+        stream.pull(np.zeros((256, 2), dtype=np.float64))
+    with pytest.raises(ValueError):
+        stream.pull(np.zeros((2, 256), dtype=np.float32))
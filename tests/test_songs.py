@@ -0,0 +1,148 @@
+import os
+import struct
+
+import pytest
+import numpy as np
+
+from pyayay import Ayumi, ChipType, Song, SongFormat
+
+DATA = os.path.join(os.path.dirname(__file__), "data")
+FRAMES = 500
+
+
+def song_registers(frames=FRAMES):
+    """Registers and mask of the song in data/song.ym and data/song.vtx"""
+    i = np.arange(frames)
+    regs = np.zeros((frames, 14), dtype=np.uint8)
+    regs[:, 0] = (i * 7) & 0xff
+    regs[:, 1] = (i // 64) & 0x0f
+    regs[:, 2] = (i * 3) & 0xff
+    regs[:, 3] = 1
+    regs[:, 4] = 200
+    regs[:, 5] = (i // 100) & 0x0f
+    regs[:, 6] = i & 0x1f
+    regs[:, 7] = 0b00111000
+    regs[:, 8] = 15
+    regs[:, 9] = i % 16
+    regs[:, 10] = 0x10
+    regs[:, 11] = 0x34
+    regs[:, 12] = 0x01
+    regs[:, 13] = (i // 64) % 16
+    mask = np.zeros((frames, 14), dtype=bool)
+    mask[:, 13] = i % 64 != 0
+    return regs, mask
+
+
+def write_psg(regs, mask):
+    data = bytearray(b"PSG\x1a" + bytes([10, 50]) + bytes(10))
+    for frame, frame_mask in zip(regs, mask):
+        data.append(0xff)
+        for reg in np.flatnonzero(~frame_mask):
+            data += bytes([reg, frame[reg]])
+    return bytes(data)
+
+
+def write_ym6(regs, mask, interleaved=True):
+    frames = len(regs)
+    table = np.zeros((frames, 16), dtype=np.uint8)
+    table[:, :14] = regs
+    table[:, 13][mask[:, 13]] = 0xff
+    data = b"YM6!LeOnArD!" + struct.pack(">IIHIHIH", frames, int(interleaved), 0, 2000000, 50, 7, 0)
+    data += b"Title\0Author\0Comment\0"
+    data += (table.T if interleaved else table).tobytes() + b"End!"
+    return data
+
+
+def test_psg():
+    regs, mask = song_registers()
+    song = Song.from_bytes(write_psg(regs, mask))
+    assert song.format == SongFormat.PSG
+    assert len(song) == FRAMES
+    assert song.fps == 50
+    song_regs, song_mask = song.to_arrays()
+    np.testing.assert_array_equal(song_mask, mask)
+    np.testing.assert_array_equal(song_regs, regs)
+
+
+def test_psg_commands():
+    # writes before the first 0xff go to the first frame, 0xfe 1 is 4 frames, 0xfd ends the song
+    data = b"PSG\x1a" + bytes(12) + bytes([0, 10, 0xff, 1, 2, 0xfe, 1, 8, 15, 0xff, 0xfd, 0xff, 9, 9])
+    regs, mask = Song.from_bytes(data).to_arrays()
+    assert regs.shape == (6, 14)
+    assert list(np.flatnonzero(~mask.all(axis=1))) == [0, 1, 5]
+    assert regs[0, 0] == 10 and regs[1, 1] == 2 and regs[5, 8] == 15
+    # unwritten registers keep the last written value
+    assert regs[3, 0] == 10 and regs[3, 1] == 2
+
+
+@pytest.mark.parametrize("interleaved", [True, False])
+def test_ym(interleaved):
+    regs, mask = song_registers()
+    song = Song.from_bytes(write_ym6(regs, mask, interleaved))
+    assert song.format == SongFormat.YM
+    assert song.type == ChipType.YM
+    assert song.clock == 2000000
+    assert song.loop_frame == 7
+    assert (song.title, song.author, song.comment) == ("Title", "Author", "Comment")
+    song_regs, song_mask = song.to_arrays()
+    np.testing.assert_array_equal(song_mask, mask)
+    np.testing.assert_array_equal(song_regs, regs)
+
+
+@pytest.mark.parametrize("name", ["song.ym", "song.vtx"])
+def test_packed_files(name):
+    regs, mask = song_registers()
+    song = Song(os.path.join(DATA, name))
+    assert len(song) == FRAMES
+    song_regs, song_mask = song.to_arrays()
+    np.testing.assert_array_equal(song_mask, mask)
+    np.testing.assert_array_equal(song_regs, regs)
+
+
+def test_lazy_frames():
+    regs, mask = song_registers()
+    song = Song(os.path.join(DATA, "song.ym"))
+    for i, (frame_regs, frame_mask) in enumerate(song):
+        np.testing.assert_array_equal(frame_regs, regs[i])
+        np.testing.assert_array_equal(frame_mask, mask[i])
+    assert i == FRAMES - 1
+
+
+def test_render_song():
+    regs, mask = song_registers()
+    song = Song(os.path.join(DATA, "song.vtx"))
+    assert song.type == ChipType.AY and song.clock == 1773400 and song.fps == 50
+
+    ay = Ayumi(clock=song.clock, type=song.type)
+    out = ay.copy().render_song(song)
+    expected = ay.render_psg_stereo(regs, mask, song.fps)
+    np.testing.assert_array_equal(out, expected)
+
+
+def test_bad_files():
+    with pytest.raises(RuntimeError):
+        Song.from_bytes(b"not a song at all")
+    with pytest.raises(RuntimeError):
+        Song(os.path.join(DATA, "missing.psg"))
+    packed = open(os.path.join(DATA, "song.ym"), "rb").read()
+    with pytest.raises(RuntimeError):
+        Song.from_bytes(packed[:len(packed) // 2])
+    vtx = open(os.path.join(DATA, "song.vtx"), "rb").read()
+    with pytest.raises(RuntimeError):
+        Song.from_bytes(vtx[:len(vtx) // 2])
+    # the unpacked size is not trusted beyond what the packed data can hold
+    with pytest.raises(RuntimeError):
+        Song.from_bytes(vtx[:12] + struct.pack("<I", 200_000_000) + vtx[16:])
+
+
+def test_zero_frame_rate():
+    # a frame rate of 0 means the default 50, like in PSG files
+    regs, mask = song_registers()
+    ym = bytearray(write_ym6(regs, mask))
+    ym[26:28] = bytes(2)
+    assert Song.from_bytes(bytes(ym)).fps == 50
+    vtx = bytearray(open(os.path.join(DATA, "song.vtx"), "rb").read())
+    vtx[9] = 0
+    song = Song.from_bytes(bytes(vtx))
+    assert song.fps == 50
+    assert Ayumi().render_song(song).shape == (44100 * FRAMES // 50, 2)
@@ -0,0 +1,72 @@
+import numpy as np
+import pytest
+
+from pyayay import Ayumi, TurboSound, ChipType, Precision
+
+from .conftest import random_psg
+
+
+@pytest.mark.parametrize("precision", [Precision.FLOAT64, Precision.FLOAT32])
+@pytest.mark.parametrize("dc_filter", ["box", "iir"])
+def test_single_chip_matches_ayumi(precision, dc_filter):
+    psg, mask = random_psg(1, 100, seed=5)
+    ts = TurboSound(1, precision=precision, dc_filter=dc_filter)
+    assert ts.get_dc_filter() == Ayumi(dc_filter=dc_filter).get_dc_filter()
+    out = ts.render_psg_stereo(psg, mask, 50)
+    expected = Ayumi(precision=precision, dc_filter=dc_filter).render_psg_stereo(psg[0], mask[0], 50)
+    np.testing.assert_array_equal(out, expected)
+
+
+def test_mix_matches_sum_of_chips():
+    chips = 3
+    psg, mask = random_psg(chips, 100, seed=5)
+    ts = TurboSound(chips)
+    expected = 0
+    for i in range(chips):
+        ay = Ayumi()
+        ts.select_chip(i)
+        for target in (ts, ay):
+            target.set_clock(1773400 + 250000 * i)
+            target.set_pan(0, 0.2 * i)
+            target.set_pan(2, 1 - 0.3 * i, True)
+        expected = expected + ay.render_psg_stereo(psg[i], mask[i], 50)
+    ts.set_master_volume(0.5)
+    out = ts.render_psg_stereo(psg, mask, 50)
+    np.testing.assert_allclose(out, 0.5 * expected, atol=1e-5)
+
+    left = np.zeros(len(out), dtype=np.float32)
+    right = np.zeros(len(out), dtype=np.float32)
+    TurboSound(chips).render_psg(psg, mask, left, right, 50)
+    stereo = TurboSound(chips).render_psg_stereo(psg, mask, 50)
+    np.testing.assert_array_equal(left, stereo[:, 0])
+    np.testing.assert_array_equal(right, stereo[:, 1])
+
+
+def test_registers_go_to_selected_chip():
+    ts = TurboSound(2)
+    assert len(ts) == 2
+    ts.select_chip(1)
+    ts.R[8] = 15
+    ts.set_tone_period(0, 300)
+    assert ts.get_selected_chip() == 1
+    assert ts.R[8] == 15
+    ts.select_chip(0)
+    assert ts.R[8] == 0
+    assert ts.get_tone_period(0) != 300
+
+    copy = ts.copy()
+    copy.select_chip(1)
+    assert copy.R[8] == 15
+
+
+def test_errors():
+    with pytest.raises(ValueError):
+        TurboSound(0)
+    ts = TurboSound(2)
+    with pytest.raises(IndexError):
+        ts.select_chip(2)
+    psg, mask = random_psg(3, 10, seed=5)
+    with pytest.raises(ValueError):
+        ts.render_psg_stereo(psg, mask, 50)
+    with pytest.raises(ValueError):
+        ts.render_psg_stereo(psg[0], mask[0], 50)